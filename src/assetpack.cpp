@@ -0,0 +1,259 @@
+#include "assetpack.h"
+#include "utils.h"
+
+#ifdef WIN32
+	#include <windows.h>
+#else
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+#endif
+
+AssetPack::AssetPack()
+{
+	data = NULL;
+	size = 0;
+	synth = NULL;
+}
+
+AssetPack::~AssetPack()
+{
+	unmount();
+}
+
+//writes zeros till the file position is aligned
+static void alignFile(FILE* f)
+{
+	static const char zeros[ASSETPACK_ALIGNMENT] = { 0 };
+	long pos = ftell(f);
+	long padding = (ASSETPACK_ALIGNMENT - pos % ASSETPACK_ALIGNMENT) % ASSETPACK_ALIGNMENT;
+	fwrite(zeros, 1, padding, f);
+}
+
+bool AssetPack::build(const char* filename, const std::vector<std::string>& files)
+{
+	std::vector<sPackEntry> entries;
+	std::vector<Image*> loaded_images;
+	Synth synth; //used to decode and convert the WAVs
+
+	//decode everything first, so we know the size of the table
+	for (int i = 0; i < files.size(); ++i)
+	{
+		const std::string& name = files[i];
+		if (name.size() >= sizeof(sPackEntry::name))
+		{
+			std::cerr << "Asset name too long for the pack: " << name << std::endl;
+			continue;
+		}
+		sPackEntry entry;
+		memset(&entry, 0, sizeof(entry));
+		strcpy(entry.name, name.c_str());
+
+		std::string ext = name.size() > 4 ? name.substr(name.size() - 4) : "";
+		if (ext == ".tga")
+		{
+			Image* img = new Image();
+			if (!img->loadTGA(name.c_str()))
+			{
+				delete img;
+				continue;
+			}
+			entry.type = IMAGE;
+			entry.width = img->width;
+			entry.height = img->height;
+			entry.size = img->width * img->height * sizeof(Color);
+			loaded_images.push_back(img);
+		}
+		else if (ext == ".wav")
+		{
+			Synth::Sample* sample = synth.loadSample(name);
+			if (!sample)
+				continue;
+			entry.type = SAMPLE;
+			entry.length = sample->length;
+			entry.size = sample->length * sizeof(float);
+		}
+		else
+			continue;
+		entries.push_back(entry);
+	}
+
+	FILE* f = fopen(filename, "wb");
+	if (!f)
+	{
+		std::cerr << "Cannot create asset pack: " << filename << std::endl;
+		for (int i = 0; i < loaded_images.size(); ++i)
+			delete loaded_images[i];
+		return false;
+	}
+
+	//compute offsets
+	uint32 offset = sizeof(sPackHeader) + entries.size() * sizeof(sPackEntry);
+	for (int i = 0; i < entries.size(); ++i)
+	{
+		offset = (offset + ASSETPACK_ALIGNMENT - 1) & ~(ASSETPACK_ALIGNMENT - 1);
+		entries[i].offset = offset;
+		offset += entries[i].size;
+	}
+
+	sPackHeader header;
+	memcpy(header.magic, "PACK", 4);
+	header.version = ASSETPACK_VERSION;
+	header.num_entries = entries.size();
+	header.reserved = 0;
+	fwrite(&header, sizeof(header), 1, f);
+	if(entries.size())
+		fwrite(&entries[0], sizeof(sPackEntry), entries.size(), f);
+
+	//write the data in the same order
+	int image_index = 0;
+	for (int i = 0; i < entries.size(); ++i)
+	{
+		sPackEntry& entry = entries[i];
+		alignFile(f);
+		if (entry.type == IMAGE)
+		{
+			Image* img = loaded_images[image_index++];
+			fwrite(img->pixels, 1, entry.size, f);
+			delete img;
+		}
+		else
+			fwrite(synth.samples[entry.name]->buffer, 1, entry.size, f);
+	}
+
+	fclose(f);
+	std::cout << " + Asset pack created: " << filename << " (" << entries.size() << " assets, " << offset / 1024 << " KB)" << std::endl;
+	return true;
+}
+
+//the entry is inside the mapped file and its size is the one of its asset, a corrupt or truncated pack is not read out of bounds
+bool AssetPack::isValidEntry(const sPackEntry& entry) const
+{
+	if (!memchr(entry.name, 0, sizeof(entry.name)) || entry.offset % ASSETPACK_ALIGNMENT || entry.offset > size || entry.size > size - entry.offset)
+		return false;
+	if (entry.type == IMAGE)
+		return entry.width && entry.height && entry.width <= 16384 && entry.height <= 16384 &&
+			(uint64)entry.width * entry.height * sizeof(Color) == entry.size;
+	if (entry.type == SAMPLE)
+		return (uint64)entry.length * sizeof(float) == entry.size;
+	return true; //unknown types are skipped
+}
+
+bool AssetPack::mount(const char* filename, Synth* synth)
+{
+	unmount();
+
+#ifdef WIN32
+	HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER file_size;
+	GetFileSizeEx(file, &file_size);
+	//copy on write, so images can still be modified (p.e. maskAlpha) without touching the file
+	HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+	CloseHandle(file);
+	if (!mapping)
+		return false;
+	data = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+	CloseHandle(mapping);
+	if (!data)
+		return false;
+	size = (size_t)file_size.QuadPart;
+#else
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return false;
+	struct stat info;
+	fstat(fd, &info);
+	size = info.st_size;
+	//copy on write, so images can still be modified (p.e. maskAlpha) without touching the file
+	data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+	{
+		data = NULL;
+		return false;
+	}
+#endif
+
+	sPackHeader* header = (sPackHeader*)data;
+	if (size < sizeof(sPackHeader) || memcmp(header->magic, "PACK", 4) != 0 || header->version != ASSETPACK_VERSION ||
+		header->num_entries > (size - sizeof(sPackHeader)) / sizeof(sPackEntry))
+	{
+		std::cerr << "Asset pack is not valid or has a different version: " << filename << std::endl;
+		unmount();
+		return false;
+	}
+
+	this->synth = synth;
+	sPackEntry* entries = (sPackEntry*)(header + 1);
+	for (unsigned int i = 0; i < header->num_entries; ++i)
+	{
+		sPackEntry& entry = entries[i];
+		if (!isValidEntry(entry))
+		{
+			std::cerr << "Asset pack entry " << i << " is corrupted: " << filename << std::endl;
+			continue;
+		}
+		void* ptr = (char*)data + entry.offset;
+		if (entry.type == IMAGE)
+		{
+			Image* img = new Image();
+			img->width = entry.width;
+			img->height = entry.height;
+			img->pixels = (Color*)ptr;
+			img->external = true;
+			img->setName(entry.name);
+			images.push_back(img);
+		}
+		else if (entry.type == SAMPLE && synth)
+		{
+			Synth::Sample* sample = new Synth::Sample(); //value initialized, every field zero
+			sample->length = entry.length;
+			sample->buffer = (float*)ptr;
+			sample->external = true;
+			sample->spec.freq = 48000;
+			sample->spec.format = AUDIO_F32;
+			sample->spec.channels = 1;
+			synth->samples[entry.name] = sample;
+			samples.push_back(sample);
+		}
+	}
+
+	std::cout << " + Asset pack mounted: " << filename << " (" << images.size() << " images, " << samples.size() << " samples)" << std::endl;
+	return true;
+}
+
+void AssetPack::unmount()
+{
+	for (int i = 0; i < images.size(); ++i)
+	{
+		Image::unregister(images[i]);
+		delete images[i];
+	}
+	images.clear();
+
+	for (int i = 0; i < samples.size(); ++i)
+	{
+		for (auto it = synth->samples.begin(); it != synth->samples.end(); ++it)
+			if (it->second == samples[i])
+			{
+				synth->samples.erase(it);
+				break;
+			}
+		delete samples[i];
+	}
+	samples.clear();
+	synth = NULL;
+
+	if (!data)
+		return;
+#ifdef WIN32
+	UnmapViewOfFile(data);
+#else
+	munmap(data, size);
+#endif
+	data = NULL;
+	size = 0;
+}
@@ -0,0 +1,64 @@
+/*	AssetPack: all the assets of the game baked in a single file.
+	Images are stored already converted to Color rows (top-down) and sounds as F32 mono 48KHz,
+	so once the file is mapped in memory the Image and Sample objects point directly to it.
+*/
+
+#ifndef ASSETPACK_H
+#define ASSETPACK_H
+
+#include <string>
+#include <vector>
+#include "framework.h"
+#include "image.h"
+#include "synth.h"
+
+#define ASSETPACK_VERSION 1
+#define ASSETPACK_ALIGNMENT 16
+
+class AssetPack
+{
+public:
+	enum {
+		IMAGE = 1,
+		SAMPLE
+	};
+
+	struct sPackHeader {
+		char magic[4]; //"PACK"
+		uint32 version;
+		uint32 num_entries;
+		uint32 reserved;
+	};
+
+	//every asset in the pack, data is stored in native endianness
+	struct sPackEntry {
+		char name[104]; //path as used in Image::Get or Synth::loadSample
+		uint32 type;
+		uint32 offset; //from the start of the file, aligned to ASSETPACK_ALIGNMENT
+		uint32 size; //in bytes
+		uint32 width; //images only
+		uint32 height; //images only
+		uint32 length; //samples only, in samples
+	};
+
+	void* data; //mapped file
+	size_t size;
+	std::vector<Image*> images;
+	std::vector<Synth::Sample*> samples;
+	Synth* synth; //where the samples were registered
+
+	AssetPack();
+	~AssetPack();
+
+	//bakes the given files (TGA and WAV) in a pack, it is meant to be used offline
+	static bool build(const char* filename, const std::vector<std::string>& files);
+
+	//maps the pack and registers all the assets so Image::Get and Synth::loadSample find them
+	bool mount(const char* filename, Synth* synth = NULL);
+	void unmount();
+
+private:
+	bool isValidEntry(const sPackEntry& entry) const;
+};
+
+#endif
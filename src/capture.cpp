@@ -0,0 +1,143 @@
+#include "capture.h"
+
+FrameCapture::FrameCapture() : frames_dropped(0), head(0), tail(0), recording(false)
+{
+	format = TGA_SEQUENCE;
+	width = height = 0;
+	frames_written = 0;
+	video = NULL;
+}
+
+FrameCapture::~FrameCapture()
+{
+	stop();
+}
+
+bool FrameCapture::start(const char* path, int format, unsigned int width, unsigned int height, int fps, int ring_size)
+{
+	stop();
+
+	this->path = path;
+	this->format = format;
+	this->width = width;
+	this->height = height;
+	frames_written = 0;
+	frames_dropped = 0;
+	head = tail = 0;
+
+	//all the memory is allocated now, not while recording
+	ring.resize(ring_size);
+	for (int i = 0; i < ring_size; ++i)
+		ring[i] = Image(width, height);
+
+	if (format == Y4M)
+	{
+		video = fopen(path, "wb");
+		if (!video)
+		{
+			std::cerr << "Cannot create capture file: " << path << std::endl;
+			return false;
+		}
+		fprintf(video, "YUV4MPEG2 W%u H%u F%d:1 Ip A1:1 C444 XCOLORRANGE=FULL\n", width, height, fps);
+		buffer.resize(width * height * 3);
+	}
+	else
+		buffer.resize(ring[0].getTGAMaxSize());
+
+	recording = true;
+	writer = std::thread(&FrameCapture::writerLoop, this);
+	std::cout << " + Capture started: " << path << std::endl;
+	return true;
+}
+
+bool FrameCapture::capture(const Image& frame)
+{
+	if (!recording || frame.width != width || frame.height != height)
+		return false;
+
+	unsigned int current = head;
+	if (current - tail >= ring.size()) //ring full, drop it so the game never waits
+	{
+		frames_dropped++;
+		return false;
+	}
+
+	memcpy(ring[current % ring.size()].pixels, frame.pixels, width * height * sizeof(Color));
+	{
+		//published under the lock, otherwise the writer could check head, miss it and sleep till the next frame
+		std::unique_lock<std::mutex> lock(mutex);
+		head = current + 1;
+	}
+	frame_ready.notify_one();
+	return true;
+}
+
+void FrameCapture::stop()
+{
+	if (!recording)
+		return;
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		recording = false;
+	}
+	frame_ready.notify_one();
+	writer.join();
+
+	if (video)
+		fclose(video);
+	video = NULL;
+	std::cout << " + Capture finished: " << frames_written << " frames written, " << frames_dropped << " dropped" << std::endl;
+}
+
+void FrameCapture::writerLoop()
+{
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			frame_ready.wait(lock, [this]() { return head != tail || !recording; });
+		}
+
+		//write everything pending, even if we were asked to stop
+		if (head == tail)
+			break;
+		while (tail != head)
+		{
+			writeFrame(ring[tail % ring.size()]);
+			tail = tail + 1;
+		}
+	}
+}
+
+void FrameCapture::writeFrame(const Image& frame)
+{
+	if (format == TGA_SEQUENCE)
+	{
+		char filename[512];
+		snprintf(filename, sizeof(filename), path.c_str(), frames_written);
+		FILE* file = fopen(filename, "wb");
+		if (!file)
+			return;
+		unsigned int size = frame.encodeTGA(&buffer[0]);
+		fwrite(&buffer[0], 1, size, file);
+		fclose(file);
+	}
+	else
+	{
+		//full range BT.601 conversion to planar Y, U, V
+		unsigned int num_pixels = width * height;
+		unsigned char* Y = &buffer[0];
+		unsigned char* U = Y + num_pixels;
+		unsigned char* V = U + num_pixels;
+		for (unsigned int i = 0; i < num_pixels; ++i)
+		{
+			const Color& c = frame.pixels[i];
+			Y[i] = (unsigned char)((77 * c.r + 150 * c.g + 29 * c.b) >> 8);
+			U[i] = (unsigned char)clamp(((-43 * c.r - 85 * c.g + 128 * c.b) >> 8) + 128, 0, 255);
+			V[i] = (unsigned char)clamp(((128 * c.r - 107 * c.g - 21 * c.b) >> 8) + 128, 0, 255);
+		}
+		fwrite("FRAME\n", 1, 6, video);
+		fwrite(&buffer[0], 1, num_pixels * 3, video);
+	}
+	frames_written++;
+}
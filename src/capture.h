@@ -0,0 +1,55 @@
+/*	FrameCapture: records the framebuffer to disk without stalling the game.
+	Every frame is copied into a ring of preallocated images and a writer thread encodes them
+	as a TGA sequence (same encoder as Image::saveTGA) or as a raw Y4M video stream.
+*/
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include "image.h"
+
+class FrameCapture
+{
+public:
+	enum {
+		TGA_SEQUENCE = 1, //path is a printf pattern, p.e. "capture_%05d.tga"
+		Y4M //path is the video file, YUV 4:4:4 (no chroma subsampling, but the 8 bits BT.601 conversion truncates, so it is lossy)
+	};
+
+	int format;
+	std::string path;
+	unsigned int width;
+	unsigned int height;
+	unsigned int frames_written;
+	std::atomic<unsigned int> frames_dropped; //the writer was too slow and the ring was full
+
+	FrameCapture();
+	~FrameCapture();
+
+	bool start(const char* path, int format, unsigned int width, unsigned int height, int fps = 60, int ring_size = 32);
+	bool capture(const Image& frame); //called from the game thread, it only copies the pixels
+	void stop(); //waits till all the queued frames are written
+	bool isRecording() const { return recording; }
+
+private:
+	std::vector<Image> ring;
+	std::atomic<unsigned int> head; //next frame to fill (game thread)
+	std::atomic<unsigned int> tail; //next frame to write (writer thread)
+	std::atomic<bool> recording;
+	std::thread writer;
+	std::mutex mutex;
+	std::condition_variable frame_ready;
+	FILE* video; //only for Y4M
+	std::vector<unsigned char> buffer; //encoded frame, preallocated
+
+	void writerLoop();
+	void writeFrame(const Image& frame);
+};
+
+#endif
@@ -0,0 +1,49 @@
+#include "clock.h"
+#include "includes.h"
+
+Clock::Clock()
+{
+	scale = 1;
+	paused = false;
+	reset();
+}
+
+void Clock::reset(long time)
+{
+	this->time = time;
+	game_time = (double)time;
+	delta = real_delta = 0;
+	elapsed = 0;
+	real_time = 0;
+	frame = 0;
+	started = false;
+}
+
+void Clock::tick()
+{
+	long now = (long)SDL_GetTicks();
+	if (!started)
+		real_time = now;
+	advance(now - real_time);
+}
+
+void Clock::advance(long real_ms)
+{
+	started = true;
+	real_delta = real_ms;
+	real_time += real_ms;
+	frame++;
+
+	long prev_time = time;
+	if (!paused)
+		game_time += real_ms * (double)scale;
+	time = (long)game_time;
+	delta = time - prev_time;
+	elapsed = delta * 0.001f;
+}
+
+Clock* Clock::Get()
+{
+	static Clock clock;
+	return &clock;
+}
@@ -0,0 +1,35 @@
+/*	Clock: the time of the game, read once per frame.
+	The game logic reads the game time, which can run faster (fast-forward), be paused, or be moved by hand
+	(recordings, benchmarks) without depending on the real clock. Only tick reads the time of the system.
+*/
+
+#ifndef CLOCK_H
+#define CLOCK_H
+
+class Clock
+{
+public:
+	long time; //game time in milliseconds, what the stages read
+	long delta; //game milliseconds advanced in the last frame
+	float elapsed; //same in seconds
+	long real_time; //real milliseconds when the last frame started
+	long real_delta;
+	long frame;
+
+	float scale; //game time per real time, > 1 is fast-forward
+	bool paused;
+
+	Clock();
+
+	void reset(long time = 0); //also restarts the count of frames
+	void tick(); //once per frame, advances with the real time
+	void advance(long real_ms); //advances as if real_ms had passed, without reading the real time
+
+	static Clock* Get(); //clock of the game
+
+private:
+	double game_time; //keeps the fractions of millisecond when scaled
+	bool started;
+};
+
+#endif
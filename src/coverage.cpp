@@ -0,0 +1,392 @@
+#include "coverage.h"
+
+#include <cmath>
+#include <string.h>
+#include "includes.h"
+
+ChurchCoverage& ChurchCoverage::operator = (const ChurchCoverage& other)
+{
+	if (this == &other)
+		return *this;
+	churches = other.churches;
+	width = other.width;
+	height = other.height;
+	valid = closest_valid = false;
+	return *this;
+}
+
+void ChurchCoverage::resize(int width, int height)
+{
+	this->width = width;
+	this->height = height;
+	churches.clear();
+	fields.clear();
+	covering.assign(width * height, 0);
+	valid = true;
+	closest_valid = false;
+}
+
+void ChurchCoverage::setChurch(int x, int y, int radius)
+{
+	int index = -1;
+	for (int i = 0; i < churches.size(); ++i)
+		if (churches[i].x == x && churches[i].y == y)
+			index = i;
+	int old_radius = index != -1 ? churches[index].radius : 0;
+	if (radius == old_radius)
+		return;
+	closest_valid = false;
+
+	if (index == -1)
+	{
+		sChurch church = { x, y, radius };
+		churches.push_back(church);
+		if (valid)
+			addToField(getField(radius), churches.size() - 1);
+		return;
+	}
+
+	if (!radius)
+	{
+		//the last church takes its index, only the cells around it point to it
+		int last = churches.size() - 1;
+		if (valid && index != last)
+		{
+			sField& field = getField(churches[last].radius);
+			int r = field.radius;
+			for (int cy = max(0, churches[last].y - r); cy <= min(height - 1, churches[last].y + r); ++cy)
+				for (int cx = max(0, churches[last].x - r); cx <= min(width - 1, churches[last].x + r); ++cx)
+					if (field.nearest[cy * width + cx] == last)
+						field.nearest[cy * width + cx] = index;
+		}
+		churches[index] = churches[last];
+		churches.pop_back();
+	}
+	else
+		churches[index].radius = radius;
+
+	if (!valid)
+		return;
+	solveField(getField(old_radius), x, y);
+	if (radius)
+		addToField(getField(radius), index);
+}
+
+void ChurchCoverage::rebuild()
+{
+	covering.assign(width * height, 0);
+	for (int i = 0; i < fields.size(); ++i)
+	{
+		fields[i].distance2.assign(width * height, COVERAGE_INFINITE);
+		fields[i].nearest.assign(width * height, -1);
+	}
+	valid = true;
+	for (int i = 0; i < churches.size(); ++i)
+		addToField(getField(churches[i].radius), i);
+}
+
+ChurchCoverage::sField& ChurchCoverage::getField(int radius)
+{
+	for (int i = 0; i < fields.size(); ++i)
+		if (fields[i].radius == radius)
+			return fields[i];
+	fields.push_back(sField());
+	sField& field = fields.back();
+	field.radius = radius;
+	field.distance2.assign(width * height, COVERAGE_INFINITE);
+	field.nearest.assign(width * height, -1);
+	return field;
+}
+
+bool ChurchCoverage::isCloser(int distance2, int church, int current_distance2, int current) const
+{
+	if (distance2 != current_distance2)
+		return distance2 < current_distance2;
+	return current == -1 || churches[church].y * width + churches[church].x < churches[current].y * width + churches[current].x;
+}
+
+void ChurchCoverage::addToField(sField& field, int church)
+{
+	int x = churches[church].x, y = churches[church].y, r = field.radius;
+	for (int cy = max(0, y - r); cy <= min(height - 1, y + r); ++cy)
+		for (int cx = max(0, x - r); cx <= min(width - 1, x + r); ++cx)
+		{
+			int index = cy * width + cx;
+			int distance2 = (cx - x) * (cx - x) + (cy - y) * (cy - y);
+			if (distance2 > r * r || !isCloser(distance2, church, field.distance2[index], field.nearest[index]))
+				continue;
+			if (field.nearest[index] == -1)
+				covering[index]++;
+			field.distance2[index] = distance2;
+			field.nearest[index] = church;
+		}
+}
+
+void ChurchCoverage::solveField(sField& field, int x, int y)
+{
+	int r = field.radius;
+	int x0 = max(0, x - r), y0 = max(0, y - r);
+	int x1 = min(width - 1, x + r), y1 = min(height - 1, y + r);
+
+	//the churches of the field that reach the square, and the square empty
+	std::vector<int> reaching;
+	for (int i = 0; i < churches.size(); ++i)
+		if (churches[i].radius == r && churches[i].x >= x0 - r && churches[i].x <= x1 + r && churches[i].y >= y0 - r && churches[i].y <= y1 + r)
+			reaching.push_back(i);
+	for (int cy = y0; cy <= y1; ++cy)
+		for (int cx = x0; cx <= x1; ++cx)
+		{
+			int index = cy * width + cx;
+			if (field.nearest[index] != -1)
+				covering[index]--;
+			field.distance2[index] = COVERAGE_INFINITE;
+			field.nearest[index] = -1;
+		}
+
+	for (int i = 0; i < reaching.size(); ++i)
+	{
+		const sChurch& church = churches[reaching[i]];
+		for (int cy = max(y0, church.y - r); cy <= min(y1, church.y + r); ++cy)
+			for (int cx = max(x0, church.x - r); cx <= min(x1, church.x + r); ++cx)
+			{
+				int index = cy * width + cx;
+				int distance2 = (cx - church.x) * (cx - church.x) + (cy - church.y) * (cy - church.y);
+				if (distance2 > r * r || !isCloser(distance2, reaching[i], field.distance2[index], field.nearest[index]))
+					continue;
+				if (field.nearest[index] == -1)
+					covering[index]++;
+				field.distance2[index] = distance2;
+				field.nearest[index] = reaching[i];
+			}
+	}
+}
+
+int ChurchCoverage::getCoveringChurch(int x, int y)
+{
+	if (x < 0 || y < 0 || x >= width || y >= height)
+		return -1;
+	update();
+	int index = y * width + x;
+	int best = -1;
+	float best_margin = 0;
+	for (int i = 0; i < fields.size(); ++i)
+	{
+		const sField& field = fields[i];
+		if (field.nearest[index] == -1)
+			continue;
+		float margin = field.radius - sqrtf((float)field.distance2[index]);
+		if (best == -1 || margin > best_margin)
+		{
+			best = field.nearest[index];
+			best_margin = margin;
+		}
+	}
+	return best;
+}
+
+int ChurchCoverage::getClosestChurch(int x, int y, float* distance)
+{
+	if (x < 0 || y < 0 || x >= width || y >= height)
+		return -1;
+	if (!closest_valid)
+	{
+		std::vector<int> xs, ys;
+		for (int i = 0; i < churches.size(); ++i)
+		{
+			xs.push_back(churches[i].x);
+			ys.push_back(churches[i].y);
+		}
+		distanceTransform(width, height, xs, ys, closest_distance2, closest_nearest);
+		closest_valid = true;
+	}
+	int index = y * width + x;
+	int best = closest_nearest[index];
+	if (distance)
+		*distance = best == -1 ? -1.0f : sqrtf((float)closest_distance2[index]);
+	return best;
+}
+
+void ChurchCoverage::distanceTransform(int width, int height, const std::vector<int>& xs, const std::vector<int>& ys,
+	std::vector<int>& distance2, std::vector<int>& nearest)
+{
+	distance2.assign(width * height, COVERAGE_INFINITE);
+	nearest.assign(width * height, -1);
+	for (int i = 0; i < xs.size(); ++i)
+	{
+		if (xs[i] < 0 || ys[i] < 0 || xs[i] >= width || ys[i] >= height)
+			continue;
+		distance2[ys[i] * width + xs[i]] = 0;
+		nearest[ys[i] * width + xs[i]] = i;
+	}
+
+	//columns: distance to the closest cell of the same column, sweeping down and up
+	for (int x = 0; x < width; ++x)
+	{
+		int last = -1;
+		for (int y = 0; y < height; ++y)
+		{
+			int index = y * width + x;
+			if (distance2[index] == 0)
+				last = y;
+			else if (last != -1)
+			{
+				distance2[index] = (y - last) * (y - last);
+				nearest[index] = nearest[last * width + x];
+			}
+		}
+		last = -1;
+		for (int y = height - 1; y >= 0; --y)
+		{
+			int index = y * width + x;
+			if (distance2[index] == 0)
+				last = y;
+			else if (last != -1 && (last - y) * (last - y) < distance2[index])
+			{
+				distance2[index] = (last - y) * (last - y);
+				nearest[index] = nearest[last * width + x];
+			}
+		}
+	}
+
+	//rows: lower envelope of the parabolas (x - q)^2 + f(q) of the columns, the closest one is the minimum
+	std::vector<int> f(width), f_nearest(width), v(width);
+	std::vector<double> z(width + 1);
+	for (int y = 0; y < height; ++y)
+	{
+		int* row = &distance2[y * width];
+		int* row_nearest = &nearest[y * width];
+		memcpy(&f[0], row, width * sizeof(int));
+		memcpy(&f_nearest[0], row_nearest, width * sizeof(int));
+
+		int k = -1;
+		for (int q = 0; q < width; ++q)
+		{
+			if (f[q] == COVERAGE_INFINITE)
+				continue;
+			if (k == -1)
+			{
+				k = 0;
+				v[0] = q;
+				z[0] = -1e30;
+				z[1] = 1e30;
+				continue;
+			}
+			double s;
+			while (true)
+			{
+				int p = v[k];
+				s = ((f[q] + (double)q * q) - (f[p] + (double)p * p)) / (2.0 * (q - p));
+				if (s > z[k])
+					break;
+				k--;
+			}
+			k++;
+			v[k] = q;
+			z[k] = s;
+			z[k + 1] = 1e30;
+		}
+		if (k == -1)
+			continue; //no columns with churches
+
+		k = 0;
+		for (int x = 0; x < width; ++x)
+		{
+			while (z[k + 1] < x)
+				k++;
+			int p = v[k];
+			row[x] = (x - p) * (x - p) + f[p];
+			row_nearest[x] = f_nearest[p];
+		}
+	}
+}
+
+int ChurchCoverage::benchmark(int size, int num_churches)
+{
+	std::cout << "Church coverage benchmark, map of " << size << "x" << size << ", " << num_churches << " churches" << std::endl;
+
+	ChurchCoverage coverage;
+	coverage.resize(size, size);
+	std::vector<bool> blessed(size * size, false); //as blessing used to be, every church rasterizes its circle
+	uint32 seed = 1;
+	double field_seconds = 0, circle_seconds = 0;
+	int square_mismatches = 0; //cells of the squares different from the circles drawn so far
+	for (int i = 0; i < num_churches; ++i)
+	{
+		seed = seed * 1664525u + 1013904223u;
+		int x = (seed >> 8) % size;
+		seed = seed * 1664525u + 1013904223u;
+		int y = (seed >> 8) % size;
+		int radius = (seed >> 4) % 2 ? 10 : 5;
+
+		Uint64 start = SDL_GetPerformanceCounter();
+		for (int cy = y - radius; cy <= y + radius; ++cy)
+			for (int cx = x - radius; cx <= x + radius; ++cx)
+				if (cx >= 0 && cy >= 0 && cx < size && cy < size && Vector2(cx, cy).distance(Vector2(x, y)) <= radius)
+					blessed[cy * size + cx] = true;
+		circle_seconds += (SDL_GetPerformanceCounter() - start) / (double)SDL_GetPerformanceFrequency();
+
+		//the same cells a world updates: the square of the church
+		start = SDL_GetPerformanceCounter();
+		coverage.setChurch(x, y, radius);
+		for (int cy = max(0, y - radius); cy <= min(size - 1, y + radius); ++cy)
+			for (int cx = max(0, x - radius); cx <= min(size - 1, x + radius); ++cx)
+				if (coverage.isCovered(cx, cy) != blessed[cy * size + cx])
+					square_mismatches++;
+		field_seconds += (SDL_GetPerformanceCounter() - start) / (double)SDL_GetPerformanceFrequency();
+	}
+
+	int failed = square_mismatches;
+	int mismatches = 0, covered = 0;
+	Uint64 start = SDL_GetPerformanceCounter();
+	for (int i = 0; i < size * size; ++i)
+	{
+		bool is_covered = coverage.isCovered(i % size, i / size);
+		if (is_covered)
+			covered++;
+		if (is_covered != blessed[i])
+			mismatches++;
+	}
+	double lookup_seconds = (SDL_GetPerformanceCounter() - start) / (double)SDL_GetPerformanceFrequency();
+
+	std::cout << " * Circles: " << circle_seconds * 1000000.0 / num_churches << " us per church" << std::endl;
+	std::cout << " * Fields: " << field_seconds * 1000000.0 / num_churches << " us per church (the square of its radius), "
+		<< square_mismatches << " cells different from the circles while adding" << std::endl;
+	std::cout << " * Lookups: " << lookup_seconds * 1000000000.0 / (size * size) << " ns per cell, " << covered * 100.0 / (size * size) << "% covered, "
+		<< mismatches << " different from the circles" << std::endl;
+	failed += mismatches;
+
+	//removing half of them and upgrading the rest of radius 5, the rest must still cover the same
+	int removed = num_churches / 2, upgraded = 0;
+	start = SDL_GetPerformanceCounter();
+	for (int i = 0; i < removed; ++i)
+	{
+		sChurch church = coverage.churches[0];
+		coverage.setChurch(church.x, church.y, 0);
+		for (int cy = max(0, church.y - church.radius); cy <= min(size - 1, church.y + church.radius); ++cy)
+			for (int cx = max(0, church.x - church.radius); cx <= min(size - 1, church.x + church.radius); ++cx)
+				coverage.isCovered(cx, cy);
+	}
+	double remove_seconds = (SDL_GetPerformanceCounter() - start) / (double)SDL_GetPerformanceFrequency();
+	for (int i = 0; i < coverage.churches.size(); ++i)
+		if (coverage.churches[i].radius == 5)
+		{
+			coverage.setChurch(coverage.churches[i].x, coverage.churches[i].y, 10);
+			upgraded++;
+		}
+	mismatches = 0;
+	for (int y = 0; y < size; ++y)
+		for (int x = 0; x < size; ++x)
+		{
+			bool inside = false;
+			for (int i = 0; i < coverage.churches.size() && !inside; ++i)
+			{
+				const sChurch& church = coverage.churches[i];
+				inside = (x - church.x) * (x - church.x) + (y - church.y) * (y - church.y) <= church.radius * church.radius;
+			}
+			if (inside != coverage.isCovered(x, y))
+				mismatches++;
+		}
+	std::cout << " * Removing " << removed << " churches: " << remove_seconds * 1000000.0 / max(1, removed) << " us per church, upgrading " << upgraded << ": "
+		<< mismatches << " cells different from the circles" << std::endl;
+	return failed + mismatches;
+}
@@ -0,0 +1,76 @@
+/*	ChurchCoverage: which cells are blessed by the churches and how far every cell is from them.
+	There is a field per church radius with the squared distance from every cell to the closest church of that radius
+	and which church it is, only for the cells inside the radius (the rest can not be covered by them), and a count by
+	cell of the fields that cover it, so a cell is blessed when the count is not 0 and overlapping churches do not bless
+	it twice.
+	Adding or upgrading a church takes the minimum with it in the square of its radius, and removing it solves again
+	that square from the churches of that radius that reach it, so a change costs about as much as drawing its circle.
+	Ties go to the church in the first cell (by rows), so the fields only depend on the churches and not on their order.
+	The distance to the closest church of any radius is a Euclidean distance transform of Felzenszwalb and Huttenlocher
+	(a pass by columns and a pass by rows, linear in the cells whatever the number of churches), built when it is asked.
+	Copies (the clones of a world) only copy the churches, the fields are built again the first time they are needed.
+*/
+
+#ifndef COVERAGE_H
+#define COVERAGE_H
+
+#include <vector>
+#include "framework.h"
+
+#define COVERAGE_INFINITE (1 << 30)
+
+class ChurchCoverage
+{
+public:
+	struct sChurch {
+		int x;
+		int y;
+		int radius; //cells it blesses around it
+	};
+
+	std::vector<sChurch> churches;
+
+	ChurchCoverage() { width = height = 0; valid = closest_valid = true; }
+	ChurchCoverage(const ChurchCoverage& other) { *this = other; }
+	ChurchCoverage& operator = (const ChurchCoverage& other);
+
+	void resize(int width, int height); //removes all the churches
+	void setChurch(int x, int y, int radius); //adds or upgrades the church in that cell, radius 0 removes it (the last church takes its index)
+
+	bool isCovered(int x, int y) { if (x < 0 || y < 0 || x >= width || y >= height) return false; update(); return covering[y * width + x] != 0; }
+	int getCoveringChurch(int x, int y); //index of the church that covers the cell (the deepest inside), -1 if none
+	int getClosestChurch(int x, int y, float* distance = NULL); //-1 if there are no churches
+
+	//distance transform of a set of cells: distance2 gets the squared distance to the closest one and nearest its
+	//index in the list (-1 for all if the list is empty)
+	static void distanceTransform(int width, int height, const std::vector<int>& xs, const std::vector<int>& ys,
+		std::vector<int>& distance2, std::vector<int>& nearest);
+
+	//churches added one by one in a map of that size, checking the coverage against rasterizing the circles
+	static int benchmark(int size = 512, int num_churches = 200); //returns the cells different from the circles, summed over every check
+
+private:
+	struct sField {
+		int radius;
+		std::vector<int> distance2; //COVERAGE_INFINITE outside the radius of all the churches of the field
+		std::vector<int> nearest; //index in churches, -1 outside
+	};
+
+	int width;
+	int height;
+	bool valid; //fields and covering, false after a copy
+	std::vector<sField> fields; //one per radius in use
+	std::vector<uint8> covering; //by cell, fields that cover it
+	bool closest_valid;
+	std::vector<int> closest_distance2; //distance transform of all the churches
+	std::vector<int> closest_nearest;
+
+	void update() { if (!valid) rebuild(); }
+	void rebuild();
+	sField& getField(int radius); //added if no church had that radius
+	bool isCloser(int distance2, int church, int current_distance2, int current) const; //than the current nearest of a cell
+	void addToField(sField& field, int church); //minimum with the church in the square of its radius
+	void solveField(sField& field, int x, int y); //the square of the radius of the field around the cell, from its churches
+};
+
+#endif
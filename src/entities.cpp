@@ -0,0 +1,304 @@
+#include "entities.h"
+
+#include "includes.h"
+
+#define ENTITY_MAX_GENERATION ((1 << (32 - ENTITY_INDEX_BITS)) - 1)
+
+EntityStore::EntityStore(World* world)
+{
+	this->world = world;
+	random_state = 0x9E3779B9;
+	num_alive = 0;
+	width = height = 0;
+
+	//the players always exist, the systems copy them from the world
+	for (int i = 0; i < 3; ++i)
+	{
+		Entity entity = create();
+		cPlayer player = { (uint8)i };
+		cPosition position = { world->players[i].draw_pos };
+		cSprite sprite = { (uint8)i, 5, PlayStage::LAYER_PLAYER };
+		players.add(entity, player);
+		positions.add(entity, position);
+		sprites.add(entity, sprite);
+	}
+	world->addListener(this);
+	onMapReset();
+}
+
+EntityStore::~EntityStore()
+{
+	world->removeListener(this);
+}
+
+Entity EntityStore::create()
+{
+	uint32 index;
+	if (free_indices.size())
+	{
+		index = free_indices.back();
+		free_indices.pop_back();
+	}
+	else
+	{
+		index = generations.size();
+		generations.push_back(1); //0 would make the first handle ENTITY_NONE
+	}
+	num_alive++;
+	return (generations[index] << ENTITY_INDEX_BITS) | index;
+}
+
+bool EntityStore::isAlive(Entity entity) const
+{
+	uint32 index = entity & ENTITY_INDEX_MASK;
+	return entity != ENTITY_NONE && index < generations.size() && generations[index] == (entity >> ENTITY_INDEX_BITS);
+}
+
+void EntityStore::destroy(Entity entity)
+{
+	if (!isAlive(entity))
+		return;
+	positions.remove(entity);
+	sprites.remove(entity);
+	wanderers.remove(entity);
+	players.remove(entity);
+
+	//the next entity with this index gets another generation, handles to this one stop being valid
+	uint32 index = entity & ENTITY_INDEX_MASK;
+	generations[index] = generations[index] == ENTITY_MAX_GENERATION ? 1 : generations[index] + 1;
+	free_indices.push_back(index);
+	num_alive--;
+}
+
+Entity EntityStore::spawn(int kind, int x, int y)
+{
+	Entity entity = create();
+	cWander wander;
+	wander.kind = kind;
+	wander.range = kind == cWander::BOAT ? 4 : 2;
+	wander.home_x = x;
+	wander.home_y = y;
+	wander.speed = kind == cWander::BOAT ? 6 + random() * 4 : 8 + random() * 6;
+	wander.wait = random() * 3;
+	wander.target.set(x * 16.0f, y * 16.0f);
+	cPosition position = { wander.target };
+	cSprite sprite = { 5, 5, PlayStage::LAYER_PEOPLE }; //one person
+	if (kind == cWander::BOAT)
+		sprite.tile_x = 12; //the boat of the players, empty
+	wanderers.add(entity, wander);
+	positions.add(entity, position);
+	sprites.add(entity, sprite);
+	return entity;
+}
+
+void EntityStore::syncCell(int x, int y)
+{
+	const sCell& cell = world->gamemap.get(x, y);
+	int index = y * width + x;
+	bool harbour = cell.item == ITEM_HARBOUR;
+	if (cell.people == spawned_people[index] && harbour == spawned_boat[index])
+		return;
+
+	//the cell lost people or its harbour, backwards because destroying moves the last ones into the hole
+	for (int i = wanderers.size() - 1; i >= 0; --i)
+	{
+		const cWander& wander = wanderers.dense[i];
+		if (wander.home_x != x || wander.home_y != y)
+			continue;
+		if (wander.kind == cWander::VILLAGER && spawned_people[index] > cell.people)
+		{
+			destroy(wanderers.entities[i]);
+			spawned_people[index]--;
+		}
+		else if (wander.kind == cWander::BOAT && !harbour)
+		{
+			destroy(wanderers.entities[i]);
+			spawned_boat[index] = false;
+		}
+	}
+
+	for (; spawned_people[index] < cell.people; spawned_people[index]++)
+		spawn(cWander::VILLAGER, x, y);
+	if (harbour && !spawned_boat[index])
+	{
+		spawn(cWander::BOAT, x, y);
+		spawned_boat[index] = true;
+	}
+}
+
+void EntityStore::onCellsChanged(int x, int y, int w, int h)
+{
+	const Matrix<sCell>& gamemap = world->gamemap;
+	if (gamemap.width != width || gamemap.height != height)
+	{
+		onMapReset();
+		return;
+	}
+	for (int cy = y; cy < y + h; ++cy)
+		for (int cx = x; cx < x + w; ++cx)
+			syncCell(cx, cy);
+}
+
+void EntityStore::onMapReset()
+{
+	for (int i = wanderers.size() - 1; i >= 0; --i)
+		destroy(wanderers.entities[i]);
+	width = world->gamemap.width;
+	height = world->gamemap.height;
+	spawned_people.assign(width * height, 0);
+	spawned_boat.assign(width * height, false);
+	for (int y = 0; y < height; ++y)
+		for (int x = 0; x < width; ++x)
+			syncCell(x, y);
+}
+
+//a cell around home where it can stand, villagers on land and boats on water, home if none was found
+void EntityStore::pickTarget(cWander& wander)
+{
+	int x = wander.home_x, y = wander.home_y;
+	for (int i = 0; i < 4; ++i)
+	{
+		int cx = wander.home_x + (int)(randomInt() % (wander.range * 2 + 1)) - wander.range;
+		int cy = wander.home_y + (int)(randomInt() % (wander.range * 2 + 1)) - wander.range;
+		if (cx < 0 || cy < 0 || cx >= width || cy >= height)
+			continue;
+		const sCell& cell = world->gamemap.get(cx, cy);
+		bool water = cell.terrain == TILE_WATER;
+		if (cell.terrain == TILE_ROCK || cell.item >= TILE_HOUSE || water != (wander.kind == cWander::BOAT))
+			continue;
+		x = cx;
+		y = cy;
+		break;
+	}
+	wander.target.set(x * 16.0f, y * 16.0f);
+	if (wander.kind == cWander::VILLAGER) //not all in the middle of the cell
+		wander.target += Vector2((int)(randomInt() % 9) - 4.0f, (int)(randomInt() % 9) - 4.0f);
+}
+
+void EntityStore::updatePlayers()
+{
+	for (int i = 0; i < players.size(); ++i)
+	{
+		Entity entity = players.entities[i];
+		sCharacter& player = world->players[players.dense[i].index];
+		player.draw_pos = lerp(player.draw_pos, player.pos, 0.5);
+		positions.get(entity)->pos = player.draw_pos;
+
+		cSprite* sprite = sprites.get(entity);
+		const sCell& cell = world->gamemap.get(player.pos.x / 16, player.pos.y / 16);
+		sprite->tile_x = cell.terrain == TILE_WATER ? 12 : players.dense[i].index;
+		sprite->tile_y = player.alive ? 5 : 6;
+		sprite->layer = players.dense[i].index == world->selected_player ? PlayStage::LAYER_SELECTED : PlayStage::LAYER_PLAYER;
+	}
+}
+
+void EntityStore::updateWanderers(float dt)
+{
+	for (int i = 0; i < wanderers.size(); ++i)
+	{
+		cWander& wander = wanderers.dense[i];
+		if (wander.wait > 0)
+		{
+			wander.wait -= dt;
+			continue;
+		}
+		Vector2& pos = positions.get(wanderers.entities[i])->pos;
+		Vector2 delta = wander.target - pos;
+		float distance = delta.length();
+		float step = wander.speed * dt;
+		if (distance > step)
+		{
+			pos += delta * (step / distance);
+			continue;
+		}
+		pos = wander.target;
+		wander.wait = 1 + random() * 3;
+		pickTarget(wander);
+	}
+}
+
+void EntityStore::update(float dt)
+{
+	updatePlayers();
+	updateWanderers(dt);
+}
+
+void EntityStore::render(SpriteBatch& batch, const Image* tileset, const IndexedImage* tileset8, const Vector2& camera)
+{
+	for (int i = 0; i < sprites.size(); ++i)
+	{
+		//every entity with a sprite has a position, created and destroyed together so both arrays are usually in the same order
+		Entity entity = sprites.entities[i];
+		const Vector2& pos = positions.entities[i] == entity ? positions.dense[i].pos : positions.get(entity)->pos;
+		int x = pos.x - camera.x;
+		int y = pos.y - camera.y;
+		if (x <= -16 || y <= -16 || x >= batch.viewport_width || y >= batch.viewport_height)
+			continue;
+		const cSprite& sprite = sprites.dense[i];
+		Area area(sprite.tile_x * 16, sprite.tile_y * 16, 16, 16);
+		if (tileset8)
+			batch.draw(*tileset8, x, y, area, sprite.layer);
+		else
+			batch.draw(*tileset, x, y, area, sprite.layer);
+	}
+}
+
+int EntityStore::benchmark(int num_entities, uint32 seed)
+{
+	std::cout << "Entities benchmark, " << num_entities << " villagers" << std::endl;
+
+	World world(seed);
+	world.newMap(256, 256);
+	EntityStore store(&world);
+	int from_map = store.wanderers.size();
+
+	//the rest in random land cells
+	Uint64 start = SDL_GetPerformanceCounter();
+	std::vector<Entity> spawned;
+	while (store.wanderers.size() < num_entities)
+	{
+		int x = world.randomInt() % 256, y = world.randomInt() % 256;
+		if (world.gamemap.get(x, y).terrain == TILE_SAND || world.gamemap.get(x, y).terrain == TILE_GRASS)
+			spawned.push_back(store.spawn(cWander::VILLAGER, x, y));
+	}
+	double seconds = (SDL_GetPerformanceCounter() - start) / (double)SDL_GetPerformanceFrequency();
+	std::cout << " * Creating: " << seconds * 1000000000.0 / max(1, (int)spawned.size()) << " ns per entity (" << from_map << " villagers and boats from the map)" << std::endl;
+
+	int frames = 600;
+	start = SDL_GetPerformanceCounter();
+	for (int i = 0; i < frames; ++i)
+		store.update(1 / 60.0f);
+	seconds = (SDL_GetPerformanceCounter() - start) / (double)SDL_GetPerformanceFrequency();
+	std::cout << " * Systems: " << seconds * 1000.0 / frames << " ms per frame, " << seconds * 1000000000.0 / (frames * store.getNumEntities()) << " ns per entity" << std::endl;
+
+	//submitting the whole map, every sprite is inside the view
+	Image atlas(256, 256);
+	SpriteBatch batch;
+	start = SDL_GetPerformanceCounter();
+	for (int i = 0; i < 10; ++i)
+	{
+		batch.begin(256 * 16, 256 * 16);
+		store.render(batch, &atlas, NULL, Vector2(0, 0));
+	}
+	seconds = (SDL_GetPerformanceCounter() - start) / (double)SDL_GetPerformanceFrequency();
+	std::cout << " * Rendering: " << seconds * 100.0 << " ms per frame, " << batch.stats.submitted << " sprites submitted" << std::endl;
+
+	//destroying half and creating them again reuses the indices, the old handles must not see the new entities
+	start = SDL_GetPerformanceCounter();
+	for (int i = 0; i < spawned.size(); i += 2)
+		store.destroy(spawned[i]);
+	int recreated = 0;
+	for (int i = 0; i < spawned.size(); i += 2, recreated++)
+		store.spawn(cWander::VILLAGER, 128, 128);
+	seconds = (SDL_GetPerformanceCounter() - start) / (double)SDL_GetPerformanceFrequency();
+	int errors = 0;
+	for (int i = 0; i < spawned.size(); ++i)
+	{
+		bool alive = i % 2 == 1;
+		if (store.isAlive(spawned[i]) != alive || store.positions.has(spawned[i]) != alive || store.wanderers.has(spawned[i]) != alive)
+			errors++;
+	}
+	std::cout << " * Destroying and creating " << recreated << ": " << seconds * 1000000000.0 / max(1, recreated * 2) << " ns per operation, "
+		<< errors << " stale handles seen as alive" << std::endl;
+	return errors;
+}
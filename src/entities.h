@@ -0,0 +1,140 @@
+/*	EntityStore: what moves on its own in the map (the family, the villagers walking around their houses and the boats
+	of the harbours), stored by component instead of by object.
+	Every component type is a sparse set: a dense array with the components (what the systems iterate, one after the
+	other), the entity of every element and, by entity index, where its component is in the dense array. Adding and
+	removing are constant time (the last element fills the hole) and nothing is allocated per entity, arrays only grow.
+	Entities are handles with an index and a generation, so a handle kept after its entity was destroyed (and its index
+	reused) is not taken for the new one.
+	It is a map listener: every person of a cell is a villager that wanders around it and every harbour has a boat,
+	created and destroyed when the cells change. They are only decoration, they have their own random numbers and
+	never touch the world, so recordings replay the same. The players are still in the world, their entities copy them.
+*/
+
+#ifndef ENTITIES_H
+#define ENTITIES_H
+
+#include <vector>
+#include "mygame.h"
+
+typedef uint32 Entity; //index in the low bits, generation in the high ones
+#define ENTITY_NONE 0
+#define ENTITY_INDEX_BITS 20
+#define ENTITY_INDEX_MASK ((1 << ENTITY_INDEX_BITS) - 1)
+
+template<typename T> class ComponentArray
+{
+public:
+	std::vector<T> dense;
+	std::vector<Entity> entities; //owner of every element of dense
+	std::vector<uint32> sparse; //by entity index, position in dense (only if the owner there is that entity)
+
+	int size() const { return dense.size(); }
+	bool has(Entity entity) const
+	{
+		uint32 index = entity & ENTITY_INDEX_MASK;
+		return index < sparse.size() && sparse[index] < entities.size() && entities[sparse[index]] == entity;
+	}
+	T* get(Entity entity) { return has(entity) ? &dense[sparse[entity & ENTITY_INDEX_MASK]] : NULL; }
+
+	T& add(Entity entity, const T& component) //replaces it if it already had one
+	{
+		if (T* current = get(entity))
+			return *current = component;
+		uint32 index = entity & ENTITY_INDEX_MASK;
+		if (index >= sparse.size())
+			sparse.resize(index + 1, 0);
+		sparse[index] = dense.size();
+		dense.push_back(component);
+		entities.push_back(entity);
+		return dense.back();
+	}
+
+	void remove(Entity entity)
+	{
+		if (!has(entity))
+			return;
+		uint32 position = sparse[entity & ENTITY_INDEX_MASK];
+		dense[position] = dense.back();
+		entities[position] = entities.back();
+		sparse[entities[position] & ENTITY_INDEX_MASK] = position;
+		dense.pop_back();
+		entities.pop_back();
+	}
+
+	void clear() { dense.clear(); entities.clear(); }
+};
+
+//components
+struct cPosition {
+	Vector2 pos; //pixels, top left corner of the sprite
+};
+
+struct cSprite {
+	uint8 tile_x; //cell of 16x16 in the tileset
+	uint8 tile_y;
+	uint8 layer; //PlayStage::LAYER_*
+};
+
+struct cWander {
+	enum { VILLAGER = 0, BOAT };
+	uint8 kind;
+	uint8 range; //cells around home
+	int16 home_x; //cell it belongs to
+	int16 home_y;
+	float speed; //pixels per second
+	float wait; //seconds standing still before walking to target
+	Vector2 target;
+};
+
+struct cPlayer {
+	uint8 index; //in world.players
+};
+
+class EntityStore : public MapListener
+{
+public:
+	World* world;
+	ComponentArray<cPosition> positions;
+	ComponentArray<cSprite> sprites;
+	ComponentArray<cWander> wanderers;
+	ComponentArray<cPlayer> players;
+	uint32 random_state; //its own, the world's decides the game
+
+	EntityStore(World* world);
+	~EntityStore();
+
+	Entity create();
+	void destroy(Entity entity); //removes its components too
+	bool isAlive(Entity entity) const;
+	int getNumEntities() const { return num_alive; }
+
+	//systems
+	void update(float dt); //players and wanderers
+	void render(SpriteBatch& batch, const Image* tileset, const IndexedImage* tileset8, const Vector2& camera); //every sprite in the view, in one pass, from the indexed tileset if not NULL
+
+	virtual void onCellsChanged(int x, int y, int w, int h);
+	virtual void onMapReset();
+
+	//thousands of villagers in a generated map: creating, moving, drawing and destroying them
+	static int benchmark(int num_entities = 10000, uint32 seed = 1); //returns the stale handles seen as alive
+
+private:
+	std::vector<uint16> generations; //by index, the current one
+	std::vector<uint32> free_indices;
+	int num_alive;
+	int width;
+	int height;
+	std::vector<uint8> spawned_people; //by cell, villagers created for it
+	std::vector<bool> spawned_boat;
+
+	uint32 randomInt() { random_state ^= random_state << 13; random_state ^= random_state >> 17; random_state ^= random_state << 5; return random_state; }
+	float random() { return (randomInt() % 10000) / 10000.0f; }
+
+	void syncCell(int x, int y); //villagers and boat of the cell as many as its people and harbour
+	Entity spawn(int kind, int x, int y);
+	void pickTarget(cWander& wander);
+	void updatePlayers();
+	void updateWanderers(float dt);
+};
+
+#endif
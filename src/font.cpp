@@ -0,0 +1,148 @@
+#include "font.h"
+
+HashTable<BitmapFont*> BitmapFont::s_fonts;
+
+BitmapFont::BitmapFont(const Image* image, int glyph_width, int glyph_height, int first_char)
+{
+	this->image = image;
+	this->glyph_width = glyph_width;
+	this->glyph_height = glyph_height;
+	this->first_char = first_char;
+	built = false;
+}
+
+void BitmapFont::build()
+{
+	glyphs.clear();
+	spans.clear();
+	built = true;
+	if (!image->pixels || image->width < glyph_width)
+		return;
+
+	//same layout as Image::getArea, glyphs sticking out of the image are clipped
+	for (int i = 0; image->getArea(i, glyph_width, glyph_height).y < (int)image->height; ++i)
+	{
+		sGlyph glyph;
+		glyph.first_span = spans.size();
+		Area area = image->getArea(i, glyph_width, glyph_height);
+		int area_w = min(glyph_width, (int)image->width - area.x);
+		int area_h = min(glyph_height, (int)image->height - area.y);
+		for (int y = 0; y < area_h; ++y)
+		{
+			for (int x = 0; x < area_w; )
+			{
+				const Color& c = image->getPixelRef(area.x + x, area.y + y);
+				if (c.a == 0)
+				{
+					x++;
+					continue;
+				}
+				sSpan span;
+				span.x = x;
+				span.y = y;
+				span.length = 1;
+				span.color = c;
+				span.blend = c.a != 255;
+				x++;
+				//opaque pixels of the same color are merged, blended ones are kept alone
+				while (!span.blend && x < area_w && memcmp(&image->getPixelRef(area.x + x, area.y + y), &c, sizeof(Color)) == 0)
+				{
+					span.length++;
+					x++;
+				}
+				spans.push_back(span);
+			}
+		}
+		glyph.num_spans = spans.size() - glyph.first_span;
+		glyphs.push_back(glyph);
+	}
+}
+
+void BitmapFont::draw(Image& target, const char* text, int x, int y)
+{
+	if (!built)
+	{
+		if (image->loading)
+			return;
+		build();
+	}
+
+	int startx = x;
+	for (; *text; ++text)
+	{
+		if (*text == '\n')
+		{
+			y += glyph_height;
+			x = startx;
+			continue;
+		}
+
+		int index = (unsigned char)*text - first_char;
+		bool visible = index >= 0 && index < (int)glyphs.size() && x < (int)target.width && y < (int)target.height && x + glyph_width > 0 && y + glyph_height > 0;
+		if (visible)
+		{
+			const sGlyph& glyph = glyphs[index];
+			const sSpan* span = &spans[0] + glyph.first_span;
+			for (unsigned int i = 0; i < glyph.num_spans; ++i, ++span)
+			{
+				int py = y + span->y;
+				if (py < 0 || py >= (int)target.height)
+					continue;
+				int start = max(0, x + span->x);
+				int end = min((int)target.width, x + span->x + span->length);
+				Color* dst = target.pixels + py * target.width;
+				if (span->blend)
+				{
+					for (int px = start; px < end; ++px)
+						dst[px] = blendColors(span->color, dst[px]);
+				}
+				else
+				{
+					for (int px = start; px < end; ++px)
+						dst[px] = span->color;
+				}
+			}
+		}
+		x += glyph_width;
+	}
+}
+
+Vector2i BitmapFont::measure(const char* text) const
+{
+	int line = 0;
+	int longest = 0;
+	int lines = 1;
+	for (; *text; ++text)
+	{
+		if (*text == '\n')
+		{
+			lines++;
+			line = 0;
+			continue;
+		}
+		line++;
+		if (line > longest)
+			longest = line;
+	}
+	return Vector2i(longest * glyph_width, lines * glyph_height);
+}
+
+BitmapFont* BitmapFont::Get(const Image* image, int glyph_width, int glyph_height, int first_char)
+{
+	//key made of the image and the glyph layout (field by field, a struct would hash its padding)
+	uint32 hash = hashData(&image, sizeof(image));
+	hash = hashData(&glyph_width, sizeof(int), hash);
+	hash = hashData(&glyph_height, sizeof(int), hash);
+	hash = hashData(&first_char, sizeof(int), hash);
+
+	//the whole key is compared, a different font with the same hash replaces the cached one instead of leaking it
+	BitmapFont** font = s_fonts.find(hash);
+	if (font && (*font)->image == image && (*font)->glyph_width == glyph_width && (*font)->glyph_height == glyph_height &&
+		(*font)->first_char == first_char)
+		return *font;
+	if (font)
+		delete *font;
+	BitmapFont* new_font = new BitmapFont(image, glyph_width, glyph_height, first_char);
+	s_fonts.set(hash, new_font);
+	return new_font;
+}
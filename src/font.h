@@ -0,0 +1,84 @@
+/*	BitmapFont: text rendering from a bitmap font image (all the glyphs of the same size, in ASCII order).
+	Glyphs are preprocessed into horizontal spans of opaque pixels, so drawing a char is just filling some spans
+	instead of testing the alpha of every pixel of the glyph rectangle.
+*/
+
+#ifndef FONT_H
+#define FONT_H
+
+#include <vector>
+#include "image.h"
+
+class BitmapFont
+{
+public:
+	//a horizontal run of pixels of the same color inside a glyph
+	struct sSpan {
+		uint8 x;
+		uint8 y;
+		uint8 length;
+		uint8 blend; //the color has partial alpha
+		Color color;
+	};
+
+	struct sGlyph {
+		unsigned int first_span;
+		unsigned int num_spans;
+	};
+
+	const Image* image;
+	int glyph_width;
+	int glyph_height;
+	int first_char;
+	bool built; //false while the image is still loading
+	std::vector<sGlyph> glyphs;
+	std::vector<sSpan> spans;
+
+	BitmapFont(const Image* image, int glyph_width = 7, int glyph_height = 9, int first_char = 32);
+
+	void build(); //extracts the spans of every glyph from the image
+	void draw(Image& target, const char* text, int x, int y);
+	Vector2i measure(const char* text) const; //size in pixels of the text (takes into account line breaks)
+
+	//font for an image and glyph size, it is created the first time
+	static BitmapFont* Get(const Image* image, int glyph_width = 7, int glyph_height = 9, int first_char = 32);
+	static HashTable<BitmapFont*> s_fonts;
+};
+
+//builds a string in a buffer on the stack, so texts that change every frame do not allocate:
+//   TextBuffer<32> str; str.add("Day: ").add(day + 1); framebuffer.drawText(str.c_str(), ...);
+template<int N>
+class TextBuffer
+{
+public:
+	char data[N];
+	int length;
+
+	TextBuffer() { clear(); }
+	void clear() { length = 0; data[0] = 0; }
+	const char* c_str() const { return data; }
+
+	TextBuffer& add(const char* text) {
+		while (*text && length < N - 1)
+			data[length++] = *text++;
+		data[length] = 0;
+		return *this;
+	}
+
+	TextBuffer& add(int value, bool force_sign = false) {
+		char digits[12];
+		int num = 0;
+		unsigned int v = value < 0 ? -(unsigned int)value : value;
+		do { digits[num++] = '0' + v % 10; v /= 10; } while (v);
+		if (value < 0)
+			add("-");
+		else if (force_sign)
+			add("+");
+		while (num && length < N - 1)
+			data[length++] = digits[--num];
+		data[length] = 0;
+		return *this;
+	}
+};
+
+#endif
@@ -22,6 +22,8 @@ typedef unsigned short uint16;
 typedef short int16;
 typedef int int32;
 typedef unsigned int uint32;
+typedef long long int64;
+typedef unsigned long long uint64;
 
 inline float random(float range = 1.0f, float offset = 0.0f) { return ((rand() % 10000) / (10000.0f)) * range + offset; }
 inline float clamp(float a, float min, float max) { return a < min ? min : (a > max ? max : a); }
@@ -494,22 +496,32 @@ public:
 		if (!f)
 			return false;
 		sMatrixHeader header;
-		fread(&header, sizeof(sMatrixHeader), 1, f);
-		if (header.bom != 0xFFFF)
+		bool ok = false;
+		if (fread(&header, sizeof(sMatrixHeader), 1, f) != 1 || header.bom != 0xFFFF)
 			std::cerr << "Matrix file is not valid: " << filename << std::endl;
 		else if (header.tsize != sizeof(T))
 			std::cerr << "Matrix data type is not the same: " << filename << std::endl;
 		else
 		{
-			if (data)
-				delete data;
-			width = header.w;
-			height = header.h;
-			data = new T[width * height];
-			fread(data, width*height * sizeof(T), 1, f);
+			//read in a temporary buffer so a truncated file does not leave the matrix half loaded
+			T* new_data = (header.w && header.h) ? new T[header.w * header.h] : NULL;
+			if (new_data && fread(new_data, header.w * header.h * sizeof(T), 1, f) != 1)
+			{
+				std::cerr << "Matrix file is truncated: " << filename << std::endl;
+				delete[] new_data;
+			}
+			else
+			{
+				if (data)
+					delete[] data;
+				width = header.w;
+				height = header.h;
+				data = new_data;
+				ok = true;
+			}
 		}
 		fclose(f);
-		return true;
+		return ok;
 	}
 
 	bool save(const char* filename)
@@ -534,6 +546,96 @@ public:
 	}
 };
 
+//FNV-1a hash of a string, it can be computed at compile time: constexpr uint32 id = hashString("data/tileset.tga");
+constexpr uint32 hashString(const char* str, uint32 hash = 2166136261u)
+{
+	return *str ? hashString(str + 1, (hash ^ (uint8)*str) * 16777619u) : hash;
+}
+
+//FNV-1a hash of a block of memory (keys made of several fields, checksums)
+inline uint32 hashData(const void* data, size_t size, uint32 hash = 2166136261u)
+{
+	const uint8* bytes = (const uint8*)data;
+	for (size_t i = 0; i < size; ++i)
+		hash = (hash ^ bytes[i]) * 16777619u;
+	return hash;
+}
+
+//open addressing (linear probing) table indexed by a precomputed hash, lookups are just integer compares
+template<typename T>
+class HashTable
+{
+public:
+	enum { EMPTY = 0, USED, DELETED };
+	struct sSlot {
+		uint32 key;
+		char state;
+		T value;
+	};
+	std::vector<sSlot> slots; //size is always zero or a power of two
+	unsigned int count; //used slots
+	unsigned int deleted; //slots marked as deleted
+
+	HashTable() { count = deleted = 0; }
+
+	void clear() { for (unsigned int i = 0; i < slots.size(); ++i) slots[i].state = EMPTY; count = deleted = 0; }
+
+	T* find(uint32 key) {
+		if (slots.empty())
+			return NULL;
+		unsigned int mask = (unsigned int)slots.size() - 1;
+		for (unsigned int i = key & mask; ; i = (i + 1) & mask) {
+			sSlot& slot = slots[i];
+			if (slot.state == EMPTY)
+				return NULL;
+			if (slot.state == USED && slot.key == key)
+				return &slot.value;
+		}
+	}
+
+	void set(uint32 key, const T& value) {
+		if (slots.empty())
+			rehash(16);
+		else if ((count + deleted + 1) * 2 > slots.size())
+			rehash(count * 4 > slots.size() ? (unsigned int)slots.size() * 2 : (unsigned int)slots.size());
+		unsigned int mask = (unsigned int)slots.size() - 1;
+		sSlot* target = NULL;
+		for (unsigned int i = key & mask; ; i = (i + 1) & mask) {
+			sSlot& slot = slots[i];
+			if (slot.state == USED && slot.key == key) { slot.value = value; return; }
+			if (slot.state == DELETED && !target) target = &slot;
+			if (slot.state == EMPTY) { if (!target) target = &slot; break; }
+		}
+		if (target->state == DELETED) deleted--;
+		target->key = key;
+		target->state = USED;
+		target->value = value;
+		count++;
+	}
+
+	bool remove(uint32 key) {
+		if (slots.empty())
+			return false;
+		unsigned int mask = (unsigned int)slots.size() - 1;
+		for (unsigned int i = key & mask; ; i = (i + 1) & mask) {
+			sSlot& slot = slots[i];
+			if (slot.state == EMPTY)
+				return false;
+			if (slot.state == USED && slot.key == key) { slot.state = DELETED; count--; deleted++; return true; }
+		}
+	}
+
+	void rehash(unsigned int size) {
+		std::vector<sSlot> old;
+		old.swap(slots);
+		slots.resize(size);
+		clear();
+		for (unsigned int i = 0; i < old.size(); ++i)
+			if (old[i].state == USED)
+				set(old[i].key, old[i].value);
+	}
+};
+
 //applies a transform to a AABB so it is 
 BoundingBox transformBoundingBox(const Matrix44 m, const BoundingBox& box);
 
@@ -11,12 +11,14 @@
 #include <cmath>
 
 #include "mygame.h"
+#include "savegame.h"
+#include "clock.h"
 
 Game* Game::instance = NULL;
 
-Image framebuffer(128, 128); //do not change framebuffer size
+Image framebuffer; //internal resolution, the stages layout everything using its size
 
-Game::Game(int window_width, int window_height, SDL_Window* window)
+Game::Game(int window_width, int window_height, SDL_Window* window, int framebuffer_width, int framebuffer_height, int presenter_type)
 {
 	this->window_width = window_width;
 	this->window_height = window_height;
@@ -29,6 +31,21 @@ Game::Game(int window_width, int window_height, SDL_Window* window)
 	time = 0.0f;
 	elapsed_time = 0.0f;
 
+	framebuffer = Image(framebuffer_width, framebuffer_height);
+	presenter = Presenter::create(presenter_type);
+
+	//if there is a baked pack (see --pack) all the assets come from it, otherwise they are loaded from data/
+	assets.mount("data.pack", &synth);
+
+	//decode the rest of the images in background while the intro plays, Image::Get returns placeholders meanwhile
+	Image::s_async_loading = true;
+	std::vector<std::string> images;
+	std::vector<std::string> files = listFiles("data");
+	for (int i = 0; i < files.size(); ++i)
+		if (files[i].size() > 4 && files[i].compare(files[i].size() - 4, 4, ".tga") == 0)
+			images.push_back(files[i]);
+	Image::preload(images);
+
 	//enableAudio(); //enable this line if you plan to add audio to your application
 	//synth.playSample("data/coin.wav",1,true);
 	//synth.osc1.amplitude = 0.5;
@@ -41,15 +58,22 @@ Game::Game(int window_width, int window_height, SDL_Window* window)
 	new NextTurnStage();
 	new TutorialStage();
 	new EndingStage();
-	Stage::changeStage("intro");
+	Stage::changeStage(STAGE_INTRO);
 }
 
 //what to do when the image has to be draw
 void Game::render(void)
 {
+	//fill the images that finished loading in background
+	Image::updateAsyncLoads();
+
 	//Create a new Image (or we could create a global one if we want to keep the previous frame)
 	Stage::current->render(framebuffer);
 
+	//record the frame, it only copies the pixels, a thread saves them
+	if (capture.isRecording())
+		capture.capture(framebuffer);
+
 	//send image to screen
 	showFramebuffer(&framebuffer);
 }
@@ -65,6 +89,36 @@ void Game::onKeyDown( SDL_KeyboardEvent event )
 	switch(event.keysym.sym)
 	{
 		case SDLK_ESCAPE: must_exit = true; break; //ESC key, kill the app
+		case SDLK_F2: //pause the game time
+			Clock::Get()->paused = !Clock::Get()->paused;
+			break;
+		case SDLK_F3: //fast-forward x1, x2, x4, x8
+			Clock::Get()->scale = Clock::Get()->scale >= 8 ? 1 : Clock::Get()->scale * 2;
+			std::cout << " * Game speed: x" << Clock::Get()->scale << std::endl;
+			break;
+		case SDLK_F5: //quick save
+			if (SaveGame::save(world, "savegame.sav"))
+				std::cout << " * Game saved" << std::endl;
+			break;
+		case SDLK_F6: //quick load
+			if (SaveGame::load(world, "savegame.sav"))
+			{
+				std::cout << " * Game loaded" << std::endl;
+				Stage::changeStage(STAGE_PLAY);
+			}
+			break;
+		case SDLK_F11: //toggle TGA sequence capture
+			if (capture.isRecording())
+				capture.stop();
+			else
+				capture.start("capture_%05d.tga", FrameCapture::TGA_SEQUENCE, framebuffer.width, framebuffer.height);
+			break;
+		case SDLK_F12: //toggle video capture
+			if (capture.isRecording())
+				capture.stop();
+			else
+				capture.start("capture.y4m", FrameCapture::Y4M, framebuffer.width, framebuffer.height);
+			break;
 	}
 }
 
@@ -101,39 +155,16 @@ void Game::onMouseWheel(SDL_MouseWheelEvent event)
 void Game::onResize(int width, int height)
 {
     std::cout << "window resized: " << width << "," << height << std::endl;
-	glViewport( 0,0, width, height );
+	if (presenter->type != Presenter::HEADLESS)
+		glViewport( 0,0, width, height );
 	window_width = width;
 	window_height = height;
 }
 
-//sends the image to the framebuffer of the GPU
+//sends the image to the window, the presenter takes care of scaling it
 void Game::showFramebuffer(Image* img)
 {
-	static Image finalframe;
-
-	if (window_width < img->width * 4 || window_height < img->height * 4)
-	{
-		finalframe = *img;
-		finalframe.scale( window_width, window_height );
-	}
-	else
-	{
-		if (finalframe.width != window_width || finalframe.height != window_height)
-		{
-			finalframe.resize(window_width, window_height);
-			finalframe.fill(Color::BLACK);
-		}
-		finalframe.drawImage(*img, (window_width - img->width * 4) * 0.5, (window_height - img->height * 4) * 0.5, img->width * 4, img->height * 4);
-	}
-
-	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-	if (1) //flip
-	{
-		glRasterPos2f(-1, 1);
-		glPixelZoom(1, -1);
-	}
-
-	glDrawPixels(finalframe.width, finalframe.height, GL_RGBA, GL_UNSIGNED_BYTE, finalframe.pixels);
+	presenter->present(*img, window_width, window_height);
 }
 
 //AUDIO STUFF ********************
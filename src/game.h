@@ -9,6 +9,9 @@
 #include "image.h"
 #include "utils.h"
 #include "synth.h"
+#include "assetpack.h"
+#include "capture.h"
+#include "presenter.h"
 
 class Game
 {
@@ -30,8 +33,17 @@ public:
 	//audio
 	Synth synth;
 
-	//ctor
-	Game( int window_width, int window_height, SDL_Window* window );
+	//assets baked in a single file (if found)
+	AssetPack assets;
+
+	//recording of the framebuffer (F11 TGA sequence, F12 video)
+	FrameCapture capture;
+
+	//sends the framebuffer to the window (OpenGL, software or headless)
+	Presenter* presenter;
+
+	//ctor, the framebuffer is the internal resolution the stages render to
+	Game( int window_width, int window_height, SDL_Window* window, int framebuffer_width = 128, int framebuffer_height = 128, int presenter_type = Presenter::OPENGL );
 
 	//main functions
 	void render( void );
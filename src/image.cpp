@@ -1,6 +1,16 @@
 #include "image.h"
 #include <algorithm>    // std::max, min, clamp
+#include <mutex>
 #include "utils.h"
+#include "threadpool.h"
+#include "font.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#include <emmintrin.h>
+	#define TGA_USE_SSE2
+#endif
+
+#define TGA_RLE_CHUNK_SIZE 16384 //bytes of the file decoded at a time
 
 template <typename T> T clamp(const T& value, const T& low, const T& high)
 {
@@ -8,10 +18,15 @@ template <typename T> T clamp(const T& value, const T& low, const T& high)
 }
 
 std::map<std::string, Image*> Image::s_loaded_images;
+HashTable<Image*> Image::s_images_by_id;
+bool Image::s_async_loading = false;
 
 Image::Image() {
 	width = 0; height = 0;
 	pixels = NULL;
+	external = false;
+	loading = false;
+	released = false;
 }
 
 Image::Image(unsigned int width, unsigned int height)
@@ -19,12 +34,18 @@ Image::Image(unsigned int width, unsigned int height)
 	this->width = width;
 	this->height = height;
 	pixels = new Color[width*height];
+	external = false;
+	loading = false;
+	released = false;
 	memset(pixels, 0, width * height * sizeof(Color));
 }
 
 //copy constructor
 Image::Image(const Image& c) {
 	pixels = NULL;
+	external = false;
+	loading = false;
+	released = false;
 
 	width = c.width;
 	height = c.height;
@@ -38,14 +59,13 @@ Image::Image(const Image& c) {
 //assign operator
 Image& Image::operator = (const Image& c)
 {
-	if(pixels) delete pixels;
-	pixels = NULL;
+	freePixels();
 
 	width = c.width;
 	height = c.height;
 	if(c.pixels)
 	{
-		pixels = new Color[width*height*sizeof(Color)];
+		pixels = new Color[width*height];
 		memcpy(pixels, c.pixels, width*height*sizeof(Color));
 	}
 	return *this;
@@ -53,11 +73,7 @@ Image& Image::operator = (const Image& c)
 
 Image::~Image()
 {
-	if (pixels)
-	{
-		delete pixels;
-		pixels = NULL;
-	}
+	freePixels();
 }
 
 
@@ -183,6 +199,40 @@ void Image::drawImage(const Image& img, int sx, int sy, int sw, int sh, int dx,
 
 
 
+void Image::drawImage(const IndexedImage& img, int x, int y, int imgx, int imgy, int imgw, int imgh, const Color* palette)
+{
+	if (x > (int)width || y > (int)height || (x + (int)imgw) < 0 || (y + (int)imgh) < 0)
+		return; //outside
+
+	if (!palette)
+		palette = img.palette;
+	imgx = clamp(imgx, 0, (int)img.width);
+	imgy = clamp(imgy, 0, (int)img.height);
+	imgw = clamp(imgw, 0, (int)img.width - imgx);
+	imgh = clamp(imgh, 0, (int)img.height - imgy);
+	int startx = clamp(x, 0, (int)width);
+	int starty = clamp(y, 0, (int)height);
+	int endx = clamp(x + imgw, 0, (int)width);
+	int endy = clamp(y + imgh, 0, (int)height);
+
+	//row by row, reading one byte per pixel
+	for (int j = starty; j < endy; ++j)
+	{
+		const uint8* src = img.indices + (j - y + imgy) * img.width + (startx - x + imgx);
+		Color* dst = pixels + j * width + startx;
+		for (int i = startx; i < endx; ++i, ++src, ++dst)
+		{
+			if (*src == IndexedImage::TRANSPARENT_INDEX)
+				continue;
+			const Color& c = palette[*src];
+			if (c.a == 255)
+				*dst = c;
+			else if (c.a)
+				*dst = blendColors(c, *dst);
+		}
+	}
+}
+
 void Image::drawLine(int x0, int y0, int x1, int y1, const Color& c)
 {
 	int dx = abs(x1 - x0), sx = x0 < x1 ? 1 : -1;
@@ -199,20 +249,9 @@ void Image::drawLine(int x0, int y0, int x1, int y1, const Color& c)
 	}
 }
 
-void Image::drawText(std::string text, int x, int y, const Image& bitmapfont, int font_w, int font_h, int first_char )
+void Image::drawText(const char* text, int x, int y, const Image& bitmapfont, int font_w, int font_h, int first_char )
 {
-	int startx = x;
-	for (int i = 0; i < text.size(); ++i)
-	{
-		if (text[i] == '\n')
-		{
-			y += font_h;
-			x = startx;
-			continue;
-		}
-		drawImage( bitmapfont, x, y, bitmapfont.getArea(text[i] - first_char, font_w, font_h));
-		x += font_w;
-	}
+	BitmapFont::Get(&bitmapfont, font_w, font_h, first_char)->draw(*this, text, x, y);
 }
 
 void Image::drawRectangle(int x, int y, int w, int h, const Color& c)
@@ -248,7 +287,7 @@ void Image::crop(unsigned int x, unsigned int y, unsigned int width, unsigned in
 		for (unsigned int i = 0; i < width; ++i)
 			for (unsigned int j = 0; j < height; ++j)
 				new_pixels[j * width + i] = getPixelSafe(i - x, j - y);
-		delete pixels;
+		freePixels();
 	}
 	this->width = width;
 	this->height = height;
@@ -287,7 +326,7 @@ void Image::scale(unsigned int width, unsigned int height)
 		for(unsigned int y = 0; y < height; ++y)
 			new_pixels[ y * width + x ] = getPixel((unsigned int)(this->width * (x / (float)width)), (unsigned int)(this->height * (y / (float)height)) );
 
-	delete pixels;
+	freePixels();
 	this->width = width;
 	this->height = height;
 	pixels = new_pixels;
@@ -306,13 +345,9 @@ void Image::flipX()
 
 void Image::flipY()
 {
-	for(unsigned int x = 0; x < width; ++x)
-		for(unsigned int y = 0; y < height * 0.5; ++y)
-		{
-			Color temp = getPixel(x, height - y - 1);
-			setPixel( x, height - y - 1, getPixel(x,y) );
-			setPixel( x, y, temp );
-		}
+	//swap whole rows
+	for(unsigned int y = 0; y < height / 2; ++y)
+		std::swap_ranges(pixels + y * width, pixels + (y + 1) * width, pixels + (height - y - 1) * width);
 }
 
 //reduce color palette quantizing every channel
@@ -348,141 +383,493 @@ void Image::maskAlpha(const Color& alpha_color)
 	}
 }
 
-//Loads an image from a TGA file
+//converts a row of BGRA (TGA order) to RGBA Colors, src and dst can be the same buffer
+static void convertRowBGRA(Color* dst, const unsigned char* src, unsigned int count)
+{
+	unsigned int i = 0;
+#ifdef TGA_USE_SSE2
+	//swap R and B of four pixels at a time: keep G and A, shift the other two bytes 16 bits to each side
+	const __m128i mask_ga = _mm_set1_epi32(0xFF00FF00);
+	const __m128i mask_rb = _mm_set1_epi32(0x00FF00FF);
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128i px = _mm_loadu_si128((const __m128i*)(src + i * 4));
+		__m128i rb = _mm_and_si128(px, mask_rb);
+		rb = _mm_or_si128(_mm_slli_epi32(rb, 16), _mm_srli_epi32(rb, 16));
+		_mm_storeu_si128((__m128i*)(dst + i), _mm_or_si128(_mm_and_si128(px, mask_ga), rb));
+	}
+#endif
+	for (; i < count; ++i)
+	{
+		const unsigned char* p = src + i * 4;
+		dst[i] = Color(p[2], p[1], p[0], p[3]);
+	}
+}
+
+//converts BGR (TGA order) to RGBA Colors, dst can overlap src as long as src starts after dst (in-place expansion)
+static void convertRowBGR(Color* dst, const unsigned char* src, unsigned int count)
+{
+	for (unsigned int i = 0; i < count; ++i)
+	{
+		const unsigned char* p = src + i * 3;
+		unsigned char b = p[0], g = p[1], r = p[2]; //read before writing, they could overlap
+		dst[i] = Color(r, g, b, 255);
+	}
+}
+
+//Loads an image from a TGA file (uncompressed or RLE, 24 or 32 bits)
 bool Image::loadTGA(const char* filename)
 {
-	unsigned char TGAheader[12] = { 0, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
-	unsigned char TGAcompare[12];
-	unsigned char header[6];
-	unsigned int bytesPerPixel;
-	unsigned int imageSize;
+	unsigned char header[18];
 
 	FILE * file = fopen(filename, "rb");
-	if (file == NULL || fread(TGAcompare, 1, sizeof(TGAcompare), file) != sizeof(TGAcompare) ||
-		memcmp(TGAheader, TGAcompare, sizeof(TGAheader)) != 0 ||
-		fread(header, 1, sizeof(header), file) != sizeof(header))
+	if (file == NULL || fread(header, 1, sizeof(header), file) != sizeof(header))
 	{
 		std::cerr << "File not found: " << filename << std::endl;
-		if (file == NULL)
-			return NULL;
-		else
-		{
+		if (file)
 			fclose(file);
-			return NULL;
-		}
+		return false;
 	}
 
-	TGAInfo* tgainfo = new TGAInfo;
-
-	tgainfo->width = header[1] * 256 + header[0];
-	tgainfo->height = header[3] * 256 + header[2];
+	unsigned int id_length = header[0];
+	unsigned int color_map_type = header[1];
+	unsigned int type = header[2];
+	unsigned int new_width = header[12] | (header[13] << 8);
+	unsigned int new_height = header[14] | (header[15] << 8);
+	unsigned int bpp = header[16];
 
-	if (tgainfo->width <= 0 || tgainfo->height <= 0 || (header[4] != 24 && header[4] != 32))
+	if ((type != 2 && type != 10) || color_map_type != 0 || new_width == 0 || new_height == 0 || (bpp != 24 && bpp != 32))
 	{
-		std::cerr << "TGA file seems to have errors or it is compressed, only uncompressed TGAs supported" << std::endl;
+		std::cerr << "TGA file seems to have errors, only true-color TGAs (uncompressed or RLE) supported: " << filename << std::endl;
 		fclose(file);
-		delete tgainfo;
-		return NULL;
+		return false;
 	}
+	fseek(file, id_length, SEEK_CUR);
 
-	tgainfo->bpp = header[4];
-	bytesPerPixel = tgainfo->bpp / 8;
-	imageSize = tgainfo->width * tgainfo->height * bytesPerPixel;
+	unsigned int bytes_per_pixel = bpp / 8;
+	unsigned int num_pixels = new_width * new_height;
 
-	tgainfo->data = new unsigned char[imageSize];
+	//the file data goes straight into the pixels buffer and is converted in place, every row already in its flipped
+	//place (rows are stored bottom-up, the origin bit is ignored, our assets set it but are stored bottom-up)
+	Color* new_pixels = new Color[num_pixels];
+	bool ok = true;
 
-	if (tgainfo->data == NULL || fread(tgainfo->data, 1, imageSize, file) != imageSize)
+	if (type == 2) //uncompressed
 	{
-		if (tgainfo->data != NULL)
-			delete tgainfo->data;
-
-		fclose(file);
-		delete tgainfo;
-		return false;
+		for (unsigned int y = 0; ok && y < new_height; ++y)
+		{
+			Color* row = new_pixels + (new_height - 1 - y) * new_width;
+			//24 bits are read at the end of the row so they can be expanded to 32 bits going forward
+			unsigned char* src = (unsigned char*)row + new_width * (4 - bytes_per_pixel);
+			ok = fread(src, bytes_per_pixel, new_width, file) == new_width;
+			if (ok && bytes_per_pixel == 4)
+				convertRowBGRA(row, src, new_width);
+			else if (ok)
+				convertRowBGR(row, src, new_width);
+		}
+	}
+	else //RLE compressed, read in chunks
+	{
+		unsigned char chunk[TGA_RLE_CHUNK_SIZE];
+		unsigned int chunk_size = 0, chunk_pos = 0;
+		unsigned int x = 0, y = 0;
+		while (ok && y < new_height)
+		{
+			//keep a whole packet in the chunk, the longest is one byte and 128 pixels
+			if (chunk_size - chunk_pos < 1 + 128 * 4)
+			{
+				memmove(chunk, chunk + chunk_pos, chunk_size - chunk_pos);
+				chunk_size -= chunk_pos;
+				chunk_pos = 0;
+				chunk_size += fread(chunk + chunk_size, 1, sizeof(chunk) - chunk_size, file);
+			}
+			if (chunk_pos >= chunk_size)
+			{
+				ok = false;
+				break;
+			}
+			unsigned char packet = chunk[chunk_pos++];
+			unsigned int count = (packet & 0x7F) + 1;
+			bool run = (packet & 0x80) != 0; //the same pixel count times
+			unsigned int packet_size = run ? bytes_per_pixel : count * bytes_per_pixel;
+			if (chunk_pos + packet_size > chunk_size)
+			{
+				ok = false;
+				break;
+			}
+			const unsigned char* src = chunk + chunk_pos;
+			chunk_pos += packet_size;
+
+			//packets can continue in the next row
+			while (count && y < new_height)
+			{
+				unsigned int num = min(count, new_width - x);
+				Color* dst = new_pixels + (new_height - 1 - y) * new_width + x;
+				if (run)
+				{
+					Color c(src[2], src[1], src[0], bytes_per_pixel == 4 ? src[3] : 255);
+					for (unsigned int i = 0; i < num; ++i)
+						dst[i] = c;
+				}
+				else
+				{
+					if (bytes_per_pixel == 4)
+						convertRowBGRA(dst, src, num);
+					else
+						convertRowBGR(dst, src, num);
+					src += num * bytes_per_pixel;
+				}
+				count -= num;
+				x += num;
+				if (x == new_width)
+				{
+					x = 0;
+					y++;
+				}
+			}
+		}
 	}
 
 	fclose(file);
 
+	if (!ok)
+	{
+		std::cerr << "TGA file is truncated: " << filename << std::endl;
+		delete[] new_pixels;
+		return false;
+	}
+
 	//save info in image
-	if (pixels)
-		delete pixels;
+	freePixels();
+	width = new_width;
+	height = new_height;
+	pixels = new_pixels;
 
-	width = tgainfo->width;
-	height = tgainfo->height;
-	pixels = new Color[width*height];
-	bool flip = true;
+	std::cout << " + Image loaded: " << filename << std::endl;
+	return true;
+}
 
-	//convert tga pixel format
-	for (unsigned int y = 0; y < height; ++y)
-		for (unsigned int x = 0; x < width; ++x)
+//encodes a row of pixels as TGA RLE packets (24 bits), returns the bytes written
+static unsigned int encodeRowRLE(unsigned char* out, const Color* row, unsigned int count)
+{
+	unsigned char* start = out;
+	unsigned int i = 0;
+	while (i < count)
+	{
+		//length of the run starting at i
+		unsigned int run = 1;
+		while (i + run < count && run < 128 && memcmp(&row[i + run], &row[i], 3) == 0)
+			run++;
+		if (run > 1)
 		{
-			unsigned int pos = y * width * bytesPerPixel + x * bytesPerPixel;
-			unsigned int alpha = bytesPerPixel == 4 ? tgainfo->data[pos + 3] : 255;
-			this->setPixel(x, flip ? height - y - 1 : y, Color(tgainfo->data[pos + 2], tgainfo->data[pos + 1], tgainfo->data[pos], alpha));
+			*out++ = 0x80 | (run - 1);
+			*out++ = row[i].b; *out++ = row[i].g; *out++ = row[i].r;
+			i += run;
+			continue;
 		}
 
-	delete tgainfo->data;
-	delete tgainfo;
-	std::cout << " + Image loaded: " << filename << std::endl;
+		//raw packet till a run of two starts
+		unsigned int raw = 1;
+		while (i + raw < count && raw < 128 && !(i + raw + 1 < count && memcmp(&row[i + raw], &row[i + raw + 1], 3) == 0))
+			raw++;
+		*out++ = raw - 1;
+		for (unsigned int j = 0; j < raw; ++j)
+		{
+			*out++ = row[i + j].b; *out++ = row[i + j].g; *out++ = row[i + j].r;
+		}
+		i += raw;
+	}
+	return out - start;
+}
 
-	return true;
+//worst case size of encodeTGA (RLE adds one byte every 128 pixels at most)
+unsigned int Image::getTGAMaxSize() const
+{
+	return 18 + width * height * 3 + height * (width / 128 + 1);
 }
 
-// Saves the image to a TGA file
-bool Image::saveTGA(const char* filename)
+//writes the TGA file (24 bits) in memory, returns the size in bytes. out must have getTGAMaxSize() bytes
+unsigned int Image::encodeTGA(unsigned char* out, bool rle) const
 {
-	unsigned char TGAheader[12] = { 0, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+	unsigned char* header = out;
+	memset(header, 0, 18);
+	header[2] = rle ? 10 : 2;
+	header[12] = width & 0xFF;
+	header[13] = (width >> 8) & 0xFF;
+	header[14] = height & 0xFF;
+	header[15] = (height >> 8) & 0xFF;
+	header[16] = 24;
+
+	//convert pixels to unsigned char, bottom-up
+	unsigned int size = 18;
+	for (unsigned int y = 0; y < height; ++y)
+	{
+		const Color* row = pixels + (height - y - 1) * width;
+		if (rle)
+		{
+			size += encodeRowRLE(out + size, row, width);
+			continue;
+		}
+		for (unsigned int x = 0; x < width; ++x)
+		{
+			out[size++] = row[x].b;
+			out[size++] = row[x].g;
+			out[size++] = row[x].r;
+		}
+	}
+	return size;
+}
 
+// Saves the image to a TGA file (24 bits), optionally RLE compressed
+bool Image::saveTGA(const char* filename, bool rle)
+{
 	FILE *file = fopen(filename, "wb");
 	if (file == NULL)
-	{
-		fclose(file);
 		return false;
-	}
-
-	unsigned short header_short[3];
-	header_short[0] = width;
-	header_short[1] = height;
-	unsigned char* header = (unsigned char*)header_short;
-	header[4] = 24;
-	header[5] = 0;
 
-	//tgainfo->width = header[1] * 256 + header[0];
-	//tgainfo->height = header[3] * 256 + header[2];
-
-	fwrite(TGAheader, 1, sizeof(TGAheader), file);
-	fwrite(header, 1, 6, file);
+	unsigned char* bytes = new unsigned char[getTGAMaxSize()];
+	unsigned int size = encodeTGA(bytes, rle);
+	fwrite(bytes, 1, size, file);
+	fclose(file);
+	delete[] bytes;
+	return true;
+}
 
-	//convert pixels to unsigned char
-	unsigned char* bytes = new unsigned char[width*height * 3];
-	for (unsigned int y = 0; y < height; ++y)
-		for (unsigned int x = 0; x < width; ++x)
+//loads big atlases (uncompressed and RLE) several times to measure the loader
+void Image::benchmarkTGA(unsigned int size)
+{
+	//an atlas made of flat tiles with some noise, like the real ones
+	Image atlas(size, size);
+	for (unsigned int y = 0; y < size; ++y)
+		for (unsigned int x = 0; x < size; ++x)
 		{
-			Color c = pixels[(height - y - 1)*width + x];
-			unsigned int pos = (y*width + x) * 3;
-			bytes[pos + 2] = c.r;
-			bytes[pos + 1] = c.g;
-			bytes[pos] = c.b;
+			unsigned int tile = (x / 16) * 7 + (y / 16) * 13;
+			Color c((tile * 37) & 0xFF, (tile * 91) & 0xFF, (tile * 53) & 0xFF);
+			if ((x * 7 + y * 3) % 11 == 0)
+				c = Color::BLACK;
+			atlas.setPixel(x, y, c);
 		}
 
-	fwrite(bytes, 1, width*height * 3, file);
-	fclose(file);
-	return true;
+	const char* files[2] = { "_bench_raw.tga", "_bench_rle.tga" };
+	atlas.saveTGA(files[0], false);
+	atlas.saveTGA(files[1], true);
+
+	std::cout << "TGA loader benchmark " << size << "x" << size << std::endl;
+	for (int i = 0; i < 2; ++i)
+	{
+		FILE* f = fopen(files[i], "rb");
+		fseek(f, 0, SEEK_END);
+		long file_size = ftell(f);
+		fclose(f);
+
+		const int iterations = 10;
+		Image img;
+		Uint64 start = SDL_GetPerformanceCounter();
+		for (int j = 0; j < iterations; ++j)
+			img.loadTGA(files[i]);
+		double seconds = (SDL_GetPerformanceCounter() - start) / (double)SDL_GetPerformanceFrequency() / iterations;
+		bool same = memcmp(img.pixels, atlas.pixels, size * size * sizeof(Color)) == 0;
+		std::cout << (i == 0 ? " uncompressed: " : " RLE: ") << file_size / 1024 << " KB, " << seconds * 1000.0 << " ms, "
+			<< (size * size * sizeof(Color)) / (seconds * 1024 * 1024) << " MB/s " << (same ? "" : "(MISMATCH)") << std::endl;
+		remove(files[i]);
+	}
 }
 
 void Image::setName(std::string name)
 {
 	this->name = name;
 	s_loaded_images[name] = this;
+
+	uint32 id = hashString(name.c_str());
+	Image** other = s_images_by_id.find(id);
+	if (other && *other != this && (*other)->name != name)
+	{
+		//the AssetID of one of them would get the other image, rename one of the files
+		std::cerr << "Image name hash collision: " << name << " and " << (*other)->name << std::endl;
+		assert(!"Image name hash collision");
+		return;
+	}
+	s_images_by_id.set(id, this);
+}
+
+void Image::release(const AssetID& id)
+{
+	Image** img = s_images_by_id.find(id.hash);
+	if (!img || (*img)->released || (*img)->loading || (*img)->external)
+		return; //not loaded yet, or its pixels are not ours (inside a mapped asset pack)
+	(*img)->freePixels();
+	(*img)->width = (*img)->height = 1;
+	(*img)->pixels = new Color[1];
+	(*img)->pixels[0] = Color(0, 0, 0, 0);
+	(*img)->released = true;
+}
+
+void Image::unregister(Image* img)
+{
+	auto it = s_loaded_images.find(img->name);
+	if (it != s_loaded_images.end() && it->second == img)
+		s_loaded_images.erase(it);
+	Image** registered = s_images_by_id.find(hashString(img->name.c_str()));
+	if (registered && *registered == img)
+		s_images_by_id.remove(hashString(img->name.c_str()));
 }
 
 Image* Image::Get(std::string name)
 {
 	auto it = s_loaded_images.find(name);
+	if (it != s_loaded_images.end() && it->second->released)
+	{
+		//in the same image, whoever kept the pointer gets the pixels too
+		Image* img = it->second;
+		if (img->loadTGA(name.c_str()))
+			img->released = false;
+		return img;
+	}
 	if (it != s_loaded_images.end())
 		return it->second;
+	if (s_async_loading)
+		return GetAsync(name);
 	Image* img = new Image();
 	img->loadTGA(name.c_str());
 	img->setName(name);
 	return img;
 }
+
+//images decoded by the workers waiting to be published: { placeholder, decoded }
+static std::vector< std::pair<Image*, Image*> > s_finished_loads;
+static std::mutex s_finished_mutex;
+
+Image* Image::GetAsync(std::string name)
+{
+	auto it = s_loaded_images.find(name);
+	if (it != s_loaded_images.end())
+		return it->second;
+
+	//placeholder with one transparent pixel, so drawing it or reading areas is safe
+	Image* img = new Image(1, 1);
+	img->loading = true;
+	img->setName(name);
+
+	//the worker only touches its own image, the placeholder is filled in updateAsyncLoads
+	ThreadPool::Get()->add([img, name]() {
+		Image* decoded = new Image();
+		decoded->loadTGA(name.c_str());
+		std::unique_lock<std::mutex> lock(s_finished_mutex);
+		s_finished_loads.push_back(std::make_pair(img, decoded));
+	});
+	return img;
+}
+
+void Image::preload(const std::vector<std::string>& names)
+{
+	for (int i = 0; i < names.size(); ++i)
+		GetAsync(names[i]);
+}
+
+void Image::updateAsyncLoads()
+{
+	std::unique_lock<std::mutex> lock(s_finished_mutex);
+	for (int i = 0; i < s_finished_loads.size(); ++i)
+	{
+		Image* img = s_finished_loads[i].first;
+		Image* decoded = s_finished_loads[i].second;
+		if (decoded->pixels) //if it failed we keep the placeholder
+		{
+			img->freePixels();
+			img->width = decoded->width;
+			img->height = decoded->height;
+			img->pixels = decoded->pixels;
+			img->external = decoded->external;
+			decoded->pixels = NULL;
+		}
+		img->loading = false;
+		delete decoded;
+	}
+	s_finished_loads.clear();
+}
+
+
+HashTable<IndexedImage*> IndexedImage::s_indexed_images;
+
+IndexedImage::IndexedImage()
+{
+	width = height = 0;
+	indices = NULL;
+	palette_size = 1;
+	for (int i = 0; i < 256; ++i) //unused entries are transparent too
+		palette[i] = Color(0, 0, 0, 0);
+}
+
+IndexedImage::~IndexedImage()
+{
+	if (indices)
+		delete[] indices;
+}
+
+int IndexedImage::findColor(const Color& c) const
+{
+	for (unsigned int i = 1; i < palette_size; ++i)
+		if (memcmp(&palette[i], &c, sizeof(Color)) == 0)
+			return i;
+	return -1;
+}
+
+bool IndexedImage::fromImage(const Image& img)
+{
+	uint8* new_indices = new uint8[img.width * img.height];
+	palette_size = 1;
+	for (unsigned int i = 0; i < img.width * img.height; ++i)
+	{
+		const Color& c = img.pixels[i];
+		if (c.a == 0)
+		{
+			new_indices[i] = TRANSPARENT_INDEX;
+			continue;
+		}
+		int index = findColor(c);
+		if (index == -1)
+		{
+			if (palette_size == 256)
+			{
+				std::cerr << "Image has too many colors to be indexed: " << img.name << std::endl;
+				delete[] new_indices;
+				return false;
+			}
+			index = palette_size++;
+			palette[index] = c;
+		}
+		new_indices[i] = index;
+	}
+
+	if (indices)
+		delete[] indices;
+	indices = new_indices;
+	width = img.width;
+	height = img.height;
+	return true;
+}
+
+void IndexedImage::toImage(Image& img) const
+{
+	img = Image(width, height);
+	for (unsigned int i = 0; i < width * height; ++i)
+		img.pixels[i] = palette[indices[i]];
+}
+
+IndexedImage* IndexedImage::Get(const AssetID& id)
+{
+	IndexedImage** cached = s_indexed_images.find(id.hash);
+	if (cached)
+		return *cached;
+	Image* img = Image::Get(id);
+	if (img->loading)
+		return NULL;
+	IndexedImage* indexed = new IndexedImage();
+	if (!indexed->fromImage(*img))
+	{
+		delete indexed;
+		indexed = NULL; //cached as NULL so we do not try again every frame
+	}
+	s_indexed_images.set(id.hash, indexed);
+	return indexed;
+}
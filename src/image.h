@@ -19,22 +19,27 @@
 #pragma warning(disable:4996)
 
 
+//identifies an asset by the hash of its path, declare them as constants so the hash is computed at compile time:
+//   const AssetID TILESET("data/tileset.tga");   ...   Image::Get(TILESET)
+struct AssetID
+{
+	uint32 hash;
+	const char* path; //only used to load it the first time and for diagnostics
+	constexpr AssetID(const char* path) : hash(hashString(path)), path(path) {}
+};
+
+class IndexedImage;
+
 //Class Image: to store a matrix of pixels
 class Image
 {
-	//a general struct to store all the information about a TGA file
-	typedef struct sTGAInfo 
-	{
-		unsigned int width;
-		unsigned int height;
-		unsigned int bpp; //bits per pixel
-		unsigned char* data; //bytes with the pixel information
-	} TGAInfo;
-
 public:
 	unsigned int width;
 	unsigned int height;
 	Color* pixels;
+	bool external; //pixels are not owned by the image (p.e. they point inside a mapped asset pack)
+	bool loading; //it is being loaded in background, meanwhile it is a transparent 1x1 placeholder
+	bool released; //its pixels were freed with release, meanwhile it is a transparent 1x1 placeholder and Get loads it again
 	std::string name;
 
 	// CONSTRUCTORS 
@@ -46,6 +51,8 @@ public:
 	//destructor
 	~Image();
 
+	void freePixels() { if (pixels && !external) delete[] pixels; pixels = NULL; external = false; }
+
 	//get the pixel at position x,y
 	Color getPixel(unsigned int x, unsigned int y) const { return pixels[ y * width + x ]; }
 	Color& getPixelRef(unsigned int x, unsigned int y)	{ return pixels[ y * width + x ]; }
@@ -73,8 +80,11 @@ public:
 	void drawImage(const Image& img, int x, int y, int imgx, int imgy, int imgw, int imgh); //draws only a part of the image
 	void drawImage(const Image& img, int sx, int sy, int sw, int sh, int dx, int dy, int dw, int dh); //draws only a part of the image
 	void drawImage(const Image& img, int x, int y, Area rect) { drawImage(img, x, y, rect.x, rect.y, rect.w, rect.h); }//draws only a part of the image
+	void drawImage(const IndexedImage& img, int x, int y, int imgx, int imgy, int imgw, int imgh, const Color* palette = NULL); //draws part of an indexed image, optionally with another palette
+	void drawImage(const IndexedImage& img, int x, int y, Area rect, const Color* palette = NULL) { drawImage(img, x, y, rect.x, rect.y, rect.w, rect.h, palette); }
 	void drawLine( int x0, int y0, int x1, int y1, const Color& c);
-	void drawText( std::string text, int x, int y, const Image& bitmapfont, int font_w = 7, int font_h = 9, int first_char = 32);
+	void drawText( const char* text, int x, int y, const Image& bitmapfont, int font_w = 7, int font_h = 9, int first_char = 32); //uses the glyph spans cached in BitmapFont
+	void drawText( const std::string& text, int x, int y, const Image& bitmapfont, int font_w = 7, int font_h = 9, int first_char = 32) { drawText(text.c_str(), x, y, bitmapfont, font_w, font_h, first_char); }
 	void drawRectangle(int x, int y, int w, int h, const Color& c);
 
 	void maskAlpha(const Color& alpha_color); //every pixel with the given color will be set to transparent
@@ -91,13 +101,55 @@ public:
 	Area getArea( int index, int w, int h) const; //returns a frame rect given the frame index and the width and height of every frame
 
 	//save or load images from the hard drive
-	bool loadTGA(const char* filename);
-	bool saveTGA(const char* filename);
+	bool loadTGA(const char* filename); //uncompressed or RLE, 24 or 32 bits
+	bool saveTGA(const char* filename, bool rle = false);
+	unsigned int encodeTGA(unsigned char* out, bool rle = false) const; //TGA file in memory, returns the size
+	unsigned int getTGAMaxSize() const; //bytes needed by encodeTGA
+	static void benchmarkTGA(unsigned int size = 2048);
 
 	//manager to load several images
 	static Image* Get( std::string name );
+	static Image* Get( const AssetID& id ) { Image** img = s_images_by_id.find(id.hash); return img && !(*img)->released ? *img : Get(std::string(id.path)); } //fast path, no strings
+	static void release( const AssetID& id ); //frees the pixels of a loaded image (p.e. when only its IndexedImage is used), pointers to it stay valid
 	static std::map<std::string, Image*> s_loaded_images;
+	static HashTable<Image*> s_images_by_id; //same images indexed by the hash of the name
 	void setName(std::string name);
+	static void unregister(Image* img);
+
+	//async loading: when enabled Get returns placeholders that are filled once the worker threads finish
+	static bool s_async_loading;
+	static Image* GetAsync( std::string name );
+	static void preload( const std::vector<std::string>& names );
+	static void updateAsyncLoads(); //publishes the finished images, call it from the main thread once per frame
+};
+
+//Class IndexedImage: one byte per pixel that indexes a palette of 256 colors, a quarter of the memory of an Image.
+//Changing the palette changes every pixel using it (useful for tints and color swaps)
+class IndexedImage
+{
+public:
+	enum { TRANSPARENT_INDEX = 0 }; //reserved, always fully transparent
+
+	unsigned int width;
+	unsigned int height;
+	uint8* indices;
+	Color palette[256];
+	unsigned int palette_size; //entries in use, including the transparent one
+
+	IndexedImage();
+	~IndexedImage();
+
+	bool fromImage(const Image& img); //fails if the image has more than 255 different colors
+	void toImage(Image& img) const;
+	int findColor(const Color& c) const; //-1 if not in the palette
+
+	uint8 getIndex(unsigned int x, unsigned int y) const { return indices[y * width + x]; }
+	Color getPixel(unsigned int x, unsigned int y) const { return palette[indices[y * width + x]]; }
+
+	//indexed version of an image loaded with Image::Get, NULL while the image is still loading.
+	//Once converted the pixels of the Image are freed (it becomes a transparent pixel), draw that asset only from here
+	static IndexedImage* Get(const AssetID& id);
+	static HashTable<IndexedImage*> s_indexed_images;
 };
 
 inline Image operator * (const Image& a, const Image& b) {
@@ -54,7 +54,8 @@ void Input::update()
 
 void Input::centerMouse()
 {
-	//return;
+	if (!window) //headless
+		return;
 	int window_width, window_height;
 	SDL_GetWindowSize(window, &window_width, &window_height);
 
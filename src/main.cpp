@@ -13,16 +13,37 @@
 #include "utils.h"
 #include "input.h"
 #include "game.h"
+#include "spritebatch.h"
+#include "replay.h"
+#include "clock.h"
+#include "simulation.h"
+#include "planner.h"
+#include "pathfinding.h"
+#include "entities.h"
+#include "regions.h"
+#include "mappyramid.h"
+#include "threadpool.h"
 
 #include <iostream> //to output
 #include <fstream>
 #include <string>
+#include <ctime>
 
 long last_time = 0; //this is used to calcule the elapsed time between frames
 
 Game* game = NULL;
 
 // *********************************
+//headless (no presenter): SDL without video, so it also runs in machines without a display or a GPU
+void initHeadless()
+{
+	SDL_Init(SDL_INIT_TIMER | SDL_INIT_EVENTS);
+	SDL_InitSubSystem(SDL_INIT_AUDIO); //optional, the game can run without audio device
+	SDL_InitSubSystem(SDL_INIT_JOYSTICK);
+	atexit(SDL_Quit);
+	Input::init(NULL);
+}
+
 //create a window using SDL
 SDL_Window* createWindow(const char* caption, int width, int height, bool fullscreen = false)
 {
@@ -58,7 +79,7 @@ SDL_Window* createWindow(const char* caption, int width, int height, bool fullsc
 	}
   
 	// Create an OpenGL context associated with the window.
-	SDL_GLContext glcontext = SDL_GL_CreateContext(window);
+	SDL_GL_CreateContext(window);
 
 	//in case of exit, call SDL_Quit()
 	atexit(SDL_Quit);
@@ -84,13 +105,12 @@ SDL_Window* createWindow(const char* caption, int width, int height, bool fullsc
 }
 
 
-//The application main loop
-void mainLoop()
+//The application main loop, the input of every frame is stored in the recording (if any)
+void mainLoop(InputRecording* recording = NULL)
 {
 	SDL_Event sdlEvent;
 
-	long start_time = SDL_GetTicks();
-	long now = start_time;
+	Clock* clock = Clock::Get();
 	long frames_this_second = 0;
 
 	while (!game->must_exit)
@@ -98,9 +118,12 @@ void mainLoop()
 		Input::update();
 
 		//render frame
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		bool headless = game->presenter->type == Presenter::HEADLESS;
+		if (!headless)
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 		game->render();
-		SDL_GL_SwapWindow(game->window);
+		if (!headless)
+			SDL_GL_SwapWindow(game->window);
 
 		//update events
 		while(SDL_PollEvent(&sdlEvent))
@@ -147,47 +170,298 @@ void mainLoop()
 		}
 
         
-		//compute delta time
-		long last_time = now;
-		now = SDL_GetTicks();
-		double elapsed_time = (now - last_time) * 0.001; //0.001 converts from milliseconds to seconds
-		double last_time_seconds = game->time;
-        game->time = float(now * 0.001);
-		game->elapsed_time = elapsed_time;
+		//compute delta time, the clock is the only one reading the real time
+		long last_real_time = clock->real_time;
+		clock->tick();
+		if (recording)
+			recording->recordFrame(clock->delta);
+		game->time = clock->time * 0.001f;
+		game->elapsed_time = clock->elapsed;
 		game->frame++;
 		frames_this_second++;
-		if (int(last_time_seconds *2) != int(game->time*2)) //next half second
+		if (last_real_time / 500 != clock->real_time / 500) //next half second
 		{
 			game->fps = frames_this_second*2;
 			frames_this_second = 0;
 		}
 
 		//update game logic
-		game->update(elapsed_time); 
+		game->update(clock->elapsed);
 
 		//save old keyboard state
 		memcpy((void*)&Input::prev_keystate, Input::keystate, SDL_NUM_SCANCODES);
 
 		//check errors in opengl only when working in debug
 		#ifdef _DEBUG
-			checkGLErrors();
+			if (!headless)
+				checkGLErrors();
 		#endif
 	}
 
 	return;
 }
 
+//replays a recording as fast as possible, same steps as mainLoop but the input comes from the recording
+void replayLoop(InputRecording& recording)
+{
+	Input::keystate = recording.keystate;
+	long start_time = getPrecisionTime();
+	InputRecording::sFrame frame;
+
+	//the recording has game time, it is replayed as it is
+	Clock* clock = Clock::Get();
+	clock->scale = 1;
+	clock->paused = false;
+
+	while (!game->must_exit && recording.nextFrame(frame))
+	{
+		game->render();
+
+		recording.applyKeys(frame);
+		game->elapsed_time = clock->elapsed;
+		game->time = clock->time * 0.001f;
+		game->frame++;
+		game->update(clock->elapsed);
+
+		memcpy((void*)&Input::prev_keystate, Input::keystate, SDL_NUM_SCANCODES);
+	}
+
+	double seconds = (getPrecisionTime() - start_time) / (double)SDL_GetPerformanceFrequency();
+	std::cout << " * Replayed " << game->frame << " frames (" << clock->time * 0.001 << " s of game) in " << seconds << " s, "
+		<< (game->frame ? seconds * 1000000.0 / game->frame : 0) << " us per frame" << std::endl;
+}
+
+//tools that run without window (useful for profiling and testing in headless machines)
+//exit_code is not 0 if a tool that checks something found it wrong
+bool runTool(int argc, char **argv, int& exit_code)
+{
+	std::string tool = argv[1];
+
+	if (tool == "--render-audio" && argc >= 5) //--render-audio script.txt output.wav seconds [golden.wav]
+	{
+		SDL_AudioSpec spec;
+		memset(&spec, 0, sizeof(spec));
+		spec.freq = 48000;
+		spec.format = AUDIO_F32;
+		spec.channels = 1;
+
+		Synth synth;
+		if (!synth.loadScript(argv[2]))
+		{
+			exit_code = 1;
+			return true;
+		}
+		unsigned int num_samples = (unsigned int)(atof(argv[4]) * spec.freq);
+		std::vector<float> output(num_samples);
+		synth.render(output.data(), num_samples, spec);
+		if (Synth::saveWAV(argv[3], output.data(), num_samples, spec.freq))
+			std::cout << " + Audio rendered: " << argv[3] << std::endl;
+		else
+			exit_code = 1;
+
+		//golden file test: the same length and every sample close to the golden one
+		std::vector<float> golden;
+		if (argc >= 6 && !Synth::loadWAV(argv[5], golden))
+		{
+			std::cout << " * Golden render can not be read: " << argv[5] << std::endl;
+			exit_code = 1;
+		}
+		else if (argc >= 6)
+		{
+			float max_error = golden.size() == num_samples ? 0 : 1;
+			for (unsigned int i = 0; i < golden.size() && i < num_samples; ++i)
+				max_error = max(max_error, fabsf(golden[i] - output[i]));
+			if (max_error <= 0.0001f)
+				std::cout << " * Render matches " << argv[5] << " (max error " << max_error << ")" << std::endl;
+			else
+			{
+				std::cout << " * Render DOES NOT match " << argv[5] << " (max error " << max_error << ", " << golden.size() << " samples)" << std::endl;
+				exit_code = 1;
+			}
+		}
+		return true;
+	}
+
+	if (tool == "--pack") //--pack [output.pack] [files or folders...]
+	{
+		//the output is optional, the first argument is only the output if it is a .pack
+		int first = 2;
+		const char* output = "data.pack";
+		if (argc > 2 && strlen(argv[2]) > 5 && strcmp(argv[2] + strlen(argv[2]) - 5, ".pack") == 0)
+			output = argv[first++];
+		std::vector<std::string> files;
+		for (int i = first; i < argc; ++i)
+		{
+			std::vector<std::string> folder_files = listFiles(argv[i]);
+			if (folder_files.empty())
+				files.push_back(argv[i]);
+			else
+				files.insert(files.end(), folder_files.begin(), folder_files.end());
+		}
+		if (first >= argc)
+			files = listFiles("data");
+		AssetPack::build(output, files);
+		return true;
+	}
+
+	if (tool == "--bench-images") //--bench-images [atlas size]
+	{
+		Image::benchmarkTGA(argc > 2 ? atoi(argv[2]) : 2048);
+		return true;
+	}
+
+	if (tool == "--bench-synth")
+	{
+		Synth::benchmark();
+		return true;
+	}
+
+	if (tool == "--bench-sprites") //--bench-sprites [number of sprites]
+	{
+		SpriteBatch::benchmark(argc > 2 ? atoi(argv[2]) : 2000);
+		return true;
+	}
+
+	if (tool == "--simulate") //--simulate [number of worlds] [days] [first seed]
+	{
+		SimulationRunner::benchmark(argc > 2 ? atoi(argv[2]) : 1000, argc > 3 ? atoi(argv[3]) : 365, argc > 4 ? atoi(argv[4]) : 1);
+		return true;
+	}
+
+	if (tool == "--bench-planner") //--bench-planner [days] [seed] [ms per decision]
+	{
+		Planner::benchmark(argc > 2 ? atoi(argv[2]) : 30, argc > 3 ? atoi(argv[3]) : 1, argc > 4 ? atoi(argv[4]) : 100);
+		return true;
+	}
+
+	if (tool == "--bench-paths") //--bench-paths [map size] [number of paths] [seed]
+	{
+		if (PathFinder::benchmark(argc > 2 ? atoi(argv[2]) : 512, argc > 3 ? atoi(argv[3]) : 1000, argc > 4 ? atoi(argv[4]) : 1))
+			exit_code = 1;
+		return true;
+	}
+
+	if (tool == "--bench-pyramid") //--bench-pyramid [map size] [number of edits] [seed]
+	{
+		if (MapPyramid::benchmark(argc > 2 ? atoi(argv[2]) : 512, argc > 3 ? atoi(argv[3]) : 20000, argc > 4 ? atoi(argv[4]) : 1))
+			exit_code = 1;
+		return true;
+	}
+
+	if (tool == "--bench-regions") //--bench-regions [map size] [seed]
+	{
+		if (MapRegions::benchmark(argc > 2 ? atoi(argv[2]) : 512, argc > 3 ? atoi(argv[3]) : 1))
+			exit_code = 1;
+		return true;
+	}
+
+	if (tool == "--bench-coverage") //--bench-coverage [map size] [number of churches]
+	{
+		if (ChurchCoverage::benchmark(argc > 2 ? atoi(argv[2]) : 512, argc > 3 ? atoi(argv[3]) : 200))
+			exit_code = 1;
+		return true;
+	}
+
+	if (tool == "--bench-entities") //--bench-entities [count] [seed]
+	{
+		if (EntityStore::benchmark(argc > 2 ? atoi(argv[2]) : 10000, argc > 3 ? atoi(argv[3]) : 1))
+			exit_code = 1;
+		return true;
+	}
+
+	if (tool == "--bench-raster") //--bench-raster [framebuffer size] [number of sprites]
+	{
+		SpriteBatch::benchmarkBinned(argc > 2 ? atoi(argv[2]) : 512, argc > 3 ? atoi(argv[3]) : 20000);
+		return true;
+	}
+
+	return false;
+}
+
 int main(int argc, char **argv)
 {
+	int exit_code = 0;
+	if (argc > 1 && runTool(argc, argv, exit_code))
+		return exit_code;
+
+	//internal resolution: --resolution WIDTHxHEIGHT (128x128 by default)
+	//presentation: --presenter gl|software|none
+	//input recording: --record session.rec stores the input, --replay session.rec plays it back (headless and as fast as possible by default)
+	//game speed: --speed 4 runs the game time 4 times faster than the real time
+	int framebuffer_width = 128;
+	int framebuffer_height = 128;
+	int presenter_type = -1; //depends on the mode
+	const char* record_filename = NULL;
+	const char* replay_filename = NULL;
+	for (int i = 1; i < argc - 1; ++i)
+	{
+		std::string option = argv[i];
+		if (option == "--record")
+			record_filename = argv[i + 1];
+		if (option == "--replay")
+			replay_filename = argv[i + 1];
+		if (option == "--speed")
+			Clock::Get()->scale = clamp(atof(argv[i + 1]), 0.1, 64.0);
+		if (option == "--resolution" && sscanf(argv[i + 1], "%dx%d", &framebuffer_width, &framebuffer_height) != 2)
+		{
+			std::cerr << "wrong resolution, use WIDTHxHEIGHT, p.e. 256x256" << std::endl;
+			return 1;
+		}
+		if (option == "--presenter" && (presenter_type = Presenter::parseType(argv[i + 1])) == -1)
+		{
+			std::cerr << "wrong presenter, use gl, software or none" << std::endl;
+			return 1;
+		}
+	}
+	if (presenter_type == -1)
+		presenter_type = replay_filename ? Presenter::HEADLESS : Presenter::OPENGL;
+	framebuffer_width = clamp(framebuffer_width, 64, 2048);
+	framebuffer_height = clamp(framebuffer_height, 64, 2048);
+
 	std::cout << "Initiating game..." << std::endl;
 
-	//create the game window 
-	SDL_Window* window = createWindow("TJE Game2D", 512, 512 );
-	if (!window)
+	//the window starts with the biggest integer scale that keeps it around 512 pixels
+	int window_scale = max(1, 512 / max(framebuffer_width, framebuffer_height));
+	int window_width = framebuffer_width * window_scale;
+	int window_height = framebuffer_height * window_scale;
+
+	//create the game window, there is none when headless
+	SDL_Window* window = NULL;
+	if (presenter_type == Presenter::HEADLESS)
+		initHeadless();
+	else if (!(window = createWindow("TJE Game2D", window_width, window_height, false)))
 		return 0;
 
 	//launch the game (game is a global variable)
-	game = new Game(512, 512, window);
+	game = new Game(window_width, window_height, window, framebuffer_width, framebuffer_height, presenter_type);
+
+	if (record_filename || replay_filename)
+	{
+		//both start with all the images loaded, so the first frames are the same
+		ThreadPool::Get()->wait();
+		Image::updateAsyncLoads();
+	}
+
+	if (replay_filename)
+	{
+		InputRecording recording;
+		if (!recording.load(replay_filename))
+			return 1;
+		recording.start(recording.header.seed);
+		replayLoop(recording);
+		return recording.verify() ? 0 : 1;
+	}
+
+	if (record_filename)
+	{
+		InputRecording recording;
+		recording.start(SDL_GetTicks() ^ (uint32)time(NULL));
+		mainLoop(&recording);
+		recording.finish();
+		if (recording.save(record_filename))
+			std::cout << " * Recording saved: " << record_filename << " (" << recording.header.num_frames << " frames)" << std::endl;
+		return 0;
+	}
 
 	//main loop, application gets inside here till user closes it
 	mainLoop();
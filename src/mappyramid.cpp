@@ -0,0 +1,239 @@
+#include "mappyramid.h"
+#include "includes.h"
+
+MapPyramid::MapPyramid(World* world)
+{
+	this->world = world;
+	rebuild();
+	world->addListener(this);
+}
+
+MapPyramid::~MapPyramid()
+{
+	world->removeListener(this);
+}
+
+int MapPyramid::getCategory(const sCell& cell)
+{
+	//same rules the minimap always used to pick the color
+	if (cell.item)
+	{
+		if (cell.item < 3)
+			return CATEGORY_TREE;
+		if (cell.item == 5) //rock
+			return CATEGORY_ROCK;
+		if (cell.item == ITEM_FOUNTAIN || cell.item == ITEM_WELL)
+			return CATEGORY_WELL;
+		if (cell.item == 128) //church
+			return CATEGORY_CHURCH;
+		if (cell.item > 128)
+			return CATEGORY_HOUSE;
+	}
+	return cell.terrain % 4;
+}
+
+const Color& MapPyramid::getCategoryColor(int category)
+{
+	static const Color colors[NUM_CATEGORIES] = {
+		{ 94,125,159,255 }, //water
+		{ 197,191,154,255 }, //sand
+		{ 116,140,98,255 }, //grass
+		{ 125,125,125,255 }, //rock
+		{ 92,112,78,255 }, //tree (darker grass)
+		{ 50,255,255,255 }, //well
+		{ 255,255,100,255 }, //church
+		{ 200,100,50,255 } //house
+	};
+	return colors[category];
+}
+
+MapPyramid::sCellInfo MapPyramid::getCellInfo(const sCell& cell)
+{
+	sCellInfo info;
+	info.category = getCategory(cell);
+	info.land = cell.terrain != TILE_WATER;
+	info.blessed = info.land && cell.blessed;
+	info.discovered = cell.discovered;
+	return info;
+}
+
+void MapPyramid::updateDominant(sBlock& block)
+{
+	block.dominant = 0;
+	for (int i = 1; i < NUM_CATEGORIES; ++i)
+		if (block.counts[i] > block.counts[block.dominant])
+			block.dominant = i;
+}
+
+void MapPyramid::rebuild()
+{
+	Matrix<sCell>& gamemap = world->gamemap;
+	int width = gamemap.width;
+	int height = gamemap.height;
+
+	cells.resize(width * height);
+	for (int i = 0; i < width * height; ++i)
+		cells[i] = getCellInfo(gamemap.data[i]);
+
+	//levels till a single block covers the whole map
+	levels.clear();
+	for (int size = 2; (size / 2) < max(width, height); size *= 2)
+	{
+		sLevel level;
+		level.size = size;
+		level.width = (width + size - 1) / size;
+		level.height = (height + size - 1) / size;
+		level.blocks.resize(level.width * level.height);
+		memset(&level.blocks[0], 0, level.blocks.size() * sizeof(sBlock));
+		levels.push_back(level);
+	}
+	if (levels.empty())
+		return;
+
+	//first level from the cells, the rest adding the four blocks below
+	sLevel& first = levels[0];
+	for (int y = 0; y < height; ++y)
+		for (int x = 0; x < width; ++x)
+		{
+			const sCellInfo& info = cells[y * width + x];
+			sBlock& block = first.blocks[(y / 2) * first.width + (x / 2)];
+			block.counts[info.category]++;
+			block.land += info.land;
+			block.blessed += info.blessed;
+			block.discovered += info.discovered;
+		}
+	for (int i = 1; i < levels.size(); ++i)
+	{
+		sLevel& level = levels[i];
+		sLevel& prev = levels[i - 1];
+		for (int y = 0; y < prev.height; ++y)
+			for (int x = 0; x < prev.width; ++x)
+			{
+				const sBlock& child = prev.blocks[y * prev.width + x];
+				sBlock& block = level.blocks[(y / 2) * level.width + (x / 2)];
+				for (int j = 0; j < NUM_CATEGORIES; ++j)
+					block.counts[j] += child.counts[j];
+				block.land += child.land;
+				block.blessed += child.blessed;
+				block.discovered += child.discovered;
+			}
+	}
+	for (int i = 0; i < levels.size(); ++i)
+		for (int j = 0; j < levels[i].blocks.size(); ++j)
+			updateDominant(levels[i].blocks[j]);
+}
+
+void MapPyramid::addCell(int x, int y, const sCellInfo& info, int sign)
+{
+	for (int i = 0; i < levels.size(); ++i)
+	{
+		sLevel& level = levels[i];
+		sBlock& block = level.blocks[(y / level.size) * level.width + (x / level.size)];
+		block.counts[info.category] += sign;
+		block.land += info.land ? sign : 0;
+		block.blessed += info.blessed ? sign : 0;
+		block.discovered += info.discovered ? sign : 0;
+		updateDominant(block);
+	}
+}
+
+void MapPyramid::onCellsChanged(int x, int y, int w, int h)
+{
+	Matrix<sCell>& gamemap = world->gamemap;
+	if (cells.size() != gamemap.width * gamemap.height)
+	{
+		rebuild();
+		return;
+	}
+
+	//only the cells that really changed touch the blocks, one per level
+	for (int cy = y; cy < y + h; ++cy)
+		for (int cx = x; cx < x + w; ++cx)
+		{
+			sCellInfo& old_info = cells[cy * gamemap.width + cx];
+			sCellInfo info = getCellInfo(gamemap.get(cx, cy));
+			if (memcmp(&info, &old_info, sizeof(sCellInfo)) == 0)
+				continue;
+			addCell(cx, cy, old_info, -1);
+			addCell(cx, cy, info, 1);
+			old_info = info;
+		}
+}
+
+//a + (b - a) * f per channel
+static Color mixColors(const Color& a, const Color& b, float f)
+{
+	return Color((unsigned char)(a.r + (b.r - a.r) * f), (unsigned char)(a.g + (b.g - a.g) * f), (unsigned char)(a.b + (b.b - a.b) * f));
+}
+
+Color MapPyramid::getBlockColor(int level, int x, int y, bool fog, bool show_blessing, const Color& background) const
+{
+	const sBlock& block = getBlock(level, x, y);
+	Color c = getCategoryColor(block.dominant);
+
+	//blessing over land: from dark to yellow by the blessed fraction
+	if (show_blessing && block.dominant != CATEGORY_WATER && block.land)
+		c = mixColors(Color(50, 50, 50), Color(255, 255, 0), block.blessed / (float)block.land);
+
+	//fog: fades to the background by the undiscovered fraction
+	if (fog)
+	{
+		uint32 area = 0;
+		for (int i = 0; i < NUM_CATEGORIES; ++i)
+			area += block.counts[i];
+		if (!block.discovered)
+			return background;
+		c = mixColors(background, c, block.discovered / (float)area);
+	}
+	return c;
+}
+
+int MapPyramid::benchmark(int size, int num_edits, uint32 seed)
+{
+	std::cout << "Map pyramid benchmark, map of " << size << "x" << size << ", " << num_edits << " edits" << std::endl;
+
+	World world(seed);
+	world.newMap(size, size);
+	MapPyramid pyramid(&world);
+
+	Uint64 start = SDL_GetPerformanceCounter();
+	pyramid.rebuild();
+	double seconds = (SDL_GetPerformanceCounter() - start) / (double)SDL_GetPerformanceFrequency();
+	std::cout << " * Full rebuild: " << seconds * 1000.0 << " ms, " << pyramid.getNumLevels() << " levels" << std::endl;
+
+	//edits of everything the blocks count: terrain, items, blessing and discovery
+	start = SDL_GetPerformanceCounter();
+	for (int i = 0; i < num_edits; ++i)
+	{
+		int x = world.randomInt() % size, y = world.randomInt() % size;
+		sCell& cell = world.gamemap.get(x, y);
+		switch (world.randomInt() % 4)
+		{
+			case 0: cell.terrain = world.randomInt() % 4; break;
+			case 1: { const uint8 items[] = { ITEM_NOTHING, ITEM_TREE, ITEM_WELL, 128, 130 }; cell.item = items[world.randomInt() % 5]; } break;
+			case 2: cell.blessed = !cell.blessed; break;
+			case 3: cell.discovered = !cell.discovered; break;
+		}
+		world.notifyCellsChanged(x, y);
+	}
+	seconds = (SDL_GetPerformanceCounter() - start) / (double)SDL_GetPerformanceFrequency();
+	std::cout << " * Incremental: " << seconds * 1000000000.0 / num_edits << " ns per edit" << std::endl;
+
+	//a pyramid built from scratch must have the same blocks
+	MapPyramid rebuilt(&world);
+	int mismatches = 0, blocks = 0;
+	for (int i = 0; i < pyramid.levels.size(); ++i)
+		for (int j = 0; j < pyramid.levels[i].blocks.size(); ++j)
+		{
+			const sBlock& a = pyramid.levels[i].blocks[j];
+			const sBlock& b = rebuilt.levels[i].blocks[j];
+			bool same = a.land == b.land && a.blessed == b.blessed && a.discovered == b.discovered && a.dominant == b.dominant;
+			for (int k = 0; k < NUM_CATEGORIES; ++k)
+				same = same && a.counts[k] == b.counts[k];
+			if (!same)
+				mismatches++;
+			blocks++;
+		}
+	std::cout << " * Checked " << blocks << " blocks against a full rebuild: " << mismatches << " different" << std::endl;
+	return mismatches;
+}
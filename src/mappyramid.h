@@ -0,0 +1,82 @@
+/*	MapPyramid: summaries of the map in blocks of 2x2, 4x4, 8x8... cells (like the mipmaps of a texture).
+	Every block knows how many cells of every kind it has, how many are blessed and how many discovered,
+	so a zoomed out map is drawn reading one block per pixel instead of scanning all the cells.
+	It is a map listener: when cells change only the blocks containing them are updated.
+*/
+
+#ifndef MAPPYRAMID_H
+#define MAPPYRAMID_H
+
+#include <vector>
+#include "mygame.h"
+
+class MapPyramid : public MapListener
+{
+public:
+	//what a cell looks like in the map
+	enum {
+		CATEGORY_WATER = 0,
+		CATEGORY_SAND,
+		CATEGORY_GRASS,
+		CATEGORY_ROCK,
+		CATEGORY_TREE,
+		CATEGORY_WELL,
+		CATEGORY_CHURCH,
+		CATEGORY_HOUSE,
+		NUM_CATEGORIES
+	};
+
+	struct sBlock {
+		uint32 counts[NUM_CATEGORIES]; //cells of every category
+		uint32 land; //cells that are not water
+		uint32 blessed; //blessed land cells
+		uint32 discovered;
+		uint8 dominant; //category with more cells
+	};
+
+	struct sLevel {
+		int width; //in blocks
+		int height;
+		int size; //cells per side of every block
+		std::vector<sBlock> blocks;
+	};
+
+	//state of every cell the last time it was summarized, to know what to subtract when it changes
+	struct sCellInfo {
+		uint8 category;
+		bool land;
+		bool blessed;
+		bool discovered;
+	};
+
+	World* world;
+	std::vector<sCellInfo> cells;
+	std::vector<sLevel> levels; //levels[i] has blocks of 2^(i+1) cells per side
+
+	MapPyramid(World* world);
+	~MapPyramid();
+
+	void rebuild();
+	virtual void onCellsChanged(int x, int y, int w, int h);
+	virtual void onMapReset() { rebuild(); }
+
+	int getNumLevels() const { return levels.size() + 1; } //level 0 are the cells
+	const sBlock& getBlock(int level, int x, int y) const { const sLevel& l = levels[level - 1]; return l.blocks[y * l.width + x]; }
+
+	//color of a block (level >= 1), as the minimap would show it
+	Color getBlockColor(int level, int x, int y, bool fog, bool show_blessing, const Color& background) const;
+
+	static int getCategory(const sCell& cell);
+	static const Color& getCategoryColor(int category);
+
+	//random cell edits in a generated map of that size, timing the incremental updates and checking
+	//every block against a full rebuild, returns the blocks that are different
+	static int benchmark(int size = 512, int num_edits = 20000, uint32 seed = 1);
+
+private:
+	static sCellInfo getCellInfo(const sCell& cell);
+	void addCell(int x, int y, const sCellInfo& info, int sign); //adds or subtracts a cell from all the levels
+	static void updateDominant(sBlock& block);
+};
+
+#endif
@@ -6,6 +6,15 @@
 #include <algorithm>    // std::max
 #include "includes.h"
 #include "framework.h"
+#include "font.h"
+#include "mappyramid.h"
+#include "snapshot.h"
+#include "clock.h"
+#include "simulation.h"
+#include "planner.h"
+#include "pathfinding.h"
+#include "entities.h"
+#include "regions.h"
 #include "input.h"
 
 Vector2 campos;
@@ -16,6 +25,34 @@ World* World::instance = NULL;
 Image* font = NULL;
 Image* minifont = NULL;
 
+//assets used every frame, the hash of the path is computed at compile time
+constexpr AssetID TILESET("data/tileset.tga");
+constexpr AssetID FONT_WHITE("data/bitmap-font-white.tga");
+constexpr AssetID FONT_YELLOW("data/bitmap-font-yellow.tga");
+constexpr AssetID MINIFONT_WHITE("data/mini-font-white-4x6.tga");
+
+//the tileset is drawn from its indexed copy once it is loaded, then the RGBA one is not needed and its pixels are freed
+static IndexedImage* getIndexedTileset()
+{
+	static bool rgba_released = false;
+	IndexedImage* tileset8 = IndexedImage::Get(TILESET);
+	if (tileset8 && !rgba_released)
+	{
+		Image::release(TILESET);
+		rgba_released = true;
+	}
+	return tileset8;
+}
+
+static void drawTileset(Image& framebuffer, int x, int y, const Area& area)
+{
+	IndexedImage* tileset8 = getIndexedTileset();
+	if (tileset8)
+		framebuffer.drawImage(*tileset8, x, y, area);
+	else
+		framebuffer.drawImage(*Image::Get(TILESET), x, y, area);
+}
+
 const sUpgrade upgrade_table[] = {
 	{ 0, 0, 0, 0, 0, 0, "nothing" },
 	{ ITEM_FOUNTAIN, ITEM_WELL, 5, -1, -1, 0, "build well" },
@@ -33,15 +70,13 @@ const sUpgrade upgrade_table[] = {
 	{ 132, 136, 10, -5, -5, -5, "upgrade church" },
 	{ 255, 255, 0, 0, 0, 0, "LAST" }
 };
-const int upgrade_table_size = 16;
+const int upgrade_table_size = sizeof(upgrade_table) / sizeof(sUpgrade);
 
-bool blink( float freq ) { return int(getTime()*0.001*freq) % 2 == 0; }
+bool blink( float freq ) { return int(Clock::Get()->time*0.001*freq) % 2 == 0; }
 
-World::World()
+World::World(uint32 seed)
 {
-	font = Image::Get("data/bitmap-font-white.tga");
-	minifont = Image::Get("data/bitmap-font-yellow.tga");
-
+	setSeed(seed);
 	alive_players = 0;
 	map_fog = true;
 	unlimited_movements = false;
@@ -49,10 +84,27 @@ World::World()
 	restart();
 }
 
+World& World::operator = (const World& other)
+{
+	if (this == &other)
+		return *this;
+	memcpy(players, other.players, sizeof(players));
+	gamemap = other.gamemap;
+	day = other.day;
+	selected_player = other.selected_player;
+	alive_players = other.alive_players;
+	souls_saved = other.souls_saved;
+	map_fog = other.map_fog;
+	unlimited_movements = other.unlimited_movements;
+	random_state = other.random_state;
+	coverage = other.coverage;
+	notifyMapReset();
+	return *this;
+}
+
 void World::restart()
 {
-	gamemap.resize(128, 128);
-	generateMap();
+	newMap(128, 128);
 	selected_player = 0;
 	day = 0;
 	souls_saved = 0;
@@ -74,29 +126,30 @@ void World::restart()
 
 		player.alive = true;
 	}
-	campos = players[0].pos;
+	if (this == &world) //only the world that is shown moves the camera
+		campos = players[0].pos;
 }
 
-sUpgrade World::getUpgradeInfo(int item)
+int World::findUpgrade(int item)
 {
 	if(!item)
-		return upgrade_table[0];
+		return 0;
 	for (int i = 0; i < upgrade_table_size; ++i)
-	{
-		const sUpgrade& row = upgrade_table[i];
-		if (row.item != item)
-			continue;
-		return row;
-	}
-	return upgrade_table[0];
+		if (upgrade_table[i].item == item)
+			return i;
+	return 0;
+}
+
+sUpgrade World::getUpgradeInfo(int item)
+{
+	return upgrade_table[findUpgrade(item)];
 }
 
-void World::upgradeCell(sCharacter* author, int x, int y)
+bool World::upgradeCell(sCharacter* author, int x, int y, Vector4* missing)
 {
-	if (x < 0 || x >= world.gamemap.width || y < 0 || y >= world.gamemap.height)
-		return;
-	sCell& cell = world.gamemap.get(x, y);
-	PlayStage* play = (PlayStage*)Stage::stages["play"];
+	if (x < 0 || x >= gamemap.width || y < 0 || y >= gamemap.height)
+		return false;
+	sCell& cell = gamemap.get(x, y);
 
 	for (int i = 0; i < upgrade_table_size; ++i)
 	{
@@ -104,21 +157,21 @@ void World::upgradeCell(sCharacter* author, int x, int y)
 		if (row.item != cell.item)
 			continue;
 		//check if I fill all the requirements
-		play->missing_resources.set(0, 0, 0, 0);
+		Vector4 needed;
 		if (author->movements < row.movements)
-			play->missing_resources.x = row.movements;
+			needed.x = row.movements;
 		if (author->wood + row.wood < 0)
-			play->missing_resources.y = row.wood;
+			needed.y = row.wood;
 		if (author->stone + row.stone < 0)
-			play->missing_resources.z = row.stone;
+			needed.z = row.stone;
 		if (author->goods + row.goods < 0)
-			play->missing_resources.w = row.goods;
-		if ( !play->missing_resources.isZero() )
-		{
-			play->missing_time = getTime() + 2000; //2 seconds
-			return;
-		}
+			needed.w = row.goods;
+		if (missing)
+			*missing = needed;
+		if ( !needed.isZero() )
+			return false;
 		cell.item = row.next_item;
+		notifyCellsChanged(x, y);
 		if(!unlimited_movements)
 			author->movements -= row.movements;
 		author->stone += row.stone;
@@ -126,28 +179,138 @@ void World::upgradeCell(sCharacter* author, int x, int y)
 		author->goods += row.goods;
 
 		//update blessing area
-		int bless_radius = 0;
-		if (cell.item == 132) //church
-			blessArea(x, y, 5);
-		else if (cell.item == 136) //church
-			blessArea(x, y, 10);
-		break;
+		if (getChurchRadius(cell.item))
+			setChurch(x, y, getChurchRadius(cell.item));
+		return true;
 	}
+	return false;
 }
 
-void World::blessArea(int x, int y, int radius)
+bool World::applyAction(int player_index, int action, int param, Vector4* missing)
 {
-	Vector2 center(x, y);
-	for (int cx = x - radius; cx <= x + radius; ++cx)
-		for (int cy = y - radius; cy <= y + radius; ++cy)
+	sCharacter& player = players[player_index];
+	if (!player.alive || (player.movements == 0 && !unlimited_movements))
+		return false;
+
+	if (action == WALK)
+	{
+		player.prev_pos = player.pos;
+		switch (param)
 		{
-			if (cx < 0 || cx >= gamemap.width || cy < 0 || cy >= gamemap.height)
-				continue;
-			if (Vector2(cx, cy).distance(center) > radius)
-				continue;
-			sCell& bless_cell = gamemap.get(cx, cy);
-			bless_cell.blessed = true;
+			case NORTH: player.pos.y -= 16; break;
+			case SOUTH: player.pos.y += 16; break;
+			case EAST: player.pos.x += 16; break;
+			case WEST: player.pos.x -= 16; break;
 		}
+
+		//adjust
+		player.pos.x = clamp(player.pos.x, 0, (gamemap.width - 1) * 16);
+		player.pos.y = clamp(player.pos.y, 0, (gamemap.height - 1) * 16);
+		int x = player.pos.x / 16;
+		int y = player.pos.y / 16;
+		if (gamemap.get(x, y).terrain == TILE_ROCK)
+		{
+			player.pos = player.prev_pos;
+			return false;
+		}
+		if(!unlimited_movements)
+			player.movements--;
+
+		//passive actions
+		sCell& finalcell = gamemap.get(x, y);
+		if (finalcell.item == ITEM_FOUNTAIN || finalcell.item == ITEM_WELL)
+			player.water = 100;
+		if (finalcell.goods)
+		{
+			player.goods = min(10, player.goods + finalcell.goods);
+			finalcell.goods = 0;
+			notifyCellsChanged(x, y);
+		}
+		computeFamilyLove();
+		return true;
+	}
+
+	if (action == INTERACT)
+		return upgradeCell(&player, player.pos.x / 16, player.pos.y / 16, missing);
+	return false;
+}
+
+int World::simulate(int days, WorldPolicy* policy)
+{
+	int played = 0;
+	while (played < days && !isGameOver())
+	{
+		if (policy)
+			for (int i = 0; i < 3; ++i)
+				if (players[i].alive)
+					policy->playTurn(*this, i);
+		passTurn();
+		played++;
+	}
+	return played;
+}
+
+int World::getChurchRadius(int item)
+{
+	if (item == 132) //church
+		return 5;
+	if (item == 136) //upgraded church
+		return 10;
+	return 0;
+}
+
+void World::setChurch(int x, int y, int radius)
+{
+	int old_radius = 0;
+	for (int i = 0; i < coverage.churches.size(); ++i)
+		if (coverage.churches[i].x == x && coverage.churches[i].y == y)
+			old_radius = coverage.churches[i].radius;
+	coverage.setChurch(x, y, radius);
+
+	//only the cells the church covered or covers can change
+	int r = max(radius, old_radius);
+	int x0 = max(0, x - r), y0 = max(0, y - r);
+	int x1 = min((int)gamemap.width - 1, x + r), y1 = min((int)gamemap.height - 1, y + r);
+	for (int cy = y0; cy <= y1; ++cy)
+		for (int cx = x0; cx <= x1; ++cx)
+			gamemap.get(cx, cy).blessed = coverage.isCovered(cx, cy);
+	notifyCellsChanged(x - r, y - r, r * 2 + 1, r * 2 + 1);
+}
+
+void World::findChurches()
+{
+	coverage.resize(gamemap.width, gamemap.height);
+	for (int y = 0; y < gamemap.height; ++y)
+		for (int x = 0; x < gamemap.width; ++x)
+		{
+			int radius = getChurchRadius(gamemap.get(x, y).item);
+			if (radius)
+				coverage.setChurch(x, y, radius);
+		}
+}
+
+void World::removeListener(MapListener* listener)
+{
+	listeners.erase(std::remove(listeners.begin(), listeners.end(), listener), listeners.end());
+}
+
+void World::notifyCellsChanged(int x, int y, int w, int h)
+{
+	//clipped to the map
+	int x1 = min(x + w, (int)gamemap.width);
+	int y1 = min(y + h, (int)gamemap.height);
+	x = max(x, 0);
+	y = max(y, 0);
+	if (x >= x1 || y >= y1)
+		return;
+	for (int i = 0; i < listeners.size(); ++i)
+		listeners[i]->onCellsChanged(x, y, x1 - x, y1 - y);
+}
+
+void World::notifyMapReset()
+{
+	for (int i = 0; i < listeners.size(); ++i)
+		listeners[i]->onMapReset();
 }
 
 void World::passTurn()
@@ -179,14 +342,22 @@ void World::passTurn()
 			alive_players++;
 	}
 
-	//compute map stuff
+	//compute map stuff, by rows so it walks the cells in memory order (this is most of the cost of a turn)
 	souls_saved = 0;
-	for(int x = 1; x < gamemap.width - 1; ++x)
-		for (int y = 1; y < gamemap.height - 1; ++y)
+	int width = gamemap.width;
+	for (int y = 1; y < (int)gamemap.height - 1; ++y)
+	{
+		sCell* row = &gamemap.get(0, y);
+		for (int x = 1; x < width - 1; ++x)
 		{
-			sCell& cell = gamemap.get(x, y);
-			if (cell.item == ITEM_WAREHOUSE && ( gamemap.get(x - 1, y).item == ITEM_HARBOUR || gamemap.get(x + 1, y).item == ITEM_HARBOUR) && cell.goods < 10 && random() > 0.8 )
+			sCell& cell = row[x];
+			if (!cell.item && !cell.blessed)
+				continue;
+			if (cell.item == ITEM_WAREHOUSE && (row[x - 1].item == ITEM_HARBOUR || row[x + 1].item == ITEM_HARBOUR) && cell.goods < 10 && random() > 0.8)
+			{
 				cell.goods += 1;
+				notifyCellsChanged(x, y);
+			}
 			if (cell.blessed)
 			{
 				if (cell.people)
@@ -196,28 +367,35 @@ void World::passTurn()
 				if (cell.item >= 133 && cell.item <= 135)
 					souls_saved += 10;
 			}
-			if ( (cell.item == 1 || cell.item == 2) && random() > 0.9) //tree reproducing
+			if ((cell.item == 1 || cell.item == 2) && random() > 0.9) //tree reproducing
 			{
-				const Vector2 offsets[4] = { {-1.0f,0.0f }, {1.0f,0.0f },{ 0.0f, 1.0f }, {0.0f,-1.0f} };
+				const int offsets[4][2] = { { -1, 0 }, { 1, 0 }, { 0, 1 }, { 0, -1 } };
 				for (int i = 0; i < 4; ++i)
 				{
-					sCell& nextcell = gamemap.get(x + offsets[i].x, y + offsets[i].y);
+					sCell& nextcell = row[x + offsets[i][0] + offsets[i][1] * width];
 					if (random() > 0.9 && !nextcell.item && nextcell.terrain == TILE_GRASS)
-						nextcell.item = rand() % 2 + 1;
+					{
+						nextcell.item = randomInt() % 2 + 1;
+						notifyCellsChanged(x + offsets[i][0], y + offsets[i][1]);
+					}
 				}
 			}
 		}
+	}
+}
 
-	if (alive_players == 0 || day >= 365 )
-		Stage::changeStage("ending");
+void World::newMap(int width, int height)
+{
+	gamemap.resize(width, height);
+	generateMap();
+	findChurches();
+	notifyMapReset();
 }
 
 void World::generateMap()
 {
 	int sea_margin = 10;
 	memset( gamemap.data, 0, sizeof(sCell) * gamemap.width *gamemap.height); //set all to 0
-	float seed = 0;
-	seed = getTime();
 	int num_islands = 16;
 	int max_size = gamemap.width * 0.3;
 	Vector3 islands[16];
@@ -270,7 +448,7 @@ void World::generateMap()
 				if (random() > 0.9)
 					cell.item = 5;
 				else if (r > 0.5 || random() > 0.9)
-					cell.item = uint8(rand() % 2) + 1;
+					cell.item = uint8(randomInt() % 2) + 1;
 			}
 		}
 
@@ -296,8 +474,8 @@ void World::generateMap()
 	int num_villages = 10;
 	while (num_villages)
 	{
-		int x = rand() % gamemap.width;
-		int y = rand() % gamemap.height;
+		int x = randomInt() % gamemap.width;
+		int y = randomInt() % gamemap.height;
 		sCell& cell = gamemap.get(x, y);
 		if (cell.terrain != TILE_GRASS )
 			continue;
@@ -313,25 +491,25 @@ void World::generateMap()
 		//build HOUSES
 		for (int i = 0; i < 6; ++i)
 		{
-			sCell& housecell = gamemap.getMirrored(x + rand() % 7 - 3, y + rand() % 7 - 3);
+			sCell& housecell = gamemap.getMirrored(x + randomInt() % 7 - 3, y + randomInt() % 7 - 3);
 			housecell.terrain = TILE_GRASS;
 			if (housecell.item == TILE_HOUSE)
 				continue;
-			housecell.item = TILE_HOUSE + 1 + rand()%3;
+			housecell.item = TILE_HOUSE + 1 + randomInt()%3;
 		}
 
 		//place FOUNTAIN
-		sCell& watercell = gamemap.getMirrored(x + rand() % 11 - 5, y + rand() % 11 - 5);
+		sCell& watercell = gamemap.getMirrored(x + randomInt() % 11 - 5, y + randomInt() % 11 - 5);
 		watercell.item = 3;
 
 		//spawn PEOPLE
 		for (int i = 0; i < 6; ++i)
 		{
-			sCell& peoplecell = gamemap.getMirrored(x + rand() % 7 - 3, y + rand() % 7 - 3);
+			sCell& peoplecell = gamemap.getMirrored(x + randomInt() % 7 - 3, y + randomInt() % 7 - 3);
 			peoplecell.terrain = TILE_GRASS;
 			if (peoplecell.item != 0)
 				continue;
-			peoplecell.people = rand() % 3;
+			peoplecell.people = randomInt() % 3;
 		}
 
 		num_villages--;
@@ -370,22 +548,33 @@ void World::computeFamilyLove()
 
 Stage* Stage::current = NULL;
 std::map<std::string,Stage*> Stage::stages;
+HashTable<Stage*> Stage::stages_by_id;
 
 Stage::Stage(const char* name)
 {
+	//fonts shared by all the stages (not in the World constructor, it runs before the asset managers exist)
+	if (!font)
+	{
+		font = Image::Get(FONT_WHITE);
+		minifont = Image::Get(FONT_YELLOW);
+	}
+
 	this->name = name;
 	stages[name] = this;
+	uint32 id = hashString(name);
+	assert(!stages_by_id.find(id) && "Two stages with the same name hash");
+	stages_by_id.set(id, this);
 }
 
-void Stage::changeStage(const char* name)
+void Stage::changeStage(uint32 id)
 {
-	auto it = stages.find(name);
-	if (it == stages.end())
+	Stage* stage = Get(id);
+	if (!stage)
 		return;
-	if (current == it->second)
+	if (current == stage)
 		return;
-	current = it->second;
-	current->enter_time = getTime();
+	current = stage;
+	current->enter_time = Clock::Get()->time;
 	current->onEnter();
 }
 
@@ -394,6 +583,12 @@ PlayStage::PlayStage() : Stage("play")
 	mode = WALK_MODE;
 	selection = 0;
 	missing_time = 0;
+	history = new WorldHistory(&world);
+	planner = new Planner();
+	planner->budget_ms = 0; //a fixed number of candidates instead, so recordings replay the same
+	planner->max_candidates = 32;
+	pathfinder = new PathFinder(&world);
+	entities = new EntityStore(&world);
 }
 
 void PlayStage::render(Image& framebuffer)
@@ -408,7 +603,17 @@ void PlayStage::render(Image& framebuffer)
 void PlayStage::renderMap(Image& framebuffer)
 {
 	Matrix<sCell>& gamemap = world.gamemap;
-	Image* tileset = Image::Get("data/tileset.tga");
+	IndexedImage* tileset8 = getIndexedTileset(); //same tileset with one byte per pixel, NULL till it is loaded
+	Image* tileset = tileset8 ? NULL : Image::Get(TILESET);
+
+	//tiles are submitted to the batch with their layer, reading the indexed tileset when available
+	batch.begin(framebuffer.width, framebuffer.height);
+	auto drawTile = [&](int x, int y, const Area& area, int layer) {
+		if (tileset8)
+			batch.draw(*tileset8, x, y, area, layer);
+		else
+			batch.draw(*tileset, x, y, area, layer);
+	};
 
 	int startx = max(1, (campos.x / 16.0));
 	int starty = max(1, (campos.y / 16.0));
@@ -428,22 +633,26 @@ void PlayStage::renderMap(Image& framebuffer)
 			uint8 tile_left = cell_left.terrain;
 			uint8 tile_up = cell_top.terrain;
 			uint8 col = tile_left << 2 | tile_up;
-			framebuffer.drawImage(*tileset, x * 16 - campos.x, y * 16 - campos.y, Area(16 * col, 16 * tile, 16, 16));
-			cell.discovered = true;
+			drawTile(x * 16 - campos.x, y * 16 - campos.y, Area(16 * col, 16 * tile, 16, 16), LAYER_FLOOR);
+			if (!cell.discovered)
+			{
+				cell.discovered = true;
+				world.notifyCellsChanged(x, y);
+			}
 
 			//road
 			if (cell.road)
 			{
 				if (cell_left.road)
-					framebuffer.drawImage(*tileset, x * 16 - campos.x, y * 16 - campos.y, Area(16 * 4, 16 * 11, 16, 16));
+					drawTile(x * 16 - campos.x, y * 16 - campos.y, Area(16 * 4, 16 * 11, 16, 16), LAYER_ROAD);
 				if (cell_right.road)
-					framebuffer.drawImage(*tileset, x * 16 - campos.x, y * 16 - campos.y, Area(16 * 2, 16 * 11, 16, 16));
+					drawTile(x * 16 - campos.x, y * 16 - campos.y, Area(16 * 2, 16 * 11, 16, 16), LAYER_ROAD);
 				if (cell_top.road)
-					framebuffer.drawImage(*tileset, x * 16 - campos.x, y * 16 - campos.y, Area(16 * 3, 16 * 11, 16, 16));
+					drawTile(x * 16 - campos.x, y * 16 - campos.y, Area(16 * 3, 16 * 11, 16, 16), LAYER_ROAD);
 				if (cell_bottom.road)
-					framebuffer.drawImage(*tileset, x * 16 - campos.x, y * 16 - campos.y, Area(16 * 1, 16 * 11, 16, 16));
+					drawTile(x * 16 - campos.x, y * 16 - campos.y, Area(16 * 1, 16 * 11, 16, 16), LAYER_ROAD);
 				if (!cell_bottom.road && !cell_top.road && !cell_left.road && !cell_right.road)
-					framebuffer.drawImage(*tileset, x * 16 - campos.x, y * 16 - campos.y, Area(0, 16 * 11, 16, 16));
+					drawTile(x * 16 - campos.x, y * 16 - campos.y, Area(0, 16 * 11, 16, 16), LAYER_ROAD);
 			}
 
 			//item
@@ -451,41 +660,32 @@ void PlayStage::renderMap(Image& framebuffer)
 			{
 				if (cell.item >= 128) //houses
 				{
-					framebuffer.drawImage(*tileset, x * 16 - campos.x, y * 16 - campos.y, Area(16 * (cell.item - 128), 16 * 10, 16, 16));
+					drawTile(x * 16 - campos.x, y * 16 - campos.y, Area(16 * (cell.item - 128), 16 * 10, 16, 16), LAYER_ITEM);
 					if( cell.item == ITEM_WAREHOUSE && cell.goods && blink(2) )
-						framebuffer.drawImage(*tileset, x * 16 - campos.x, y * 16 - campos.y - 16, Area( 6 * 16, 12 * 16, 16, 16) );
+						drawTile(x * 16 - campos.x, y * 16 - campos.y - 16, Area( 6 * 16, 12 * 16, 16, 16), LAYER_MARKER );
 				}
 				else
-					framebuffer.drawImage(*tileset, x * 16 - campos.x, y * 16 - campos.y, Area(16 * cell.item, 16 * 4, 16, 16));
+					drawTile(x * 16 - campos.x, y * 16 - campos.y, Area(16 * cell.item, 16 * 4, 16, 16), LAYER_ITEM);
 			}
-
-			//people
-			if (cell.people != 0)
-				framebuffer.drawImage(*tileset, x * 16 - campos.x, y * 16 - campos.y, Area(16 * (4 + cell.people), 16 * 5, 16, 16));
 		}
 	}
 
-	//render players
-	for (int i2 = world.selected_player + 1; i2 < world.selected_player + 4; ++i2)
-	{
-		int i = i2 % 3;//hack to force player is the last one
-		sCharacter& player = world.players[i];
-		player.draw_pos = lerp(player.draw_pos, player.pos, 0.5);
+	//players, villagers and boats, the selected player over the others
+	entities->render(batch, tileset, tileset8, campos);
+	sCharacter& player = world.players[world.selected_player];
+	if (blink(2) && player.alive)
+		drawTile(player.draw_pos.x - campos.x, player.draw_pos.y - campos.y - 16, Area(1 * 16, 7 * 16, 16, 16), LAYER_SELECTED);
 
-		sCell& player_cell = gamemap.get(player.pos.x / 16, player.pos.y / 16);
-		if (player_cell.terrain == TILE_WATER)
-			framebuffer.drawImage(*tileset, player.draw_pos.x - campos.x, player.draw_pos.y - campos.y, Area(12 * 16, 5 * 16 + (player.alive ? 0 : 16), 16, 16));
-		else
-			framebuffer.drawImage(*tileset, player.draw_pos.x - campos.x, player.draw_pos.y - campos.y, Area(i*16, 16 * 5 + (player.alive ? 0 : 16), 16, 16));
-		if ( i == world.selected_player && blink(2) && player.alive)
-			framebuffer.drawImage(*tileset, player.draw_pos.x - campos.x, player.draw_pos.y - campos.y - 16, Area(1 * 16, 7 * 16, 16, 16));
-	}
+	//only big framebuffers are worth splitting across threads
+	if (framebuffer.width * framebuffer.height >= 256 * 256)
+		batch.execute(framebuffer, ThreadPool::Get());
+	else
+		batch.execute(framebuffer);
 }
 
 void PlayStage::renderHUD(Image& framebuffer)
 {
-	Image* tileset = Image::Get("data/tileset.tga");
-	Image* minifont = Image::Get("data/mini-font-white-4x6.tga"); //load bitmap-font image
+	Image* minifont = Image::Get(MINIFONT_WHITE); //load bitmap-font image
 
 	int height = 12;
 	if (mode == MENU_MODE)
@@ -497,12 +697,12 @@ void PlayStage::renderHUD(Image& framebuffer)
 	framebuffer.drawLine(0, y, framebuffer.width, y, Color(80, 80, 80));
 
 	if(player.alive)
-		framebuffer.drawImage(*tileset, 0, y - 32, Area( player.character * 16, 128, 16, 32) ); //face
+		drawTileset(framebuffer, 0, y - 32, Area( player.character * 16, 128, 16, 32) ); //face
 	else
-		framebuffer.drawImage(*tileset, 0, y - 32, Area(3 * 16, 128, 16, 32)); //face
+		drawTileset(framebuffer, 0, y - 32, Area(3 * 16, 128, 16, 32)); //face
 
 	sCell& cell = world.gamemap.get(player.pos.x / 16, player.pos.y / 16);
-	long now = getTime();
+	long now = Clock::Get()->time;
 	sUpgrade upgrade = world.getUpgradeInfo( cell.item );
 
 	//action
@@ -526,35 +726,38 @@ void PlayStage::renderHUD(Image& framebuffer)
 	float f = 1 - (player.love / 100.0);
 	if (player.love || blink(5))
 	{
-		framebuffer.drawImage(*tileset, 0, y - 2, Area(1 * 16, 12 * 16, 16, 16));
-		framebuffer.drawImage(*tileset, 0, y - 2, Area(1 * 16, 13 * 16, 16, 16 * f));
+		drawTileset(framebuffer, 0, y - 2, Area(1 * 16, 12 * 16, 16, 16));
+		drawTileset(framebuffer, 0, y - 2, Area(1 * 16, 13 * 16, 16, 16 * f));
 	}
 	f = 1 - (player.water / 100.0);
 	if (player.water || blink(5))
 	{
-		framebuffer.drawImage(*tileset, 10, y - 2, Area(0 * 16, 12 * 16, 16, 16));
-		framebuffer.drawImage(*tileset, 10, y - 2, Area(0 * 16, 13 * 16, 16, 16 * f));
+		drawTileset(framebuffer, 10, y - 2, Area(0 * 16, 12 * 16, 16, 16));
+		drawTileset(framebuffer, 10, y - 2, Area(0 * 16, 13 * 16, 16, 16 * f));
 	}
 
 	//resources
 	if ((missing_time - now) < 0 || !missing_resources.y || blink(5))
-		framebuffer.drawImage(*tileset, 28, y - 1, Area(3 * 16, 12 * 16, 16, 16));
+		drawTileset(framebuffer, 28, y - 1, Area(3 * 16, 12 * 16, 16, 16));
 	if ((missing_time - now) < 0 || !missing_resources.z || blink(5))
-		framebuffer.drawImage(*tileset, 60, y - 2, Area(4 * 16, 12 * 16, 16, 16));
+		drawTileset(framebuffer, 60, y - 2, Area(4 * 16, 12 * 16, 16, 16));
 	if ((missing_time - now) < 0 || !missing_resources.w || blink(5))
-		framebuffer.drawImage(*tileset, 92, y - 2, Area(6 * 16, 12 * 16, 16, 16));
-	std::string wood_extra = "";
+		drawTileset(framebuffer, 92, y - 2, Area(6 * 16, 12 * 16, 16, 16));
+	TextBuffer<16> str;
+	str.add(player.wood);
 	if (upgrade.item && upgrade.wood)
-		wood_extra = std::string(upgrade.wood > 0 ? "+" : "") + std::to_string(upgrade.wood);
-	framebuffer.drawText(std::to_string(player.wood) + wood_extra, 41, y + 4, *minifont, 4, 6);
-	std::string stone_extra = "";
+		str.add(upgrade.wood, true);
+	framebuffer.drawText(str.c_str(), 41, y + 4, *minifont, 4, 6);
+	str.clear();
+	str.add(player.stone);
 	if (upgrade.item && upgrade.stone)
-		stone_extra = std::string(upgrade.stone > 0 ? "+" : "") + std::to_string(upgrade.stone);
-	framebuffer.drawText(std::to_string(player.stone) + stone_extra, 76, y + 4, *minifont, 4, 6);
-	std::string goods_extra = "";
+		str.add(upgrade.stone, true);
+	framebuffer.drawText(str.c_str(), 76, y + 4, *minifont, 4, 6);
+	str.clear();
+	str.add(player.goods);
 	if (upgrade.item && upgrade.goods)
-		goods_extra = std::string(upgrade.goods > 0 ? "+" : "") + std::to_string(upgrade.goods);
-	framebuffer.drawText(std::to_string(player.goods) + goods_extra, 106, y + 4, *minifont, 4, 6);
+		str.add(upgrade.goods, true);
+	framebuffer.drawText(str.c_str(), 106, y + 4, *minifont, 4, 6);
 
 	//menu
 	if (mode == MENU_MODE)
@@ -562,19 +765,22 @@ void PlayStage::renderHUD(Image& framebuffer)
 		for (int i = 0; i < 2; ++i)
 		{
 			sCharacter& character = world.players[((world.selected_player + 1 + i) % 3)];
-			framebuffer.drawImage(*tileset, 16*i, framebuffer.height - 16, Area(character.alive ? character.character * 16 : 3*16, 138, 16, 16)); //face2
+			drawTileset(framebuffer, 16*i, framebuffer.height - 16, Area(character.alive ? character.character * 16 : 3*16, 138, 16, 16)); //face2
 		}
-		framebuffer.drawImage(*tileset, 16*2, framebuffer.height - 16, Area(4*16,112,16*2,16)); //icons
-		if( int(getTime() * 0.005) % 2 == 0 )
-			framebuffer.drawImage(*tileset, selection * 16, framebuffer.height - 16, Area(0, 112, 16, 16)); //icons
+		drawTileset(framebuffer, 16*2, framebuffer.height - 16, Area(4*16,112,16*2,16)); //icons
+		if( int(Clock::Get()->time * 0.005) % 2 == 0 )
+			drawTileset(framebuffer, selection * 16, framebuffer.height - 16, Area(0, 112, 16, 16)); //icons
 	}
 
 	framebuffer.drawRectangle( 0, 0, 30, 8, Color(0, 0, 0, 100) );
-	framebuffer.drawText( std::string("Day: ") + std::to_string(world.day + 1), 1, 1, *minifont, 4, 6 );
+	str.clear();
+	str.add("Day: ").add(world.day + 1);
+	framebuffer.drawText( str.c_str(), 1, 1, *minifont, 4, 6 );
 }
 
 void PlayStage::update(float dt)
 {
+	entities->update(dt);
 	sCharacter& player = world.players[ world.selected_player ];
 	uint8 action = NO_ACTION;
 	uint8 param = 0;
@@ -639,13 +845,14 @@ void PlayStage::update(float dt)
 			}
 			else if (selection == 2)
 			{
-				Stage::changeStage("map");
+				Stage::changeStage(STAGE_MAP);
 			}
 			else if (selection == 3)
 			{
 				mode = WALK_MODE;
 				selection = 0;
-				Stage::changeStage("turn");
+				history->push();
+				Stage::changeStage(STAGE_TURN);
 			}
 		}
 	}
@@ -653,49 +860,61 @@ void PlayStage::update(float dt)
 	if (action && player.movements == 0 && !world.unlimited_movements )
 		action = NO_ACTION;
 
-	if (action == WALK)
+	//every action can be undone, the state before it is only kept if it changed something (not walking into a rock)
+	if (Input::wasKeyPressed(SDL_SCANCODE_BACKSPACE))
 	{
-		player.prev_pos = player.pos;
-		switch (param)
-		{
-			case NORTH: player.pos.y -= 16; break;
-			case SOUTH: player.pos.y += 16; break;
-			case EAST: player.pos.x += 16; break;
-			case WEST: player.pos.x -= 16; break;
-		}
+		history->undo();
+		action = NO_ACTION;
+	}
+	WorldSnapshot before;
+	if (action)
+		before = history->take();
 
-		//adjust
-		player.pos.x = clamp(player.pos.x, 0, (world.gamemap.width - 1) * 16);
-		player.pos.y = clamp(player.pos.y, 0, (world.gamemap.height - 1) * 16);
-		sCell& targetcell = getCellWorld(player.pos.x, player.pos.y);
-		if (targetcell.terrain == TILE_ROCK)
-			player.pos = player.prev_pos;
-		else if(!world.unlimited_movements)
-			player.movements--;
+	//the planner plays the rest of the day of the selected player
+	if (Input::wasKeyPressed(SDL_SCANCODE_P) && player.alive && !action)
+	{
+		history->push();
+		Planner::apply(world, world.selected_player, planner->plan(world, world.selected_player));
+	}
 
-		//passive actions
-		sCell& finalcell = getCellWorld(player.pos.x, player.pos.y);
-		if (finalcell.item == ITEM_FOUNTAIN || finalcell.item == ITEM_WELL)
-			player.water = 100;
-		if (finalcell.goods)
-		{
-			player.goods = min(10, player.goods + finalcell.goods);
-			finalcell.goods = 0;
-		}
-		world.computeFamilyLove();
+	//walks to the closest water or member of the family, as far as the movements allow
+	int walk_field = -1;
+	if (Input::wasKeyPressed(SDL_SCANCODE_W))
+		walk_field = PathFinder::FIELD_WATER;
+	if (Input::wasKeyPressed(SDL_SCANCODE_F))
+		walk_field = pathfinder->getClosestPlayer(world.selected_player);
+	if (walk_field != -1 && player.alive && !action && pathfinder->getDirection(walk_field, player.pos.x / 16, player.pos.y / 16))
+	{
+		history->push();
+		int direction;
+		while ((direction = pathfinder->getDirection(walk_field, player.pos.x / 16, player.pos.y / 16)) && world.applyAction(world.selected_player, WALK, direction))
+			;
 	}
 
+	if (action == WALK && world.applyAction(world.selected_player, WALK, param))
+		history->push(before);
+
 	if (action == INTERACT)
 	{
 		sCell& finalcell = getCellWorld(player.pos.x, player.pos.y);
 		if(finalcell.item)
-			world.upgradeCell( &player, player.pos.x / 16, player.pos.y / 16);
+		{
+			Vector4 missing;
+			bool changed = world.applyAction(world.selected_player, INTERACT, 0, &missing);
+			if (changed)
+				history->push(before);
+			if (changed || !missing.isZero())
+				missing_resources = missing;
+			if (!missing.isZero())
+				missing_time = Clock::Get()->time + 2000; //2 seconds
+		}
 		else if (finalcell.people)
-			Stage::changeStage("talk");
+			Stage::changeStage(STAGE_TALK);
 	}
 
 	//DEBUG STUFF
 	sCell& cell = getCellWorld( player.pos.x, player.pos.y );
+	bool cell_edited = false; //the listeners (minimap, pathfinder...) are notified once after the edits
 	if (Input::wasKeyPressed(SDL_SCANCODE_1))
 		world.selected_player = 0;
 	if (Input::wasKeyPressed(SDL_SCANCODE_2))
@@ -703,27 +922,48 @@ void PlayStage::update(float dt)
 	if (Input::wasKeyPressed(SDL_SCANCODE_3))
 		world.selected_player = 2;
 	if (Input::wasKeyPressed(SDL_SCANCODE_C))
+	{
+		bool church = World::getChurchRadius(cell.item) != 0;
 		cell.item = 12;
+		if (church)
+			world.setChurch(player.pos.x / 16, player.pos.y / 16, 0);
+		cell_edited = true;
+	}
 	if (Input::wasKeyPressed(SDL_SCANCODE_R))
+	{
 		cell.road = !cell.road;
+		cell_edited = true;
+	}
 	if (Input::wasKeyPressed(SDL_SCANCODE_T))
+	{
+		history->push();
 		world.restart();
+	}
 	if (Input::wasKeyPressed(SDL_SCANCODE_N))
-		Stage::changeStage("turn");
+	{
+		history->push();
+		Stage::changeStage(STAGE_TURN);
+	}
 	if (Input::wasKeyPressed(SDL_SCANCODE_M))
-		Stage::changeStage("map");
+		Stage::changeStage(STAGE_MAP);
 	if (Input::wasKeyPressed(SDL_SCANCODE_I))
 		world.unlimited_movements = !world.unlimited_movements;
-	if (Input::wasKeyPressed(SDL_SCANCODE_7)) 
-		cell.terrain = 0;
-	if (Input::wasKeyPressed(SDL_SCANCODE_8)) 
-		cell.terrain = 1;
-	if (Input::wasKeyPressed(SDL_SCANCODE_9)) 
-		cell.terrain = 2;
-	if (Input::wasKeyPressed(SDL_SCANCODE_0)) 
-		cell.terrain = 3;
+	const int terrain_keys[4] = { SDL_SCANCODE_7, SDL_SCANCODE_8, SDL_SCANCODE_9, SDL_SCANCODE_0 };
+	for (int i = 0; i < 4; ++i)
+		if (Input::wasKeyPressed(terrain_keys[i]))
+		{
+			cell.terrain = i;
+			cell_edited = true;
+		}
+	if (cell_edited)
+		world.notifyCellsChanged(player.pos.x / 16, player.pos.y / 16);
 	if (Input::wasKeyPressed(SDL_SCANCODE_PAGEDOWN))
+	{
+		history->push();
 		world.passTurn();
+		if (world.isGameOver())
+			Stage::changeStage(STAGE_ENDING);
+	}
 	if (Input::wasKeyPressed(SDL_SCANCODE_INSERT))
 		player.wood += 1;
 	if (Input::wasKeyPressed(SDL_SCANCODE_HOME))
@@ -736,7 +976,7 @@ void PlayStage::update(float dt)
 		player.alive = false;
 	}
 	if (Input::wasKeyPressed(SDL_SCANCODE_END))
-		Stage::changeStage("ending");
+		Stage::changeStage(STAGE_ENDING);
 }
 
 
@@ -753,16 +993,15 @@ void TalkStage::onEnter()
 
 void TalkStage::render(Image& framebuffer)
 {
-	stages["play"]->render(framebuffer);
+	Stage::Get(STAGE_PLAY)->render(framebuffer);
 
-	Image* tileset = Image::Get("data/tileset.tga");
 	int y = framebuffer.height - 48;
 
-	framebuffer.drawRectangle(0, y, 128, framebuffer.height - y,Color(80,80,80));
-	framebuffer.drawLine(0, y, 128, y, Color(70, 70, 70));
+	framebuffer.drawRectangle(0, y, framebuffer.width, framebuffer.height - y,Color(80,80,80));
+	framebuffer.drawLine(0, y, framebuffer.width, y, Color(70, 70, 70));
 
-	framebuffer.drawImage(*tileset, 0, y - 32, Area(world.selected_player * 16, 128, 16, 32)); //you
-	framebuffer.drawImage(*tileset, 128 - 16, y - 32, Area((5 + agreement) * 16, 128, 16, 32)); //him
+	drawTileset(framebuffer, 0, y - 32, Area(world.selected_player * 16, 128, 16, 32)); //you
+	drawTileset(framebuffer, framebuffer.width - 16, y - 32, Area((5 + agreement) * 16, 128, 16, 32)); //him
 
 	const char* sentences[] = { 
 		"Hello friend,\nHave you heard\nabout our lord\nand savior?",
@@ -776,7 +1015,7 @@ void TalkStage::render(Image& framebuffer)
 	if (sentence < 6)
 		framebuffer.drawText( sentences[sentence], 2, y + 4, sentence %2 == 0 ? *font : *minifont);
 	else
-		Stage::changeStage("play");
+		Stage::changeStage(STAGE_PLAY);
 }
 
 void TalkStage::update(float dt)
@@ -784,7 +1023,7 @@ void TalkStage::update(float dt)
 	if (Input::wasKeyPressed(SDL_SCANCODE_A)) 
 		sentence++;
 	if (Input::wasKeyPressed(SDL_SCANCODE_Z))
-		Stage::changeStage("play");
+		Stage::changeStage(STAGE_PLAY);
 }
 
 NextTurnStage::NextTurnStage() : Stage("turn")
@@ -794,26 +1033,33 @@ NextTurnStage::NextTurnStage() : Stage("turn")
 void NextTurnStage::onEnter()
 {
 	world.passTurn();
+	if (world.isGameOver())
+		Stage::changeStage(STAGE_ENDING);
 }
 
 void NextTurnStage::render(Image& framebuffer)
 {
 	framebuffer.fill(Color(0, 0, 0));
 
-	Image* tileset = Image::Get("data/tileset.tga");
-	float elapsed = (getTime() - enter_time) * 0.001;
+	float elapsed = (Clock::Get()->time - enter_time) * 0.001;
 
-	framebuffer.drawText("Next turn", 32, 44, *font);
+	//layout made for 128x128, centered in the framebuffer
+	int x = (framebuffer.width - 128) / 2;
+	int y = (framebuffer.height - 128) / 2;
+	framebuffer.drawText("Next turn", x + 32, y + 44, *font);
 
-	std::string str = std::string("Day ") + std::to_string( world.day + 1 );
-	framebuffer.drawText(str, 43, 58, *font);
+	TextBuffer<16> str;
+	str.add("Day ").add(world.day + 1);
+	framebuffer.drawText(str.c_str(), x + 43, y + 58, *font);
 
-	framebuffer.drawText("Souls saved", 23, 81, *font);
-	framebuffer.drawText(std::to_string(world.souls_saved), 56, 94, *font);
-	framebuffer.drawImage(*tileset, 40, 90, Area(2 * 16, 12 * 16, 16, 16));
+	framebuffer.drawText("Souls saved", x + 23, y + 81, *font);
+	str.clear();
+	str.add(world.souls_saved);
+	framebuffer.drawText(str.c_str(), x + 56, y + 94, *font);
+	drawTileset(framebuffer, x + 40, y + 90, Area(2 * 16, 12 * 16, 16, 16));
 
 	if (elapsed > 4) //autopass
-		Stage::changeStage("play");
+		Stage::changeStage(STAGE_PLAY);
 }
 
 void NextTurnStage::update(float dt)
@@ -821,65 +1067,267 @@ void NextTurnStage::update(float dt)
 	if (Input::wasKeyPressed(SDL_SCANCODE_A)) 
 	{
 		world.passTurn();
-		Stage::changeStage("play");
+		Stage::changeStage(world.isGameOver() ? STAGE_ENDING : STAGE_PLAY);
 	}
 }
 
 MapStage::MapStage() : Stage("map")
 {
 	show_blessing = false;
+	fit = true;
+	zoom = 0;
+	cache_valid = view_valid = false;
+	cached_fog = cached_blessing = false;
+	view_scale = view_step = 1;
+	view_x = view_y = 0;
+	world.addListener(this);
+	pyramid = new MapPyramid(&world);
+	islands = new MapRegions(&world, false);
 }
 
-void MapStage::render(Image& framebuffer)
+void MapStage::onCellsChanged(int x, int y, int w, int h)
 {
-	framebuffer.fill(Color(209,208,190));
-	static const Color colors[4] = { {94,125,159,255}, {197,191,154,255 },{ 116,140,98,255 },{ 125,125,125,255 } };
-	for(int x = 0; x < framebuffer.width; ++x)
-		for (int y = 0; y < framebuffer.height; ++y)
+	if (!cache_valid)
+		return;
+	//too many small changes (p.e. a whole turn), cheaper to rebuild
+	if (dirty.size() >= 256)
+	{
+		onMapReset();
+		return;
+	}
+	sDirtyArea area = { x, y, w, h };
+	dirty.push_back(area);
+}
+
+const Color MAP_BACKGROUND(209, 208, 190);
+
+void MapStage::updateCells(int x, int y, int w, int h)
+{
+	for (int cy = y; cy < y + h; ++cy)
+		for (int cx = x; cx < x + w; ++cx)
 		{
-			sCell& cell = world.gamemap.get(clamp(x, 0, world.gamemap.width), clamp(y, 0, world.gamemap.height));
+			sCell& cell = world.gamemap.get(cx, cy);
 			if (!cell.discovered && world.map_fog)
+			{
+				minimap.setPixel(cx, cy, Color(0, 0, 0, 0));
+				blessing.setPixel(cx, cy, Color(0, 0, 0, 0));
 				continue;
-			Color c = colors[cell.terrain % 4];
-			if (cell.item)
+			}
+			minimap.setPixel(cx, cy, MapPyramid::getCategoryColor(MapPyramid::getCategory(cell)));
+
+			if (cell.terrain != TILE_WATER)
+				blessing.setPixel(cx, cy, cell.blessed ? Color(255, 255, 0) : Color(50, 50, 50));
+			else
+				blessing.setPixel(cx, cy, Color(0, 0, 0, 0));
+		}
+}
+
+void MapStage::composeView(int x, int y, int w, int h)
+{
+	//view pixels of the cells, a cell is view_scale pixels wide, or a pixel shows a block of view_step cells
+	int startx = max(0, view_x + x * view_scale / view_step);
+	int starty = max(0, view_y + y * view_scale / view_step);
+	int endx = min((int)view.width, view_x + ((x + w - 1) * view_scale) / view_step + view_scale);
+	int endy = min((int)view.height, view_y + ((y + h - 1) * view_scale) / view_step + view_scale);
+
+	//zoomed out, every pixel is a block of the pyramid
+	if (view_step > 1)
+	{
+		int level = 0;
+		while ((1 << level) < view_step)
+			level++;
+		const MapPyramid::sLevel& blocks = pyramid->levels[level - 1];
+		for (int py = starty; py < endy; ++py)
+		{
+			Color* dst = &view.getPixelRef(startx, py);
+			int by = py - view_y;
+			for (int px = startx; px < endx; ++px, ++dst)
 			{
-				if (cell.item < 3) //tree
-					c *= 0.8;
-				else if (cell.item == 5) //rock
-					c.set(125, 125, 125);
-				else if (cell.item == ITEM_FOUNTAIN || cell.item == ITEM_WELL) //water
-					c.set(50, 255, 255);
-				else if (cell.item == 128 ) //church
-					c.set(255,255,100);
-				else if (cell.item > 128) //house
-					c.set(200, 100, 50);
+				int bx = px - view_x;
+				if (bx < 0 || by < 0 || bx >= blocks.width || by >= blocks.height)
+					*dst = MAP_BACKGROUND;
+				else
+					*dst = pyramid->getBlockColor(level, bx, by, world.map_fog, show_blessing, MAP_BACKGROUND);
 			}
+		}
+		return;
+	}
 
-			if (show_blessing && cell.terrain != TILE_WATER)
-				c = cell.blessed ? Color(255, 255, 0) : Color(50, 50, 50);
-			framebuffer.setPixel(x,y,c);
+	for (int py = starty; py < endy; ++py)
+	{
+		Color* dst = &view.getPixelRef(startx, py);
+		for (int px = startx; px < endx; ++px, ++dst)
+		{
+			int cx = px - view_x;
+			int cy = py - view_y;
+			if (cx < 0 || cy < 0)
+			{
+				*dst = MAP_BACKGROUND;
+				continue;
+			}
+			cx = cx / view_scale;
+			cy = cy / view_scale;
+			if (cx >= (int)minimap.width || cy >= (int)minimap.height)
+			{
+				*dst = MAP_BACKGROUND;
+				continue;
+			}
+			const Color& c = minimap.getPixelRef(cx, cy);
+			const Color& overlay = blessing.getPixelRef(cx, cy);
+			if (c.a == 0)
+				*dst = MAP_BACKGROUND;
+			else if (show_blessing && overlay.a)
+				*dst = overlay;
+			else
+				*dst = c;
 		}
+	}
+}
+
+void MapStage::updateLayout()
+{
+	Matrix<sCell>& gamemap = world.gamemap;
+	int min_zoom = 1 - pyramid->getNumLevels(); //one pixel for the whole map
+	if (fit)
+	{
+		//biggest zoom that shows the whole map
+		center.set(gamemap.width * 0.5, gamemap.height * 0.5);
+		for (zoom = 4; zoom > min_zoom; --zoom)
+		{
+			int w = zoom >= 0 ? gamemap.width << zoom : (gamemap.width + (1 << -zoom) - 1) >> -zoom;
+			int h = zoom >= 0 ? gamemap.height << zoom : (gamemap.height + (1 << -zoom) - 1) >> -zoom;
+			if (w <= (int)view.width && h <= (int)view.height)
+				break;
+		}
+	}
+	zoom = clamp(zoom, min_zoom, 4);
+	center.x = clamp(center.x, 0, gamemap.width);
+	center.y = clamp(center.y, 0, gamemap.height);
+
+	int scale = zoom > 0 ? 1 << zoom : 1;
+	int step = zoom < 0 ? 1 << -zoom : 1;
+	int x = (int)view.width / 2 - (int)(center.x / step) * scale;
+	int y = (int)view.height / 2 - (int)(center.y / step) * scale;
+	if (scale != view_scale || step != view_step || x != view_x || y != view_y)
+		view_valid = false;
+	view_scale = scale;
+	view_step = step;
+	view_x = x;
+	view_y = y;
+}
+
+void MapStage::updateCache(Image& framebuffer)
+{
+	Matrix<sCell>& gamemap = world.gamemap;
+	if (view.width != framebuffer.width || view.height != framebuffer.height || minimap.width != gamemap.width || minimap.height != gamemap.height || cached_fog != world.map_fog)
+		cache_valid = false;
+
+	if (!cache_valid)
+	{
+		minimap = Image(gamemap.width, gamemap.height);
+		blessing = Image(gamemap.width, gamemap.height);
+		view = Image(framebuffer.width, framebuffer.height);
+		updateCells(0, 0, gamemap.width, gamemap.height);
+		dirty.clear();
+		cached_fog = world.map_fog;
+		cache_valid = true;
+		view_valid = false;
+	}
+
+	updateLayout();
+	if (cached_blessing != show_blessing)
+		view_valid = false;
+
+	for (int i = 0; i < dirty.size(); ++i)
+	{
+		sDirtyArea& area = dirty[i];
+		updateCells(area.x, area.y, area.w, area.h);
+		if (view_valid)
+			composeView(area.x, area.y, area.w, area.h);
+	}
+	dirty.clear();
+
+	//zoom, pan or overlay changed, recompose all the view (one block per pixel, not one cell)
+	if (!view_valid)
+	{
+		view.fill(MAP_BACKGROUND);
+		composeView(0, 0, gamemap.width, gamemap.height);
+		cached_blessing = show_blessing;
+		view_valid = true;
+	}
+}
+
+void MapStage::render(Image& framebuffer)
+{
+	//the map is only redrawn where it changed, showing it is a single copy
+	updateCache(framebuffer);
+	memcpy(framebuffer.pixels, view.pixels, view.width * view.height * sizeof(Color));
 
 	for (int i = 0; i < 3; ++i)
 	{
 		sCharacter& player = world.players[i];
-		framebuffer.setPixelSafe(player.pos.x / 16, player.pos.y / 16, Color(rand(),rand(),rand()));
+		Color c(rand(), rand(), rand());
+		int x = view_x + (int)(player.pos.x / 16) * view_scale / view_step;
+		int y = view_y + (int)(player.pos.y / 16) * view_scale / view_step;
+		framebuffer.drawRectangle(x, y, view_scale, view_scale, c);
+	}
+
+	//island of the selected player, when it is on land
+	const sCharacter& player = world.players[world.selected_player];
+	int island = islands->getRegion(player.pos.x / 16, player.pos.y / 16);
+	if (island != -1)
+	{
+		const MapRegions::sRegion& info = islands->getRegionInfo(island);
+		TextBuffer<32> str;
+		str.add("Island people ").add(info.people).add(" blessed ").add(info.blessed * 100 / info.cells).add("%");
+		framebuffer.drawRectangle(0, framebuffer.height - 8, framebuffer.width, 8, Color(0, 0, 0, 100));
+		framebuffer.drawText(str.c_str(), 1, framebuffer.height - 7, *Image::Get(MINIFONT_WHITE), 4, 6);
 	}
 }
 
 void MapStage::update(float dt)
 {
 	if (Input::wasKeyPressed(SDL_SCANCODE_Z) || Input::wasKeyPressed(SDL_SCANCODE_M))
-		Stage::changeStage("play");
+		Stage::changeStage(STAGE_PLAY);
 	if (Input::wasKeyPressed(SDL_SCANCODE_R)) //regenerates the map
 		world.restart();
 	if (Input::wasKeyPressed(SDL_SCANCODE_F)) //shows all map
 		world.map_fog = !world.map_fog;
 	if (Input::wasKeyPressed(SDL_SCANCODE_B) || Input::wasKeyPressed(SDL_SCANCODE_A))
 		show_blessing = !show_blessing;
+
+	//zoom with +/-, pan with the arrows, HOME to see the whole map again
+	if (Input::wasKeyPressed(SDL_SCANCODE_EQUALS) || Input::wasKeyPressed(SDL_SCANCODE_KP_PLUS))
+	{
+		zoom++;
+		fit = false;
+	}
+	if (Input::wasKeyPressed(SDL_SCANCODE_MINUS) || Input::wasKeyPressed(SDL_SCANCODE_KP_MINUS))
+	{
+		zoom--;
+		fit = false;
+	}
+	if (Input::wasKeyPressed(SDL_SCANCODE_HOME))
+		fit = true;
+
+	float speed = 64 * dt * view_step / view_scale; //64 pixels per second, in cells
+	Vector2 move;
+	if (Input::isKeyPressed(SDL_SCANCODE_LEFT))
+		move.x -= speed;
+	if (Input::isKeyPressed(SDL_SCANCODE_RIGHT))
+		move.x += speed;
+	if (Input::isKeyPressed(SDL_SCANCODE_UP))
+		move.y -= speed;
+	if (Input::isKeyPressed(SDL_SCANCODE_DOWN))
+		move.y += speed;
+	if (move.x || move.y)
+	{
+		center = center + move;
+		fit = false;
+	}
 }
 
-Vector2ub wave_points[10]; //used to show moving waves in random positions
+Vector2ub wave_points[10]; //used to show moving waves in random positions (x relative to a 128 pixels width)
 
 IntroStage::IntroStage() : Stage("intro")
 {
@@ -889,35 +1337,37 @@ IntroStage::IntroStage() : Stage("intro")
 
 void IntroStage::render(Image& framebuffer)
 {
-	Image* tileset = Image::Get("data/tileset.tga");
-	float elapsed = (getTime() - enter_time) * 0.001;
+	float elapsed = (Clock::Get()->time - enter_time) * 0.001;
 	int horizon = framebuffer.height*0.6;
 
 	framebuffer.drawRectangle(0, 0,framebuffer.width, horizon, Color(160,175,191));
 	framebuffer.drawRectangle(0, horizon, framebuffer.width, framebuffer.height, Color(94, 125, 159));
 
+	//the art is 128 pixels wide, centered when the framebuffer is bigger
+	int center = (framebuffer.width - 128) / 2;
 	int offset = min(0, elapsed * 10 - 40);
-	framebuffer.drawImage( *tileset, offset + elapsed * 2, 48, Area(128, 208, 128, 16)); //clouds
-	framebuffer.drawImage(*tileset, offset + elapsed * 2 - 128, 48, Area(128, 208, 128, 16)); //clouds
-	framebuffer.drawImage( *tileset, offset, horizon - 16, Area(128,224,128,32)); //island
+	drawTileset(framebuffer, center + offset + elapsed * 2, 48, Area(128, 208, 128, 16)); //clouds
+	drawTileset(framebuffer, center + offset + elapsed * 2 - 128, 48, Area(128, 208, 128, 16)); //clouds
+	drawTileset(framebuffer, center + offset, horizon - 16, Area(128,224,128,32)); //island
 
-	framebuffer.drawImage(*tileset, 1, min(10,elapsed * 20 - 50), Area(0, 224, 128, 32)); //title
+	drawTileset(framebuffer, center + 1, min(10,elapsed * 20 - 50), Area(0, 224, 128, 32)); //title
 
 	if (elapsed > 3 && blink(3))
-		framebuffer.drawText("Press a button", 10, framebuffer.height - 20, *font);
+		framebuffer.drawText("Press a button", center + 10, framebuffer.height - 20, *font);
 
 	for (int i = 0; i < 10; ++i)
 	{
 		float f = sin(elapsed*0.8 + i*10) * 5;
+		int x = wave_points[i].x * framebuffer.width / 128; //spread over the whole width
 		if (f > 0)
-			framebuffer.drawLine(offset + wave_points[i].x - f, horizon + wave_points[i].y, offset + wave_points[i].x + f, horizon + wave_points[i].y, Color(174, 187, 202));
+			framebuffer.drawLine(offset + x - f, horizon + wave_points[i].y, offset + x + f, horizon + wave_points[i].y, Color(174, 187, 202));
 	}
 }
 
 void IntroStage::update(float dt)
 {
 	if (Input::wasKeyPressed(SDL_SCANCODE_A) || Input::wasKeyPressed(SDL_SCANCODE_Z))
-		Stage::changeStage("tutorial");
+		Stage::changeStage(STAGE_TUTORIAL);
 }
 
 TutorialStage::TutorialStage() : Stage("tutorial")
@@ -926,19 +1376,18 @@ TutorialStage::TutorialStage() : Stage("tutorial")
 
 void TutorialStage::render(Image& framebuffer)
 {
-	Image* tileset = Image::Get("data/tileset.tga");
-	float elapsed = (getTime() - enter_time) * 0.001;
+	float elapsed = (Clock::Get()->time - enter_time) * 0.001;
 
 	framebuffer.fill(Color::BLACK);
 
 	int x = min(elapsed * 50 - 30,10);
 	int y = framebuffer.height * 0.5;
-	framebuffer.drawImage(*tileset, x + 0, y, Area(0 * 16, 128, 16, 32));
-	framebuffer.drawImage(*tileset, x + 16, y, Area(1 * 16, 128, 16, 32));
-	framebuffer.drawImage(*tileset, x + 32, y, Area(2 * 16, 128, 16, 32));
+	drawTileset(framebuffer, x + 0, y, Area(0 * 16, 128, 16, 32));
+	drawTileset(framebuffer, x + 16, y, Area(1 * 16, 128, 16, 32));
+	drawTileset(framebuffer, x + 32, y, Area(2 * 16, 128, 16, 32));
 
-	x = 110 - min((elapsed - 1) * 50 - 30, 10);
-	framebuffer.drawImage(*tileset, x, y, Area( (14 + (int(getTime()*0.003)%2) )* 16, 128, 16, 32));
+	x = framebuffer.width - 18 - min((elapsed - 1) * 50 - 30, 10);
+	drawTileset(framebuffer, x, y, Area( (14 + (int(Clock::Get()->time*0.003)%2) )* 16, 128, 16, 32));
 
 	const char* text[] = {
 		"You must go to\nthe new world\nand save their\nsouls.",
@@ -953,13 +1402,13 @@ void TutorialStage::render(Image& framebuffer)
 	else if (elapsed < 15 && elapsed > 10)
 		framebuffer.drawText(text[2], 10, 10, *font);
 	else if (elapsed > 16)
-		Stage::changeStage("play");
+		Stage::changeStage(STAGE_PLAY);
 }
 
 void TutorialStage::update(float dt)
 {
 	if (Input::wasKeyPressed(SDL_SCANCODE_A) || Input::wasKeyPressed(SDL_SCANCODE_Z)) 
-		Stage::changeStage("play");
+		Stage::changeStage(STAGE_PLAY);
 }
 
 EndingStage::EndingStage() : Stage("ending")
@@ -968,30 +1417,31 @@ EndingStage::EndingStage() : Stage("ending")
 
 void EndingStage::render(Image& framebuffer)
 {
-	Image* tileset = Image::Get("data/tileset.tga");
-	float elapsed = (getTime() - enter_time) * 0.001;
+	float elapsed = (Clock::Get()->time - enter_time) * 0.001;
 
 	framebuffer.fill(Color::BLACK);
 
-	int x = 20;
-	int y = framebuffer.height * 0.5;
+	//layout made for 128x128, centered in the framebuffer
+	int x = (framebuffer.width - 128) / 2;
+	int y = (framebuffer.height - 128) / 2;
 
 	if (world.alive_players == 0)
-		framebuffer.drawText("All your family\nmembers are\ndead.", 10, 10, *font);
+		framebuffer.drawText("All your family\nmembers are\ndead.", x + 10, y + 10, *font);
 	else if (world.day >= 365)
-		framebuffer.drawText("The year has passed.", 10, 10, *font);
+		framebuffer.drawText("The year has passed.", x + 10, y + 10, *font);
 	else
-		framebuffer.drawText("You resigned.", 10, 10, *font);
+		framebuffer.drawText("You resigned.", x + 10, y + 10, *font);
 
-	std::string str = std::string("Souls saved\n") + std::to_string(world.souls_saved);
-	framebuffer.drawText(str, 23, 81, *font);
-	framebuffer.drawImage(*tileset, 2, 76, Area(2 * 16, 12 * 16, 16, 16));
+	TextBuffer<32> str;
+	str.add("Souls saved\n").add(world.souls_saved);
+	framebuffer.drawText(str.c_str(), x + 23, y + 81, *font);
+	drawTileset(framebuffer, x + 2, y + 76, Area(2 * 16, 12 * 16, 16, 16));
 }
 
 void EndingStage::update(float dt)
 {
-	float elapsed = (getTime() - enter_time) * 0.001;
+	float elapsed = (Clock::Get()->time - enter_time) * 0.001;
 
 	if (elapsed > 2 && (Input::wasKeyPressed(SDL_SCANCODE_A) || Input::wasKeyPressed(SDL_SCANCODE_Z))) 
-		Stage::changeStage("intro");
+		Stage::changeStage(STAGE_INTRO);
 }
\ No newline at end of file
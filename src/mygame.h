@@ -1,6 +1,8 @@
 #pragma once
 
 #include "image.h"
+#include "spritebatch.h"
+#include "coverage.h"
 
 enum { TILE_WATER = 0, TILE_SAND, TILE_GRASS, TILE_ROCK };
 enum { TILE_HOUSE = 128 };
@@ -64,12 +66,26 @@ struct sUpgrade {
 	const char* str;
 };
 
+//what every item becomes and what it costs, ends with a row with item 255
+extern const sUpgrade upgrade_table[];
+extern const int upgrade_table_size;
+
+//objects that keep data computed from the map (caches, overlays...) are told when cells change
+class MapListener {
+public:
+	virtual ~MapListener() {}
+	virtual void onCellsChanged(int x, int y, int w, int h) = 0; //area of cells modified
+	virtual void onMapReset() = 0; //the whole map changed (new map, resized...)
+};
+
+class WorldPolicy;
+
 class World {
 public:
 	static World* instance;
 	sCharacter players[3];
 	Matrix<sCell> gamemap;
-	uint8 day;
+	uint16 day;
 	uint8 selected_player;
 	uint8 alive_players;
 	int souls_saved;
@@ -78,21 +94,62 @@ public:
 	bool map_fog;
 	bool unlimited_movements;
 
-	World();
+	World(uint32 seed = 1);
+	World(const World& other) { *this = other; }
+	World& operator = (const World& other); //copies the state but not the listeners, so a clone can be played on its own
 	void restart();
 	void generateMap();
+	void newMap(int width, int height); //resizes and generates the map, the listeners are told (the benchmarks play on these maps)
 	void passTurn();
+	bool isGameOver() const { return alive_players == 0 || day >= 365; }
+
+	//what a player can do in its turn, false if it could not be done (missing gets the resources missing for an upgrade)
+	bool applyAction(int player, int action, int param = 0, Vector4* missing = NULL);
+	//plays turns without rendering, the policy (if any) decides the actions of the players, returns the days played
+	int simulate(int days, WorldPolicy* policy = NULL);
 
 	void computeFamilyLove();
 	sUpgrade getUpgradeInfo(int item);
-	void upgradeCell(sCharacter* author, int x, int y);
-	void blessArea(int x, int y, int radius); //increases bleassing area
+	static int findUpgrade(int item); //row of the upgrade_table, 0 if the item can not be upgraded
+	bool upgradeCell(sCharacter* author, int x, int y, Vector4* missing = NULL);
+
+	//churches and the cells they bless
+	ChurchCoverage coverage;
+	static int getChurchRadius(int item); //0 if the item is not a church
+	void setChurch(int x, int y, int radius); //adds, upgrades or removes (radius 0) a church and updates the blessed cells
+	void findChurches(); //coverage from the items, when the cells were replaced without upgrades (p.e. loading)
+
+	//random numbers of this world (not rand), so every world is deterministic and can run in its own thread
+	uint32 random_state;
+	void setSeed(uint32 seed) { random_state = seed ? seed : 1; }
+	uint32 randomInt() { random_state ^= random_state << 13; random_state ^= random_state >> 17; random_state ^= random_state << 5; return random_state; } //xorshift32
+	float random() { return (randomInt() % 10000) / 10000.0f; } //same range as ::random()
+
+	//map listeners, call notifyCellsChanged after modifying cells
+	std::vector<MapListener*> listeners;
+	void addListener(MapListener* listener) { listeners.push_back(listener); }
+	void removeListener(MapListener* listener);
+	void notifyCellsChanged(int x, int y, int w = 1, int h = 1);
+	void notifyMapReset();
 };
 
+extern World world;
+extern Vector2 campos; //camera of the play stage
+
+//stage ids, the hash of the name of every stage computed at compile time
+constexpr uint32 STAGE_INTRO = hashString("intro");
+constexpr uint32 STAGE_TUTORIAL = hashString("tutorial");
+constexpr uint32 STAGE_PLAY = hashString("play");
+constexpr uint32 STAGE_TALK = hashString("talk");
+constexpr uint32 STAGE_TURN = hashString("turn");
+constexpr uint32 STAGE_MAP = hashString("map");
+constexpr uint32 STAGE_ENDING = hashString("ending");
+
 class Stage {
 public:
 	static Stage* current;
 	static std::map<std::string, Stage*> stages;
+	static HashTable<Stage*> stages_by_id; //same stages indexed by the hash of the name
 
 	std::string name;
 	long enter_time;
@@ -102,7 +159,8 @@ public:
 	virtual void update(float dt) {}
 	virtual void onEnter() {}
 
-	static void changeStage(const char* name);
+	static Stage* Get(uint32 id) { Stage** stage = stages_by_id.find(id); return stage ? *stage : NULL; } //id is one of STAGE_*
+	static void changeStage(uint32 id);
 };
 
 
@@ -125,6 +183,11 @@ enum ACTIONS {
 };
 
 
+class WorldHistory;
+class Planner;
+class PathFinder;
+class EntityStore;
+
 class PlayStage : public Stage {
 public:
 	PlayStage();
@@ -137,6 +200,14 @@ public:
 	long missing_time;
 	Vector4 missing_resources; //movements,wood,stone,goods
 
+	//layers of the map sprites, from bottom to top
+	enum { LAYER_FLOOR = 0, LAYER_ROAD, LAYER_ITEM, LAYER_PEOPLE, LAYER_MARKER, LAYER_PLAYER, LAYER_SELECTED };
+	SpriteBatch batch; //map sprites of the last frame
+	WorldHistory* history; //undo stack, a snapshot before every action
+	Planner* planner; //plays the day of the selected player (P)
+	PathFinder* pathfinder; //walks the selected player to the water (W) or to the family (F)
+	EntityStore* entities; //players, villagers and boats drawn in the map
+
 	void renderMap(Image& framebuffer);
 	void renderHUD(Image& framebuffer);
 };
@@ -160,13 +231,46 @@ public:
 	virtual void update(float dt);
 };
 
-class MapStage : public Stage {
+class MapPyramid;
+class MapRegions;
+
+class MapStage : public Stage, public MapListener {
 public:
 	MapStage();
 	bool show_blessing;
 
+	//zoom and pan, zoom 0 is one pixel per cell, 1 is 2x2 pixels per cell, -1 is 2x2 cells per pixel...
+	bool fit; //zoom to see the whole map (till the player zooms or pans)
+	int zoom;
+	Vector2 center; //cell in the middle of the view
+	MapPyramid* pyramid; //summaries of the map used when zoom < 0
+	MapRegions* islands; //to show the island of the selected player
+
+	//cache of the map, one pixel per cell, only the cells that changed are updated
+	Image minimap; //transparent where it is hidden by the fog
+	Image blessing; //overlay, transparent where it does not apply (water, fog)
+	Image view; //what is shown: minimap (and overlay) scaled to the framebuffer
+	bool cache_valid;
+	bool cached_fog; //world.map_fog when the cache was built
+	bool cached_blessing; //show_blessing when the view was composed
+	int view_scale; //pixels per cell when the map fits the view
+	int view_step; //cells per pixel when it does not
+	int view_x; //where the map starts in the view
+	int view_y;
+	bool view_valid; //view composed with the current layout
+	struct sDirtyArea { int x, y, w, h; };
+	std::vector<sDirtyArea> dirty; //cells changed since the last update
+
 	virtual void render(Image& framebuffer);
 	virtual void update(float dt);
+
+	virtual void onCellsChanged(int x, int y, int w, int h);
+	virtual void onMapReset() { cache_valid = false; dirty.clear(); }
+
+	void updateCache(Image& framebuffer);
+	void updateLayout(); //view_scale, view_step and view position from the zoom and center
+	void updateCells(int x, int y, int w, int h); //minimap and overlay pixels of an area
+	void composeView(int x, int y, int w, int h); //view pixels covering an area of cells
 };
 
 class IntroStage : public Stage {
@@ -0,0 +1,524 @@
+#include "pathfinding.h"
+
+#include <algorithm>
+#include "includes.h"
+
+//same order as the directions: NORTH, EAST, SOUTH, WEST
+static const int steps[4][2] = { { 0, -1 }, { 1, 0 }, { 0, 1 }, { -1, 0 } };
+
+static int getDirectionOf(int dx, int dy)
+{
+	if (dx)
+		return dx > 0 ? EAST : WEST;
+	return dy > 0 ? SOUTH : NORTH;
+}
+
+PathFinder::PathFinder(World* world)
+{
+	this->world = world;
+	terrain_cost[TILE_WATER] = 1;
+	terrain_cost[TILE_SAND] = 1;
+	terrain_cost[TILE_GRASS] = 1;
+	terrain_cost[TILE_ROCK] = 0;
+	memset(&stats, 0, sizeof(stats));
+	width = height = 0;
+	search = 0;
+	onMapReset();
+	world->addListener(this);
+}
+
+PathFinder::~PathFinder()
+{
+	world->removeListener(this);
+}
+
+void PathFinder::onMapReset()
+{
+	width = world->gamemap.width;
+	height = world->gamemap.height;
+	int size = width * height;
+	terrain.assign(size, TILE_WATER);
+	water.assign(size, false);
+	cost.resize(size);
+	parent.resize(size);
+	opened.assign(size, 0);
+	closed.assign(size, 0);
+	search = 0;
+
+	bool changed_terrain, changed_water;
+	sync(0, 0, width, height, changed_terrain, changed_water);
+	for (int i = 0; i < NUM_FIELDS; ++i)
+		fields[i].valid = false;
+}
+
+void PathFinder::onCellsChanged(int x, int y, int w, int h)
+{
+	if (world->gamemap.width != width || world->gamemap.height != height)
+	{
+		onMapReset();
+		return;
+	}
+
+	//most changes (items, roads, goods) do not change the ways
+	bool changed_terrain, changed_water;
+	sync(x, y, w, h, changed_terrain, changed_water);
+	if (changed_terrain)
+		for (int i = 0; i < NUM_FIELDS; ++i)
+			fields[i].valid = false;
+	else if (changed_water)
+		fields[FIELD_WATER].valid = false;
+}
+
+void PathFinder::sync(int x, int y, int w, int h, bool& changed_terrain, bool& changed_water)
+{
+	changed_terrain = changed_water = false;
+	const Matrix<sCell>& gamemap = world->gamemap;
+	for (int cy = y; cy < y + h; ++cy)
+		for (int cx = x; cx < x + w; ++cx)
+		{
+			int index = cy * width + cx;
+			const sCell& cell = gamemap.data[index];
+			bool is_water = cell.item == ITEM_FOUNTAIN || cell.item == ITEM_WELL;
+			if (terrain[index] != cell.terrain)
+			{
+				terrain[index] = cell.terrain;
+				changed_terrain = true;
+			}
+			if (water[index] != is_water)
+			{
+				water[index] = is_water;
+				changed_water = true;
+			}
+		}
+}
+
+bool PathFinder::uniformCost() const
+{
+	int first = 0;
+	for (int i = 0; i < 4; ++i)
+	{
+		if (!terrain_cost[i])
+			continue;
+		if (first && terrain_cost[i] != first)
+			return false;
+		first = terrain_cost[i];
+	}
+	return true;
+}
+
+void PathFinder::pushHeap(uint32 f, int index)
+{
+	sHeapNode node = { f, index };
+	int i = heap.size();
+	heap.push_back(node);
+	while (i > 0)
+	{
+		int up = (i - 1) / 2;
+		if (heap[up].f <= node.f)
+			break;
+		heap[i] = heap[up];
+		i = up;
+	}
+	heap[i] = node;
+}
+
+PathFinder::sHeapNode PathFinder::popHeap()
+{
+	sHeapNode top = heap[0];
+	sHeapNode last = heap.back();
+	heap.pop_back();
+	int size = heap.size();
+	if (!size)
+		return top;
+	int i = 0;
+	while (true)
+	{
+		int child = i * 2 + 1;
+		if (child >= size)
+			break;
+		if (child + 1 < size && heap[child + 1].f < heap[child].f)
+			child++;
+		if (last.f <= heap[child].f)
+			break;
+		heap[i] = heap[child];
+		i = child;
+	}
+	heap[i] = last;
+	return top;
+}
+
+void PathFinder::open(int index, uint32 g, uint32 h, int from)
+{
+	if (closed[index] == search || (opened[index] == search && cost[index] <= g))
+		return;
+	opened[index] = search;
+	cost[index] = g;
+	parent[index] = from;
+	pushHeap(g + h, index); //the old entry stays in the heap, it is skipped when it comes out closed
+}
+
+//next jump point from x,y going in a straight line (4 connected: horizontal moves look for ways up and down at
+//every cell, vertical moves only stop where a wall on a side ends), -1 if there is none
+int PathFinder::jump(int x, int y, int dx, int dy, int target_x, int target_y) const
+{
+	while (true)
+	{
+		x += dx;
+		y += dy;
+		if (!isWalkable(x, y))
+			return -1;
+		if (x == target_x && y == target_y)
+			return y * width + x;
+		if (dx)
+		{
+			if (jump(x, y, 0, 1, target_x, target_y) != -1 || jump(x, y, 0, -1, target_x, target_y) != -1)
+				return y * width + x;
+		}
+		else if ((isWalkable(x - 1, y) && !isWalkable(x - 1, y - dy)) || (isWalkable(x + 1, y) && !isWalkable(x + 1, y - dy)))
+			return y * width + x;
+	}
+}
+
+bool PathFinder::findPath(int x, int y, int target_x, int target_y, std::vector<uint8>& directions, bool jump_points)
+{
+	directions.clear();
+	if (x < 0 || y < 0 || x >= width || y >= height || !isWalkable(target_x, target_y))
+		return false;
+	if (x == target_x && y == target_y)
+		return true;
+	stats.searches++;
+
+	//the cheapest terrain makes the estimation admissible
+	uint32 min_cost = 255;
+	for (int i = 0; i < 4; ++i)
+		if (terrain_cost[i])
+			min_cost = min(min_cost, (uint32)terrain_cost[i]);
+	jump_points = jump_points && uniformCost();
+
+	if (++search == 0) //the stamps wrapped around
+	{
+		opened.assign(opened.size(), 0);
+		closed.assign(closed.size(), 0);
+		search = 1;
+	}
+	heap.clear();
+	int start = y * width + x;
+	int goal = target_y * width + target_x;
+	open(start, 0, (abs(target_x - x) + abs(target_y - y)) * min_cost, -1);
+
+	while (!heap.empty())
+	{
+		int index = popHeap().index;
+		if (closed[index] == search)
+			continue;
+		closed[index] = search;
+		stats.expanded++;
+		if (index == goal)
+			break;
+		int cx = index % width;
+		int cy = index / width;
+
+		if (!jump_points)
+		{
+			for (int i = 0; i < 4; ++i)
+			{
+				int nx = cx + steps[i][0];
+				int ny = cy + steps[i][1];
+				if (!isWalkable(nx, ny))
+					continue;
+				int next = ny * width + nx;
+				open(next, cost[index] + terrain_cost[terrain[next]], (abs(target_x - nx) + abs(target_y - ny)) * min_cost, index);
+			}
+			continue;
+		}
+
+		//directions worth following: all from the start, after a horizontal move straight and turning, after a
+		//vertical move straight and to the sides where a wall ends
+		int dirs[4][2];
+		int num_dirs = 0;
+		int from = parent[index];
+		if (from == -1)
+		{
+			memcpy(dirs, steps, sizeof(steps));
+			num_dirs = 4;
+		}
+		else
+		{
+			int dx = cx - from % width;
+			int dy = cy - from / width;
+			dx = dx > 0 ? 1 : (dx < 0 ? -1 : 0);
+			dy = dy > 0 ? 1 : (dy < 0 ? -1 : 0);
+			if (dx)
+			{
+				dirs[0][0] = dx; dirs[0][1] = 0;
+				dirs[1][0] = 0; dirs[1][1] = 1;
+				dirs[2][0] = 0; dirs[2][1] = -1;
+				num_dirs = 3;
+			}
+			else
+			{
+				dirs[0][0] = 0; dirs[0][1] = dy;
+				num_dirs = 1;
+				for (int side = -1; side <= 1; side += 2)
+					if (isWalkable(cx + side, cy) && !isWalkable(cx + side, cy - dy))
+					{
+						dirs[num_dirs][0] = side;
+						dirs[num_dirs][1] = 0;
+						num_dirs++;
+					}
+			}
+		}
+		for (int i = 0; i < num_dirs; ++i)
+		{
+			int next = jump(cx, cy, dirs[i][0], dirs[i][1], target_x, target_y);
+			if (next == -1)
+				continue;
+			int nx = next % width;
+			int ny = next / width;
+			int length = abs(nx - cx) + abs(ny - cy);
+			open(next, cost[index] + length * min_cost, (abs(target_x - nx) + abs(target_y - ny)) * min_cost, index);
+		}
+	}
+	if (closed[goal] != search)
+		return false;
+
+	//back from the goal, jump points are joined by straight lines
+	for (int index = goal; index != start; index = parent[index])
+	{
+		int from = parent[index];
+		int dx = index % width - from % width;
+		int dy = index / width - from / width;
+		int direction = getDirectionOf(dx, dy);
+		for (int i = abs(dx) + abs(dy); i > 0; --i)
+			directions.push_back(direction);
+	}
+	std::reverse(directions.begin(), directions.end());
+	return true;
+}
+
+void PathFinder::buildField(int field)
+{
+	sField& f = fields[field];
+	f.distance.assign(width * height, PATH_UNREACHABLE);
+	f.valid = true;
+	f.source_x = f.source_y = -1;
+	stats.fields_built++;
+	heap.clear();
+
+	if (field == FIELD_WATER)
+	{
+		for (int i = 0; i < width * height; ++i)
+			if (water[i] && terrain_cost[terrain[i]])
+			{
+				f.distance[i] = 0;
+				pushHeap(0, i);
+			}
+	}
+	else
+	{
+		const sCharacter& player = world->players[field - FIELD_PLAYER];
+		int x = player.pos.x / 16;
+		int y = player.pos.y / 16;
+		if (!player.alive)
+			return;
+		f.source_x = x;
+		f.source_y = y;
+		if (!isWalkable(x, y))
+			return;
+		f.distance[y * width + x] = 0;
+		pushHeap(0, y * width + x);
+	}
+
+	//with the same cost everywhere the order of a queue is already the order of the distances (BFS)
+	if (uniformCost())
+	{
+		queue.clear();
+		for (int i = 0; i < heap.size(); ++i)
+			queue.push_back(heap[i].index);
+		heap.clear();
+		for (int head = 0; head < queue.size(); ++head)
+		{
+			int index = queue[head];
+			int cx = index % width;
+			int cy = index / width;
+			uint32 next_distance = f.distance[index] + terrain_cost[terrain[index]];
+			if (next_distance >= PATH_UNREACHABLE)
+				break;
+			for (int i = 0; i < 4; ++i)
+			{
+				int nx = cx + steps[i][0];
+				int ny = cy + steps[i][1];
+				if (!isWalkable(nx, ny))
+					continue;
+				int next = ny * width + nx;
+				if (f.distance[next] != PATH_UNREACHABLE)
+					continue;
+				f.distance[next] = next_distance;
+				queue.push_back(next);
+			}
+		}
+		return;
+	}
+
+	//Dijkstra from the targets, going from a neighbour into a cell costs the terrain of that cell
+	while (!heap.empty())
+	{
+		sHeapNode node = popHeap();
+		if (node.f != f.distance[node.index])
+			continue;
+		int cx = node.index % width;
+		int cy = node.index / width;
+		uint32 next_distance = node.f + terrain_cost[terrain[node.index]];
+		if (next_distance >= PATH_UNREACHABLE)
+			continue;
+		for (int i = 0; i < 4; ++i)
+		{
+			int nx = cx + steps[i][0];
+			int ny = cy + steps[i][1];
+			if (!isWalkable(nx, ny))
+				continue;
+			int next = ny * width + nx;
+			if (next_distance >= f.distance[next])
+				continue;
+			f.distance[next] = next_distance;
+			pushHeap(next_distance, next);
+		}
+	}
+}
+
+const PathFinder::sField& PathFinder::getField(int field)
+{
+	sField& f = fields[field];
+	if (!f.valid)
+		buildField(field);
+	else if (field >= FIELD_PLAYER)
+	{
+		//the family moves, the field is only rebuilt when it is asked after a move
+		const sCharacter& player = world->players[field - FIELD_PLAYER];
+		int x = player.alive ? (int)player.pos.x / 16 : -1;
+		int y = player.alive ? (int)player.pos.y / 16 : -1;
+		if (x != f.source_x || y != f.source_y)
+			buildField(field);
+	}
+	return f;
+}
+
+int PathFinder::getDistance(int field, int x, int y)
+{
+	const sField& f = getField(field);
+	if (x < 0 || y < 0 || x >= width || y >= height)
+		return -1;
+	uint16 distance = f.distance[y * width + x];
+	return distance == PATH_UNREACHABLE ? -1 : distance;
+}
+
+int PathFinder::getDirection(int field, int x, int y)
+{
+	const sField& f = getField(field);
+	if (x < 0 || y < 0 || x >= width || y >= height)
+		return 0;
+	uint16 distance = f.distance[y * width + x];
+	if (distance == 0 || distance == PATH_UNREACHABLE)
+		return 0;
+
+	//the distance of a cell is the best of its neighbours plus entering them
+	for (int i = 0; i < 4; ++i)
+	{
+		int nx = x + steps[i][0];
+		int ny = y + steps[i][1];
+		if (!isWalkable(nx, ny))
+			continue;
+		int next = ny * width + nx;
+		if (f.distance[next] != PATH_UNREACHABLE && f.distance[next] + terrain_cost[terrain[next]] == distance)
+			return i + 1; //NORTH is 1
+	}
+	return 0;
+}
+
+int PathFinder::getClosestPlayer(int player)
+{
+	const sCharacter& me = world->players[player];
+	int x = me.pos.x / 16;
+	int y = me.pos.y / 16;
+	int best = -1, best_distance = 0;
+	for (int i = 0; i < 3; ++i)
+	{
+		if (i == player || !world->players[i].alive)
+			continue;
+		int distance = getDistance(FIELD_PLAYER + i, x, y);
+		if (distance < 0 || (best != -1 && distance >= best_distance))
+			continue;
+		best = FIELD_PLAYER + i;
+		best_distance = distance;
+	}
+	return best;
+}
+
+int PathFinder::benchmark(int size, int num_paths, uint32 seed)
+{
+	std::cout << "Pathfinding benchmark, map of " << size << "x" << size << ", " << num_paths << " paths" << std::endl;
+
+	World world(seed);
+	world.newMap(size, size);
+	PathFinder finder(&world);
+
+	//random pairs of walkable cells, some of them in different islands
+	std::vector<int> pairs;
+	while (pairs.size() < num_paths * 2)
+	{
+		int index = world.randomInt() % (size * size);
+		if (finder.isWalkable(index % size, index / size))
+			pairs.push_back(index);
+	}
+
+	std::vector<uint8> directions;
+	std::vector<int> lengths(num_paths);
+	int mismatches = 0; //only the jump points are compared
+	for (int jump_points = 0; jump_points < 2; ++jump_points)
+	{
+		memset(&finder.stats, 0, sizeof(finder.stats));
+		int found = 0;
+		long total_length = 0;
+		Uint64 start = SDL_GetPerformanceCounter();
+		for (int i = 0; i < num_paths; ++i)
+		{
+			int from = pairs[i * 2], to = pairs[i * 2 + 1];
+			int length = finder.findPath(from % size, from / size, to % size, to / size, directions, jump_points != 0) ? directions.size() : -1;
+			if (length >= 0)
+			{
+				found++;
+				total_length += length;
+			}
+			if (!jump_points)
+				lengths[i] = length;
+			else if (lengths[i] != length)
+				mismatches++;
+		}
+		double seconds = (SDL_GetPerformanceCounter() - start) / (double)SDL_GetPerformanceFrequency();
+		std::cout << (jump_points ? " * Jump points: " : " * A*: ") << num_paths / seconds << " paths/s, " << seconds * 1000000.0 / num_paths << " us per path, "
+			<< finder.stats.expanded / (double)num_paths << " nodes expanded per path" << std::endl;
+		std::cout << "   " << found << " found, average length " << (found ? total_length / (double)found : 0);
+		if (jump_points)
+			std::cout << ", " << mismatches << " different from A*";
+		std::cout << std::endl;
+	}
+
+	Uint64 start = SDL_GetPerformanceCounter();
+	const sField& water = finder.getField(FIELD_WATER);
+	double seconds = (SDL_GetPerformanceCounter() - start) / (double)SDL_GetPerformanceFrequency();
+	int reachable = 0;
+	for (int i = 0; i < size * size; ++i)
+		if (water.distance[i] != PATH_UNREACHABLE)
+			reachable++;
+	std::cout << " * Water field: " << seconds * 1000.0 << " ms to build, " << reachable * 100.0 / (size * size) << "% of the cells reach water" << std::endl;
+
+	//asking again is free while nothing changes
+	start = SDL_GetPerformanceCounter();
+	int steps_found = 0;
+	for (int i = 0; i < num_paths * 2; ++i)
+		if (finder.getDirection(FIELD_WATER, pairs[i] % size, pairs[i] / size))
+			steps_found++;
+	seconds = (SDL_GetPerformanceCounter() - start) / (double)SDL_GetPerformanceFrequency();
+	std::cout << " * Cached steps to water: " << seconds * 1000000000.0 / (num_paths * 2) << " ns per query (" << steps_found << " cells with a step)" << std::endl;
+	return mismatches;
+}
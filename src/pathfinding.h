@@ -0,0 +1,93 @@
+/*	PathFinder: paths over the cells of the map, walking in the four directions like the players do.
+	findPath is A* with a binary heap, its node arrays are allocated once per map size and a search stamp says which
+	nodes belong to the current search, so nothing is cleared between searches. With jump points (only when all the
+	walkable terrains cost the same) straight corridors are skipped instead of expanding every cell.
+	The distance fields give the distance from every cell to the closest target (water, a member of the family), so
+	going there is reading the neighbours. They are cached and only rebuilt when the terrain, the water sources or the
+	position of the player change (it is a map listener).
+*/
+
+#ifndef PATHFINDING_H
+#define PATHFINDING_H
+
+#include <vector>
+#include "mygame.h"
+
+#define PATH_UNREACHABLE 0xFFFF
+
+class PathFinder : public MapListener
+{
+public:
+	enum {
+		FIELD_WATER = 0, //fountains and wells
+		FIELD_PLAYER, //FIELD_PLAYER + i is players[i]
+		NUM_FIELDS = FIELD_PLAYER + 3
+	};
+
+	struct sField {
+		std::vector<uint16> distance; //movements to the closest target, PATH_UNREACHABLE if there is no way
+		bool valid;
+		int source_x; //position of the player it was built for
+		int source_y;
+	};
+
+	struct sStats {
+		int searches;
+		int expanded; //nodes taken from the heap
+		int fields_built;
+	};
+
+	World* world;
+	uint8 terrain_cost[4]; //movements to enter a cell of every terrain, 0 can not be entered (rocks, as in WALK)
+	sStats stats;
+
+	PathFinder(World* world);
+	~PathFinder();
+
+	//directions (NORTH, EAST...) from one cell to the other, false if there is no way
+	bool findPath(int x, int y, int target_x, int target_y, std::vector<uint8>& directions, bool jump_points = false);
+
+	const sField& getField(int field); //rebuilt if needed
+	int getDistance(int field, int x, int y); //-1 if it can not be reached
+	int getDirection(int field, int x, int y); //step that gets closer to the target, 0 if there or unreachable
+	int getClosestPlayer(int player); //field of the closest member of the family that can be reached, -1 if none
+
+	bool isWalkable(int x, int y) const { return x >= 0 && y >= 0 && x < width && y < height && terrain_cost[terrain[y * width + x]] != 0; }
+
+	virtual void onCellsChanged(int x, int y, int w, int h);
+	virtual void onMapReset();
+
+	//A* against jump points on random pairs of cells, and the cost of the fields, in a map of that size
+	static int benchmark(int size = 512, int num_paths = 1000, uint32 seed = 1); //returns the paths of jump points with another length than A*
+
+private:
+	struct sHeapNode {
+		uint32 f; //cost so far plus the estimation
+		int index; //of the cell
+	};
+
+	int width;
+	int height;
+	std::vector<uint8> terrain; //copy of the terrain and the water sources, to know what changed
+	std::vector<bool> water;
+	sField fields[NUM_FIELDS];
+
+	//search nodes, one per cell
+	std::vector<uint32> cost; //from the start, only valid if the node was opened in the current search
+	std::vector<int> parent;
+	std::vector<uint32> opened; //search that opened the node
+	std::vector<uint32> closed; //search that closed it
+	uint32 search;
+	std::vector<sHeapNode> heap;
+	std::vector<int> queue; //of the fields when all the terrains cost the same
+
+	void sync(int x, int y, int w, int h, bool& changed_terrain, bool& changed_water); //copies the cells
+	bool uniformCost() const;
+	void buildField(int field);
+	void open(int index, uint32 g, uint32 h, int from);
+	int jump(int x, int y, int dx, int dy, int target_x, int target_y) const;
+	void pushHeap(uint32 f, int index);
+	sHeapNode popHeap();
+};
+
+#endif
@@ -0,0 +1,179 @@
+#include "planner.h"
+
+#include <atomic>
+#include <cfloat>
+#include "includes.h"
+#include "simulation.h"
+
+Planner::Planner(ThreadPool* pool)
+{
+	this->pool = pool;
+	budget_ms = 100;
+	max_candidates = 0;
+	rollouts = 4;
+	horizon = 10;
+	exploration = 0.2f;
+	memset(&stats, 0, sizeof(stats));
+}
+
+//seed of a candidate or a rollout, mixed with the state of the world so every decision explores something different
+static uint32 mixSeed(const World& world, uint32 index, uint32 salt)
+{
+	uint32 key[3] = { world.random_state, index, salt };
+	uint32 seed = hashData(key, sizeof(key));
+	return seed ? seed : 1;
+}
+
+//plays the greedy policy in a clone, sometimes doing a random action or ending the turn early instead
+static void makeCandidate(const World& world, int player_index, float exploration, uint32 seed, std::vector<Planner::sStep>& steps)
+{
+	World clone(world);
+	GreedyPolicy greedy;
+	sCharacter& player = clone.players[player_index];
+	clone.setSeed(seed); //the clone's own generator is only used for the random choices, the turn is not passed here
+	for (int tries = 0; tries < 64 && player.alive && player.movements > 0; ++tries)
+	{
+		int action = WALK, param = 0;
+		if (clone.random() < exploration)
+		{
+			if (clone.randomInt() % 16 == 0)
+				break;
+			int choice = clone.randomInt() % 5; //interact or one of the four directions
+			if (choice == 0)
+				action = INTERACT;
+			else
+				param = choice;
+			if (!clone.applyAction(player_index, action, param))
+				continue;
+		}
+		else if (!greedy.step(clone, player_index, &action, &param))
+			break;
+		Planner::sStep step = { (uint8)action, (uint8)param };
+		steps.push_back(step);
+	}
+}
+
+//plan, the other players and the rest of the day, then some days of greedy play
+static float rollout(const World& world, int player, const Planner::sPlan& plan, int horizon, uint32 seed, long& turns)
+{
+	World clone(world);
+	GreedyPolicy greedy;
+	clone.setSeed(seed);
+	Planner::apply(clone, player, plan);
+	for (int i = 0; i < 3; ++i)
+		if (i != player && clone.players[i].alive)
+			greedy.playTurn(clone, i);
+	clone.passTurn();
+	turns += 1 + clone.simulate(horizon, &greedy);
+	return Planner::score(clone);
+}
+
+Planner::sPlan Planner::plan(const World& world, int player)
+{
+	Uint64 start = SDL_GetPerformanceCounter();
+	Uint64 deadline = start + (Uint64)(budget_ms * (double)SDL_GetPerformanceFrequency() / 1000.0);
+	std::atomic<int> evaluated(0), played(0);
+	std::atomic<long> turns(0);
+
+	//in batches so the time is checked often, the first candidate (plain greedy) is always evaluated
+	std::vector<sPlan> candidates;
+	int batch = (pool->num_threads + 1) * 2;
+	bool timeout = false;
+	while (!timeout && (!max_candidates || (int)candidates.size() < max_candidates))
+	{
+		int first = candidates.size();
+		int count = max_candidates ? min(batch, max_candidates - first) : batch;
+		candidates.resize(first + count);
+		pool->parallelFor(count, [&](int i) {
+			int index = first + i;
+			sPlan& candidate = candidates[index];
+			candidate.score = -FLT_MAX;
+			if (index && budget_ms && SDL_GetPerformanceCounter() > deadline)
+				return;
+			makeCandidate(world, player, index ? exploration : 0.0f, mixSeed(world, index, 0), candidate.steps);
+			long candidate_turns = 0;
+			float total = 0;
+			for (int r = 0; r < rollouts; ++r)
+				total += rollout(world, player, candidate, horizon, mixSeed(world, r, 1), candidate_turns);
+			candidate.score = total / max(rollouts, 1);
+			evaluated++;
+			played += rollouts;
+			turns += candidate_turns;
+		});
+		timeout = budget_ms && SDL_GetPerformanceCounter() > deadline;
+	}
+
+	//the first of the best, so ties keep the greedy plan
+	int best = 0;
+	for (int i = 1; i < candidates.size(); ++i)
+		if (candidates[i].score > candidates[best].score)
+			best = i;
+
+	stats.candidates = evaluated;
+	stats.rollouts = played;
+	stats.turns = turns;
+	stats.seconds = (SDL_GetPerformanceCounter() - start) / (double)SDL_GetPerformanceFrequency();
+	return candidates[best];
+}
+
+int Planner::apply(World& world, int player, const sPlan& plan)
+{
+	int done = 0;
+	for (int i = 0; i < plan.steps.size(); ++i)
+		if (world.applyAction(player, plan.steps[i].action, plan.steps[i].param))
+			done++;
+	return done;
+}
+
+float Planner::score(const World& world)
+{
+	//staying alive is worth more than anything, then the souls and then what helps to save more
+	float score = world.souls_saved * 2.0f;
+	for (int i = 0; i < 3; ++i)
+	{
+		const sCharacter& player = world.players[i];
+		if (!player.alive)
+			continue;
+		score += 100 + player.max_movements * 10 + (player.love + player.water) * 0.2f;
+		score += (player.wood + player.stone + player.goods) * 0.5f;
+	}
+	return score;
+}
+
+void Planner::benchmark(int days, uint32 seed, int budget_ms)
+{
+	std::cout << "Planner benchmark, " << days << " days, " << budget_ms << " ms per decision" << std::endl;
+
+	//same world played by the greedy policy, to compare
+	World greedy_world(seed);
+	GreedyPolicy greedy;
+	int greedy_days = greedy_world.simulate(days, &greedy);
+
+	World world(seed);
+	Planner planner;
+	planner.budget_ms = budget_ms;
+	int decisions = 0, played_days = 0;
+	long candidates = 0, played = 0, turns = 0;
+	double seconds = 0;
+	for (; played_days < days && !world.isGameOver(); ++played_days)
+	{
+		for (int i = 0; i < 3; ++i)
+		{
+			if (!world.players[i].alive)
+				continue;
+			apply(world, i, planner.plan(world, i));
+			decisions++;
+			candidates += planner.stats.candidates;
+			played += planner.stats.rollouts;
+			turns += planner.stats.turns;
+			seconds += planner.stats.seconds;
+		}
+		world.passTurn();
+	}
+
+	std::cout << " * " << decisions << " decisions in " << seconds << " s (" << planner.pool->num_threads + 1 << " threads), "
+		<< candidates / (double)max(decisions, 1) << " candidates per decision" << std::endl;
+	std::cout << " * " << played / seconds << " rollouts/s, " << turns / seconds << " turns/s" << std::endl;
+	std::cout << std::endl << "Planner: " << played_days << " days, souls saved: " << world.souls_saved << ", players alive: " << (int)world.alive_players << std::endl;
+	std::cout << "Greedy: " << greedy_days << " days, souls saved: " << greedy_world.souls_saved << ", players alive: " << (int)greedy_world.alive_players << std::endl;
+}
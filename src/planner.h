@@ -0,0 +1,55 @@
+/*	Planner: Monte Carlo search of what a player should do in the current day.
+	A candidate is a sequence of actions (walks and interactions, the turn ends when it ends) made by the greedy policy
+	with random deviations. Every candidate is played in clones of the world followed by some days of greedy play
+	(rollouts, with the same seeds for all the candidates so they are compared under the same luck), and the one with
+	the best average score wins. Candidates are evaluated in the thread pool till the time budget runs out.
+*/
+
+#ifndef PLANNER_H
+#define PLANNER_H
+
+#include <vector>
+#include "mygame.h"
+#include "threadpool.h"
+
+class Planner
+{
+public:
+	struct sStep {
+		uint8 action; //WALK or INTERACT
+		uint8 param; //direction of WALK
+	};
+
+	struct sPlan {
+		std::vector<sStep> steps; //empty means ending the turn now
+		float score; //average of its rollouts
+	};
+
+	struct sStats {
+		int candidates; //evaluated
+		int rollouts;
+		long turns; //days simulated in the rollouts
+		double seconds;
+	};
+
+	int budget_ms; //time for a decision, 0 for no limit
+	int max_candidates; //0 for no limit, with no time limit the plan only depends on the world
+	int rollouts; //per candidate
+	int horizon; //days played after the plan in every rollout
+	float exploration; //probability of a random action instead of the greedy one
+	ThreadPool* pool;
+	sStats stats; //of the last plan
+
+	Planner(ThreadPool* pool = ThreadPool::Get());
+
+	sPlan plan(const World& world, int player);
+	static int apply(World& world, int player, const sPlan& plan); //returns the steps that could be done
+
+	//souls saved, players alive and how well they are (love, water, movements) and their resources
+	static float score(const World& world);
+
+	//decisions per second and rollouts per second for a whole game played with the planner
+	static void benchmark(int days, uint32 seed = 1, int budget_ms = 100);
+};
+
+#endif
@@ -0,0 +1,215 @@
+#include "presenter.h"
+
+//buffer objects are not in the OpenGL 1.1 headers of Windows, they are imported at runtime
+REGISTER_GLEXT(void, glGenBuffers, GLsizei n, GLuint* buffers);
+REGISTER_GLEXT(void, glDeleteBuffers, GLsizei n, const GLuint* buffers);
+REGISTER_GLEXT(void, glBindBuffer, GLenum target, GLuint buffer);
+REGISTER_GLEXT(void, glBufferData, GLenum target, GLsizeiptr size, const void* data, GLenum usage);
+REGISTER_GLEXT(void*, glMapBuffer, GLenum target, GLenum access);
+REGISTER_GLEXT(GLboolean, glUnmapBuffer, GLenum target);
+
+#ifndef GL_PIXEL_UNPACK_BUFFER
+	#define GL_PIXEL_UNPACK_BUFFER 0x88EC
+#endif
+#ifndef GL_STREAM_DRAW
+	#define GL_STREAM_DRAW 0x88E0
+#endif
+#ifndef GL_WRITE_ONLY
+	#define GL_WRITE_ONLY 0x88B9
+#endif
+#ifndef GL_CLAMP_TO_EDGE
+	#define GL_CLAMP_TO_EDGE 0x812F
+#endif
+
+int Presenter::getIntegerScale(const Image& img, int window_width, int window_height)
+{
+	return min(window_width / (int)img.width, window_height / (int)img.height);
+}
+
+Presenter* Presenter::create(int type)
+{
+	Presenter* presenter = NULL;
+	if (type == OPENGL)
+		presenter = new GLPresenter();
+	else if (type == SOFTWARE)
+		presenter = new SoftwarePresenter();
+	else
+		presenter = new Presenter(HEADLESS);
+
+	if (!presenter->init())
+	{
+		std::cout << " * " << getTypeName(type) << " presenter not available, using software" << std::endl;
+		delete presenter;
+		presenter = new SoftwarePresenter();
+	}
+	std::cout << " * Presenter: " << getTypeName(presenter->type) << std::endl;
+	return presenter;
+}
+
+int Presenter::parseType(const char* name)
+{
+	std::string str = name;
+	if (str == "gl" || str == "opengl")
+		return OPENGL;
+	if (str == "software")
+		return SOFTWARE;
+	if (str == "none" || str == "headless")
+		return HEADLESS;
+	return -1;
+}
+
+const char* Presenter::getTypeName(int type)
+{
+	switch (type)
+	{
+		case OPENGL: return "OpenGL";
+		case SOFTWARE: return "software";
+		default: return "headless";
+	}
+}
+
+//SOFTWARE *************************
+
+SoftwarePresenter::SoftwarePresenter() : Presenter(SOFTWARE)
+{
+	last_scale = 0;
+}
+
+void SoftwarePresenter::present(const Image& img, int window_width, int window_height)
+{
+	frames++;
+
+	//biggest integer scale that fits the window, so every pixel becomes a square of the same size
+	int scale = getIntegerScale(img, window_width, window_height);
+	if (scale < 1)
+	{
+		finalframe = img;
+		finalframe.scale( window_width, window_height );
+	}
+	else
+	{
+		if (finalframe.width != window_width || finalframe.height != window_height || scale != last_scale)
+		{
+			finalframe.resize(window_width, window_height);
+			finalframe.fill(Color::BLACK);
+		}
+		finalframe.drawImage(img, (window_width - img.width * scale) / 2, (window_height - img.height * scale) / 2, img.width * scale, img.height * scale);
+	}
+	last_scale = scale;
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	if (1) //flip
+	{
+		glRasterPos2f(-1, 1);
+		glPixelZoom(1, -1);
+	}
+
+	glDrawPixels(finalframe.width, finalframe.height, GL_RGBA, GL_UNSIGNED_BYTE, finalframe.pixels);
+}
+
+//OPENGL *************************
+
+GLPresenter::GLPresenter() : Presenter(OPENGL)
+{
+	texture = 0;
+	pbos[0] = pbos[1] = 0;
+	current_pbo = 0;
+	width = height = 0;
+}
+
+GLPresenter::~GLPresenter()
+{
+	if (pbos[0])
+		glDeleteBuffers(2, pbos);
+	if (texture)
+		glDeleteTextures(1, &texture);
+}
+
+bool GLPresenter::init()
+{
+	IMPORT_GLEXT(glGenBuffers);
+	IMPORT_GLEXT(glDeleteBuffers);
+	IMPORT_GLEXT(glBindBuffer);
+	IMPORT_GLEXT(glBufferData);
+	IMPORT_GLEXT(glMapBuffer);
+	IMPORT_GLEXT(glUnmapBuffer);
+	if (!glGenBuffers || !glDeleteBuffers || !glBindBuffer || !glBufferData || !glMapBuffer || !glUnmapBuffer)
+		return false;
+
+	glGenTextures(1, &texture);
+	glGenBuffers(2, pbos);
+	return texture != 0 && pbos[0] != 0;
+}
+
+void GLPresenter::resize(unsigned int width, unsigned int height)
+{
+	this->width = width;
+	this->height = height;
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST); //pixelated
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+}
+
+void GLPresenter::present(const Image& img, int window_width, int window_height)
+{
+	frames++;
+	if (img.width != width || img.height != height)
+		resize(img.width, img.height);
+
+	//copy the pixels to a pixel buffer, reallocating it first so the driver does not wait for the previous upload
+	unsigned int size = width * height * sizeof(Color);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbos[current_pbo]);
+	glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+	void* data = glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+	if (data)
+	{
+		memcpy(data, img.pixels, size);
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+	}
+	else
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	//the texture is filled from the buffer (the GPU copies it asynchronously) or directly from memory if mapping failed
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, data ? NULL : img.pixels);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	current_pbo = 1 - current_pbo;
+
+	//integer scale when possible, otherwise as big as possible keeping the aspect ratio
+	int scale = getIntegerScale(img, window_width, window_height);
+	int w = width * scale;
+	int h = height * scale;
+	if (scale < 1)
+	{
+		float f = min(window_width / (float)width, window_height / (float)height);
+		w = width * f;
+		h = height * f;
+	}
+	glViewport((window_width - w) / 2, (window_height - h) / 2, w, h);
+
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_BLEND);
+	glDisable(GL_CULL_FACE);
+	glMatrixMode(GL_PROJECTION);
+	glLoadIdentity();
+	glMatrixMode(GL_MODELVIEW);
+	glLoadIdentity();
+	glEnable(GL_TEXTURE_2D);
+	glColor4f(1, 1, 1, 1);
+
+	//first row of the image is the top one
+	glBegin(GL_QUADS);
+	glTexCoord2f(0, 1); glVertex2f(-1, -1);
+	glTexCoord2f(1, 1); glVertex2f(1, -1);
+	glTexCoord2f(1, 0); glVertex2f(1, 1);
+	glTexCoord2f(0, 0); glVertex2f(-1, 1);
+	glEnd();
+
+	glDisable(GL_TEXTURE_2D);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glViewport(0, 0, window_width, window_height);
+}
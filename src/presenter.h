@@ -0,0 +1,68 @@
+/*	Presenter: sends the framebuffer to the window once per frame.
+	The OpenGL one uploads only the framebuffer (through a pixel buffer) to a texture and lets the GPU scale it,
+	the software one scales it in the CPU and uses glDrawPixels (old drivers), and the headless one does nothing
+	so the game can run where there is no GPU.
+*/
+
+#ifndef PRESENTER_H
+#define PRESENTER_H
+
+#include "includes.h"
+#include "image.h"
+
+class Presenter
+{
+public:
+	enum {
+		HEADLESS = 0,
+		SOFTWARE,
+		OPENGL
+	};
+
+	int type;
+	unsigned int frames; //frames presented
+
+	Presenter(int type) { this->type = type; frames = 0; }
+	virtual ~Presenter() {}
+
+	virtual bool init() { return true; } //false if the backend can not work in this machine
+	virtual void present(const Image& img, int window_width, int window_height) { frames++; }
+
+	//biggest integer scale of the image that fits the window (0 if it does not fit)
+	static int getIntegerScale(const Image& img, int window_width, int window_height);
+
+	//creates the backend, falls back to software if OpenGL is not available
+	static Presenter* create(int type);
+	static int parseType(const char* name); //"gl", "software" or "none", -1 if unknown
+	static const char* getTypeName(int type);
+};
+
+class SoftwarePresenter : public Presenter
+{
+public:
+	Image finalframe; //framebuffer scaled to the window
+	int last_scale;
+
+	SoftwarePresenter();
+	virtual void present(const Image& img, int window_width, int window_height);
+};
+
+class GLPresenter : public Presenter
+{
+public:
+	GLuint texture;
+	GLuint pbos[2]; //written alternately, so we never wait for the upload of the previous frame
+	int current_pbo;
+	unsigned int width; //size of the texture
+	unsigned int height;
+
+	GLPresenter();
+	virtual ~GLPresenter();
+	virtual bool init();
+	virtual void present(const Image& img, int window_width, int window_height);
+
+private:
+	void resize(unsigned int width, unsigned int height);
+};
+
+#endif
@@ -0,0 +1,255 @@
+#include "regions.h"
+
+#include <algorithm>
+#include "includes.h"
+
+MapRegions::MapRegions(World* world, bool include_water)
+{
+	this->world = world;
+	connects[TILE_WATER] = include_water;
+	connects[TILE_SAND] = true;
+	connects[TILE_GRASS] = true;
+	connects[TILE_ROCK] = false;
+	width = height = 0;
+	num_regions = 0;
+	valid = false;
+	world->addListener(this);
+}
+
+MapRegions::~MapRegions()
+{
+	world->removeListener(this);
+}
+
+MapRegions::sCellInfo MapRegions::getCellInfo(const sCell& cell) const
+{
+	sCellInfo info;
+	info.connected = connects[cell.terrain & 3];
+	info.blessed = cell.blessed;
+	info.people = cell.people;
+	return info;
+}
+
+int MapRegions::find(int region)
+{
+	while (parents[region] != region)
+	{
+		parents[region] = parents[parents[region]]; //path halving
+		region = parents[region];
+	}
+	return region;
+}
+
+//the smaller region joins the bigger one, returns the one that remains
+int MapRegions::unite(int a, int b)
+{
+	a = find(a);
+	b = find(b);
+	if (a == b)
+		return a;
+	if (regions[a].cells < regions[b].cells)
+		std::swap(a, b);
+	parents[b] = a;
+	regions[a].cells += regions[b].cells;
+	regions[a].people += regions[b].people;
+	regions[a].blessed += regions[b].blessed;
+	num_regions--;
+	return a;
+}
+
+int MapRegions::addRegion()
+{
+	sRegion region = { 0, 0, 0 };
+	parents.push_back(parents.size());
+	regions.push_back(region);
+	num_regions++;
+	return regions.size() - 1;
+}
+
+void MapRegions::addCell(sRegion& region, const sCellInfo& info, int sign)
+{
+	region.cells += sign;
+	region.people += info.people * sign;
+	if (info.blessed)
+		region.blessed += sign;
+}
+
+void MapRegions::rebuild()
+{
+	const Matrix<sCell>& gamemap = world->gamemap;
+	width = gamemap.width;
+	height = gamemap.height;
+	int size = width * height;
+	cells.resize(size);
+	labels.assign(size, -1);
+	parents.clear();
+	regions.clear();
+	num_regions = 0;
+
+	//first pass: a cell continues the region of its left neighbour and joins the one above
+	for (int y = 0; y < height; ++y)
+		for (int x = 0; x < width; ++x)
+		{
+			int index = y * width + x;
+			sCellInfo& info = cells[index];
+			info = getCellInfo(gamemap.data[index]);
+			if (!info.connected)
+				continue;
+			int label = x > 0 && labels[index - 1] != -1 ? labels[index - 1] : addRegion();
+			if (y > 0 && labels[index - width] != -1)
+				label = unite(label, labels[index - width]);
+			labels[index] = label;
+			addCell(regions[find(label)], info, 1);
+		}
+
+	//second pass: consecutive labels, so the regions are 0...num_regions - 1 and every cell points to its root
+	std::vector<int> compact(regions.size(), -1);
+	std::vector<sRegion> roots;
+	for (int i = 0; i < size; ++i)
+	{
+		if (labels[i] == -1)
+			continue;
+		int root = find(labels[i]);
+		if (compact[root] == -1)
+		{
+			compact[root] = roots.size();
+			roots.push_back(regions[root]);
+		}
+		labels[i] = compact[root];
+	}
+	regions.swap(roots);
+	parents.resize(regions.size());
+	for (int i = 0; i < parents.size(); ++i)
+		parents[i] = i;
+	num_regions = regions.size();
+	valid = true;
+}
+
+int MapRegions::getRegion(int x, int y)
+{
+	update();
+	if (x < 0 || y < 0 || x >= width || y >= height)
+		return -1;
+	int label = labels[y * width + x];
+	return label == -1 ? -1 : find(label);
+}
+
+void MapRegions::onCellsChanged(int x, int y, int w, int h)
+{
+	if (!valid)
+		return;
+	const Matrix<sCell>& gamemap = world->gamemap;
+	if (gamemap.width != width || gamemap.height != height)
+	{
+		valid = false;
+		return;
+	}
+
+	//a cell that stops connecting could split its region, that needs everything
+	for (int cy = y; cy < y + h; ++cy)
+		for (int cx = x; cx < x + w; ++cx)
+		{
+			int index = cy * width + cx;
+			if (cells[index].connected && !connects[gamemap.data[index].terrain & 3])
+			{
+				valid = false;
+				return;
+			}
+		}
+
+	for (int cy = y; cy < y + h; ++cy)
+		for (int cx = x; cx < x + w; ++cx)
+		{
+			int index = cy * width + cx;
+			sCellInfo& info = cells[index];
+			sCellInfo new_info = getCellInfo(gamemap.data[index]);
+			if (info.connected)
+			{
+				//only the counters change
+				sRegion& region = regions[find(labels[index])];
+				addCell(region, info, -1);
+				addCell(region, new_info, 1);
+				info = new_info;
+				continue;
+			}
+			info = new_info;
+			if (!info.connected)
+				continue;
+
+			//a new cell, its own region merged with the ones around
+			int label = addRegion();
+			addCell(regions[label], info, 1);
+			const int offsets[4][2] = { { -1, 0 }, { 1, 0 }, { 0, -1 }, { 0, 1 } };
+			for (int i = 0; i < 4; ++i)
+			{
+				int nx = cx + offsets[i][0];
+				int ny = cy + offsets[i][1];
+				if (nx < 0 || ny < 0 || nx >= width || ny >= height || labels[ny * width + nx] == -1 || !cells[ny * width + nx].connected)
+					continue;
+				label = unite(label, labels[ny * width + nx]);
+			}
+			labels[index] = label;
+		}
+}
+
+int MapRegions::benchmark(int size, uint32 seed)
+{
+	std::cout << "Regions benchmark, map of " << size << "x" << size << std::endl;
+
+	World world(seed);
+	world.newMap(size, size);
+	MapRegions walkable(&world);
+	MapRegions islands(&world, false);
+
+	Uint64 start = SDL_GetPerformanceCounter();
+	walkable.rebuild();
+	islands.rebuild();
+	double seconds = (SDL_GetPerformanceCounter() - start) / (double)SDL_GetPerformanceFrequency();
+	std::cout << " * Full labelling: " << seconds * 500.0 << " ms per map, " << walkable.getNumRegions() << " walkable regions, "
+		<< islands.getNumRegions() << " islands" << std::endl;
+
+	//the biggest islands
+	std::vector<std::pair<int, int> > sizes;
+	for (int i = 0; i < islands.regions.size(); ++i)
+		if (islands.find(i) == i)
+			sizes.push_back(std::make_pair(islands.regions[i].cells, i));
+	std::sort(sizes.rbegin(), sizes.rend());
+	for (int i = 0; i < sizes.size() && i < 5; ++i)
+	{
+		const sRegion& region = islands.regions[sizes[i].second];
+		std::cout << "   island of " << region.cells << " cells, " << region.people << " people" << std::endl;
+	}
+
+	//connectivity queries
+	int queries = 1000000, connected = 0;
+	start = SDL_GetPerformanceCounter();
+	for (int i = 0; i < queries; ++i)
+	{
+		uint32 a = world.randomInt(), b = world.randomInt();
+		if (islands.sameRegion(a % size, (a / size) % size, b % size, (b / size) % size))
+			connected++;
+	}
+	seconds = (SDL_GetPerformanceCounter() - start) / (double)SDL_GetPerformanceFrequency();
+	std::cout << " * sameRegion: " << seconds * 1000000000.0 / queries << " ns per query (" << connected * 100.0 / queries << "% in the same island)" << std::endl;
+
+	//joining cells (sand in the water, like building) is incremental, removing them rebuilds
+	int changes = 1000;
+	start = SDL_GetPerformanceCounter();
+	for (int i = 0; i < changes; ++i)
+	{
+		int x = world.randomInt() % size, y = world.randomInt() % size;
+		sCell& cell = world.gamemap.get(x, y);
+		if (cell.terrain != TILE_WATER)
+			continue;
+		cell.terrain = TILE_SAND;
+		world.notifyCellsChanged(x, y);
+	}
+	int incremental_regions = islands.getNumRegions();
+	seconds = (SDL_GetPerformanceCounter() - start) / (double)SDL_GetPerformanceFrequency();
+	std::cout << " * Joining cells: " << seconds * 1000000.0 / changes << " us per change (2 maps), " << incremental_regions << " islands after the changes" << std::endl;
+	islands.rebuild();
+	if (islands.getNumRegions() == incremental_regions)
+		return 0;
+	std::cout << "   ERROR: rebuilding gives " << islands.getNumRegions() << " islands" << std::endl;
+	return 1;
+}
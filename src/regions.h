@@ -0,0 +1,67 @@
+/*	MapRegions: connected regions of the map (cells joined by the terrains that connect), like the islands.
+	Built row by row with a union-find (a cell joins the region of its left neighbour and merges with the one above),
+	so asking if two cells are connected is comparing two labels instead of a flood fill.
+	It is a map listener: cells that become walkable join their neighbours' regions (merging them), and only a cell
+	that stops connecting (it could split a region) makes it rebuild everything the next time it is asked.
+	Every region also counts its cells, people and blessed cells.
+*/
+
+#ifndef REGIONS_H
+#define REGIONS_H
+
+#include <vector>
+#include "mygame.h"
+
+class MapRegions : public MapListener
+{
+public:
+	struct sRegion {
+		int cells;
+		int people;
+		int blessed; //cells
+	};
+
+	World* world;
+	bool connects[4]; //terrains that belong to a region, by default the ones a player can walk (not rocks)
+
+	MapRegions(World* world, bool include_water = true); //without water the regions are the islands
+	~MapRegions();
+
+	int getRegion(int x, int y); //-1 for cells that do not connect
+	bool sameRegion(int x, int y, int x2, int y2) { int region = getRegion(x, y); return region != -1 && region == getRegion(x2, y2); }
+	const sRegion& getRegionInfo(int region) { update(); return regions[find(region)]; }
+	int getNumRegions() { update(); return num_regions; }
+
+	void rebuild();
+	virtual void onCellsChanged(int x, int y, int w, int h);
+	virtual void onMapReset() { valid = false; }
+
+	//full labelling, incremental changes and queries, in a map of that size
+	static int benchmark(int size = 512, uint32 seed = 1); //returns 1 if rebuilding does not give the islands joined incrementally
+
+private:
+	//state of every cell the last time it was counted, to know what to subtract when it changes
+	struct sCellInfo {
+		bool connected;
+		bool blessed;
+		uint8 people;
+	};
+
+	int width;
+	int height;
+	bool valid; //false after a change that could split a region
+	int num_regions;
+	std::vector<int> labels; //per cell, a region that may have been merged (find gives the current one)
+	std::vector<int> parents; //union-find of the regions, the root has the sRegion
+	std::vector<sRegion> regions;
+	std::vector<sCellInfo> cells;
+
+	void update() { if (!valid) rebuild(); }
+	sCellInfo getCellInfo(const sCell& cell) const;
+	int find(int region);
+	int unite(int a, int b);
+	int addRegion();
+	void addCell(sRegion& region, const sCellInfo& info, int sign);
+};
+
+#endif
@@ -0,0 +1,165 @@
+#include "replay.h"
+#include "input.h"
+#include "clock.h"
+#include "mygame.h"
+
+#include <cstdio>
+
+InputRecording::InputRecording()
+{
+	memset(&header, 0, sizeof(header));
+	memset(keystate, 0, sizeof(keystate));
+	read_pos = 0;
+}
+
+void InputRecording::start(uint32 seed)
+{
+	header.seed = seed;
+	memset(keystate, 0, sizeof(keystate));
+	read_pos = 0;
+	Clock::Get()->reset();
+
+	//the map and every random event depend only on the seed (rand is still used by some animations)
+	srand(seed);
+	world.setSeed(seed);
+	world.restart();
+	Stage::current = NULL; //enters again, so its timers start with the virtual clock
+	Stage::changeStage(STAGE_INTRO);
+}
+
+void InputRecording::recordFrame(int elapsed_ms)
+{
+	sFrame frame;
+	frame.elapsed = clamp(elapsed_ms, 0, 0xFFFF);
+	const GamepadState& pad = Input::gamepads[0];
+	frame.buttons = 0;
+	for (int i = 0; i < 16; ++i)
+		if (pad.button[i])
+			frame.buttons |= 1 << i;
+	frame.hat = pad.hat;
+	frame.direction = pad.direction;
+
+	//only the keys that changed
+	std::vector<uint16> keys;
+	for (int i = 0; i < SDL_NUM_SCANCODES; ++i)
+		if ((Input::keystate[i] != 0) != (keystate[i] != 0))
+		{
+			keys.push_back(i);
+			keystate[i] = Input::keystate[i] ? 1 : 0;
+		}
+	frame.num_keys = keys.size();
+
+	data.insert(data.end(), (uint8*)&frame, (uint8*)(&frame + 1));
+	if (!keys.empty())
+		data.insert(data.end(), (uint8*)&keys[0], (uint8*)(&keys[0] + keys.size()));
+	header.num_frames++;
+}
+
+void InputRecording::finish()
+{
+	header.final_hash = hashWorld(world);
+	header.final_day = world.day;
+	header.final_souls = world.souls_saved;
+}
+
+bool InputRecording::save(const char* filename)
+{
+	memcpy(header.magic, "RPLY", 4);
+	header.version = REPLAY_VERSION;
+	FILE* f = fopen(filename, "wb");
+	if (!f)
+	{
+		std::cerr << "Cannot write recording: " << filename << std::endl;
+		return false;
+	}
+	bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+	if (ok && !data.empty())
+		ok = fwrite(&data[0], data.size(), 1, f) == 1;
+	fclose(f);
+	return ok;
+}
+
+bool InputRecording::load(const char* filename)
+{
+	FILE* f = fopen(filename, "rb");
+	if (!f)
+	{
+		std::cerr << "Recording not found: " << filename << std::endl;
+		return false;
+	}
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	bool ok = size >= (long)sizeof(header) && fread(&header, sizeof(header), 1, f) == 1;
+	if (ok && memcmp(header.magic, "RPLY", 4) == 0 && header.version != REPLAY_VERSION)
+	{
+		//it would replay, but not as it was played
+		std::cerr << "Recording made with another version of the game (" << header.version << ", this one plays " << REPLAY_VERSION << "): " << filename << std::endl;
+		fclose(f);
+		return false;
+	}
+	if (ok && memcmp(header.magic, "RPLY", 4) == 0)
+	{
+		data.resize(size - sizeof(header));
+		ok = data.empty() || fread(&data[0], data.size(), 1, f) == 1;
+	}
+	else
+		ok = false;
+	fclose(f);
+	if (!ok)
+		std::cerr << "Recording not valid: " << filename << std::endl;
+	read_pos = 0;
+	return ok;
+}
+
+bool InputRecording::nextFrame(sFrame& frame)
+{
+	if (read_pos + sizeof(sFrame) > data.size())
+		return false;
+	memcpy(&frame, &data[read_pos], sizeof(sFrame));
+	read_pos += sizeof(sFrame);
+	if (read_pos + frame.num_keys * sizeof(uint16) > data.size())
+		return false;
+	frame_keys.resize(frame.num_keys);
+	if (frame.num_keys)
+		memcpy(&frame_keys[0], &data[read_pos], frame.num_keys * sizeof(uint16));
+	read_pos += frame.num_keys * sizeof(uint16);
+
+	//same as Input::update does with a real gamepad
+	GamepadState& pad = Input::gamepads[0];
+	memcpy(pad.prev_button, pad.button, sizeof(pad.button));
+	for (int i = 0; i < 16; ++i)
+		pad.button[i] = (frame.buttons >> i) & 1;
+	pad.hat = (HATState)frame.hat;
+	pad.prev_direction = pad.direction;
+	pad.direction = frame.direction;
+	return true;
+}
+
+void InputRecording::applyKeys(const sFrame& frame)
+{
+	for (int i = 0; i < frame_keys.size(); ++i)
+		if (frame_keys[i] < SDL_NUM_SCANCODES)
+			keystate[frame_keys[i]] = !keystate[frame_keys[i]];
+	Clock::Get()->advance(frame.elapsed);
+}
+
+bool InputRecording::verify()
+{
+	uint32 hash = hashWorld(world);
+	bool ok = hash == header.final_hash && world.day == header.final_day && world.souls_saved == header.final_souls;
+	std::cout << " * Day: " << (int)world.day << " Souls saved: " << world.souls_saved << " Hash: " << hash << std::endl;
+	if (ok)
+		std::cout << " * Replay matches the recording" << std::endl;
+	else
+		std::cout << " * Replay DOES NOT match the recording (day " << header.final_day << ", souls saved " << header.final_souls << ", hash " << header.final_hash << ")" << std::endl;
+	return ok;
+}
+
+uint32 InputRecording::hashWorld(const World& world)
+{
+	const Matrix<sCell>& gamemap = world.gamemap;
+	int32 values[3] = { world.souls_saved, world.day, world.alive_players };
+	uint32 hash = hashData(values, sizeof(values));
+	return hashData(gamemap.data, gamemap.width * gamemap.height * sizeof(sCell), hash);
+}
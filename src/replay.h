@@ -0,0 +1,67 @@
+/*	InputRecording: records the input of every frame (keys that changed, first gamepad and elapsed time)
+	and the random seed, so a whole session can be replayed later exactly as it was played.
+	Frames store the game time advanced (see Clock), so a replay moves the clock exactly as it moved
+	while recording (fast-forward and pauses included) and the timers of the stages give the same results.
+	The final state of the world is stored too, to check the replay reaches the same result.
+*/
+
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <vector>
+#include "includes.h"
+#include "framework.h"
+
+class World;
+
+#define REPLAY_VERSION 5 //2: sFrame.elapsed is game time (see Clock), not real time, 3: xorshift random numbers and 16 bits day, 4: passTurn visits the cells by rows, 5: no undo entries for actions that change nothing
+
+class InputRecording
+{
+public:
+	struct sHeader {
+		char magic[4]; //"RPLY"
+		uint32 version;
+		uint32 seed;
+		uint32 num_frames;
+		uint32 final_hash; //hashWorld at the end of the recording
+		uint32 final_day;
+		int32 final_souls;
+	};
+
+	//followed by num_keys scancodes (uint16) that changed since the previous frame
+	struct sFrame {
+		uint16 elapsed; //milliseconds
+		uint16 buttons; //one bit per button of the first gamepad
+		uint8 hat;
+		uint8 direction;
+		uint16 num_keys;
+	};
+
+	sHeader header;
+	std::vector<uint8> data; //frames
+	unsigned int read_pos;
+	Uint8 keystate[SDL_NUM_SCANCODES]; //keys of the last frame recorded or replayed
+
+	InputRecording();
+
+	//seeds the random generator, restarts the world and the clock, call it before the first frame (also before replaying)
+	void start(uint32 seed);
+	void recordFrame(int elapsed_ms); //reads the current input, elapsed_ms of game time
+	void finish(); //stores the final state of the world
+
+	bool save(const char* filename);
+	bool load(const char* filename);
+
+	//replay: nextFrame reads a frame and applies the gamepad, applyKeys sets the keys and the clock of that frame
+	bool nextFrame(sFrame& frame);
+	void applyKeys(const sFrame& frame);
+	bool verify(); //prints the final state of the world and checks it is the recorded one
+
+	static uint32 hashWorld(const World& world);
+
+private:
+	std::vector<uint16> frame_keys; //keys of the frame being replayed
+};
+
+#endif
@@ -0,0 +1,246 @@
+#include "savegame.h"
+
+#include <cstdio>
+
+//cell flags stored in the FLAGS plane
+enum {
+	FLAG_ROAD = 1,
+	FLAG_DISCOVERED = 2,
+	FLAG_BLESSED = 4
+};
+
+void SaveGame::encodeRLE(const uint8* data, unsigned int size, std::vector<uint8>& out)
+{
+	unsigned int pos = 0;
+	while (pos < size)
+	{
+		//length of the run starting here
+		unsigned int run = 1;
+		while (pos + run < size && run < 130 && data[pos + run] == data[pos])
+			run++;
+		if (run >= 3)
+		{
+			out.push_back((uint8)(run + 125));
+			out.push_back(data[pos]);
+			pos += run;
+			continue;
+		}
+
+		//literals till the next run of three or more
+		unsigned int start = pos;
+		while (pos < size && pos - start < 128)
+		{
+			if (pos + 2 < size && data[pos] == data[pos + 1] && data[pos] == data[pos + 2])
+				break;
+			pos++;
+		}
+		out.push_back((uint8)(pos - start - 1));
+		out.insert(out.end(), data + start, data + pos);
+	}
+}
+
+bool SaveGame::decodeRLE(const uint8* data, unsigned int size, uint8* out, unsigned int out_size)
+{
+	unsigned int pos = 0;
+	unsigned int out_pos = 0;
+	while (pos < size)
+	{
+		uint8 control = data[pos++];
+		if (control < 128)
+		{
+			unsigned int count = control + 1;
+			if (pos + count > size || out_pos + count > out_size)
+				return false;
+			memcpy(out + out_pos, data + pos, count);
+			pos += count;
+			out_pos += count;
+		}
+		else
+		{
+			unsigned int count = control - 125;
+			if (pos >= size || out_pos + count > out_size)
+				return false;
+			memset(out + out_pos, data[pos++], count);
+			out_pos += count;
+		}
+	}
+	return out_pos == out_size;
+}
+
+static void addSection(std::vector<uint8>& buffer, uint32 id, const uint8* data, unsigned int size, unsigned int raw_size)
+{
+	SaveGame::sSectionHeader header;
+	header.id = id;
+	header.size = size;
+	header.raw_size = raw_size;
+	header.checksum = hashData(data, size);
+	const uint8* h = (const uint8*)&header;
+	buffer.insert(buffer.end(), h, h + sizeof(header));
+	buffer.insert(buffer.end(), data, data + size);
+}
+
+static void addPlane(std::vector<uint8>& buffer, uint32 id, const std::vector<uint8>& plane)
+{
+	std::vector<uint8> packed;
+	packed.reserve(plane.size() / 4);
+	SaveGame::encodeRLE(&plane[0], plane.size(), packed);
+	addSection(buffer, id, &packed[0], packed.size(), plane.size());
+}
+
+bool SaveGame::save(const World& world, const char* filename)
+{
+	const Matrix<sCell>& gamemap = world.gamemap;
+	unsigned int num_cells = gamemap.width * gamemap.height;
+	if (!num_cells)
+		return false;
+
+	std::vector<uint8> buffer;
+	sSaveHeader header;
+	memcpy(header.magic, "SAVE", 4);
+	header.version = SAVEGAME_VERSION;
+	header.num_sections = 7;
+	header.reserved = 0;
+	buffer.insert(buffer.end(), (uint8*)&header, (uint8*)(&header + 1));
+
+	sWorldState state;
+	memset(&state, 0, sizeof(state));
+	state.width = gamemap.width;
+	state.height = gamemap.height;
+	state.souls_saved = world.souls_saved;
+	state.day = world.day;
+	state.selected_player = world.selected_player;
+	state.alive_players = world.alive_players;
+	state.map_fog = world.map_fog;
+	state.random_state = world.random_state;
+	addSection(buffer, SECTION_WORLD, (uint8*)&state, sizeof(state), sizeof(state));
+	addSection(buffer, SECTION_PLAYERS, (uint8*)world.players, sizeof(world.players), sizeof(world.players));
+
+	//one plane per field, they compress much better than the cells interleaved
+	std::vector<uint8> planes[5];
+	for (int i = 0; i < 5; ++i)
+		planes[i].resize(num_cells);
+	for (unsigned int i = 0; i < num_cells; ++i)
+	{
+		const sCell& cell = gamemap.data[i];
+		planes[0][i] = cell.terrain;
+		planes[1][i] = cell.item;
+		planes[2][i] = (cell.road ? FLAG_ROAD : 0) | (cell.discovered ? FLAG_DISCOVERED : 0) | (cell.blessed ? FLAG_BLESSED : 0);
+		planes[3][i] = cell.people;
+		planes[4][i] = cell.goods;
+	}
+	for (int i = 0; i < 5; ++i)
+		addPlane(buffer, SECTION_TERRAIN + i, planes[i]);
+
+	FILE* f = fopen(filename, "wb");
+	if (!f)
+	{
+		std::cerr << "Cannot write savegame: " << filename << std::endl;
+		return false;
+	}
+	bool ok = fwrite(&buffer[0], buffer.size(), 1, f) == 1;
+	fclose(f);
+	return ok;
+}
+
+bool SaveGame::load(World& world, const char* filename)
+{
+	//the whole file in a single read, then everything is validated before touching the world
+	FILE* f = fopen(filename, "rb");
+	if (!f)
+		return false;
+	fseek(f, 0, SEEK_END);
+	long file_size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	std::vector<uint8> buffer(file_size > 0 ? file_size : 0);
+	bool read_ok = file_size > 0 && fread(&buffer[0], file_size, 1, f) == 1;
+	fclose(f);
+	if (!read_ok || buffer.size() < sizeof(sSaveHeader))
+	{
+		std::cerr << "Savegame not valid: " << filename << std::endl;
+		return false;
+	}
+
+	sSaveHeader header;
+	memcpy(&header, &buffer[0], sizeof(header));
+	if (memcmp(header.magic, "SAVE", 4) != 0 || header.version != SAVEGAME_VERSION)
+	{
+		std::cerr << "Savegame version not supported: " << filename << std::endl;
+		return false;
+	}
+
+	//find the sections
+	const uint8* sections[SECTION_GOODS + 1] = { NULL };
+	sSectionHeader section_headers[SECTION_GOODS + 1];
+	unsigned int pos = sizeof(sSaveHeader);
+	for (unsigned int i = 0; i < header.num_sections; ++i)
+	{
+		sSectionHeader section;
+		if (pos + sizeof(section) > buffer.size())
+			break;
+		memcpy(&section, &buffer[pos], sizeof(section));
+		pos += sizeof(section);
+		if (section.size > buffer.size() - pos || hashData(&buffer[pos], section.size) != section.checksum)
+		{
+			std::cerr << "Savegame section " << section.id << " is corrupted: " << filename << std::endl;
+			return false;
+		}
+		if (section.id <= SECTION_GOODS) //unknown sections are skipped
+		{
+			sections[section.id] = &buffer[pos];
+			section_headers[section.id] = section;
+		}
+		pos += section.size;
+	}
+	for (int i = SECTION_WORLD; i <= SECTION_GOODS; ++i)
+		if (!sections[i])
+		{
+			std::cerr << "Savegame section " << i << " is missing: " << filename << std::endl;
+			return false;
+		}
+
+	sWorldState state;
+	if (section_headers[SECTION_WORLD].size != sizeof(state) || section_headers[SECTION_PLAYERS].size != sizeof(world.players))
+		return false;
+	memcpy(&state, sections[SECTION_WORLD], sizeof(state));
+	unsigned int num_cells = state.width * state.height;
+	if (!num_cells || state.width > 4096 || state.height > 4096 || state.selected_player >= 3)
+		return false;
+
+	std::vector<uint8> planes[5];
+	for (int i = 0; i < 5; ++i)
+	{
+		const sSectionHeader& section = section_headers[SECTION_TERRAIN + i];
+		planes[i].resize(num_cells);
+		if (section.raw_size != num_cells || !decodeRLE(sections[SECTION_TERRAIN + i], section.size, &planes[i][0], num_cells))
+		{
+			std::cerr << "Savegame map is corrupted: " << filename << std::endl;
+			return false;
+		}
+	}
+
+	//everything is valid, apply it
+	world.gamemap.resize(state.width, state.height);
+	for (unsigned int i = 0; i < num_cells; ++i)
+	{
+		sCell& cell = world.gamemap.data[i];
+		cell.terrain = planes[0][i];
+		cell.item = planes[1][i];
+		cell.road = (planes[2][i] & FLAG_ROAD) != 0;
+		cell.discovered = (planes[2][i] & FLAG_DISCOVERED) != 0;
+		cell.blessed = (planes[2][i] & FLAG_BLESSED) != 0;
+		cell.people = planes[3][i];
+		cell.goods = planes[4][i];
+	}
+	memcpy(world.players, sections[SECTION_PLAYERS], sizeof(world.players));
+	world.day = state.day;
+	world.selected_player = state.selected_player;
+	world.alive_players = state.alive_players;
+	world.souls_saved = state.souls_saved;
+	world.map_fog = state.map_fog != 0;
+	world.setSeed(state.random_state);
+
+	world.findChurches();
+	world.notifyMapReset();
+	campos = world.players[world.selected_player].pos;
+	return true;
+}
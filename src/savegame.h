@@ -0,0 +1,62 @@
+/*	SaveGame: stores the state of the World in a small file.
+	The file is a header followed by sections, every one with its own checksum. The map is stored as
+	separate planes (terrain, items, flags, people, goods) compressed with run-length encoding,
+	because every plane alone has long runs of the same value.
+*/
+
+#ifndef SAVEGAME_H
+#define SAVEGAME_H
+
+#include <vector>
+#include "mygame.h"
+
+#define SAVEGAME_VERSION 3 //2: random state of the world, 3: 16 bits day
+
+class SaveGame
+{
+public:
+	struct sSaveHeader {
+		char magic[4]; //"SAVE"
+		uint32 version;
+		uint32 num_sections;
+		uint32 reserved;
+	};
+
+	struct sSectionHeader {
+		uint32 id; //SECTION_*
+		uint32 size; //stored bytes after this header
+		uint32 raw_size; //bytes once decompressed
+		uint32 checksum; //hashData of the stored bytes
+	};
+
+	enum {
+		SECTION_WORLD = 1, //day, counters, map size, random state
+		SECTION_PLAYERS,
+		SECTION_TERRAIN, //map planes, RLE
+		SECTION_ITEMS,
+		SECTION_FLAGS, //road, discovered and blessed bits
+		SECTION_PEOPLE,
+		SECTION_GOODS
+	};
+
+	//fields of the world that are not in the map
+	struct sWorldState {
+		uint32 width;
+		uint32 height;
+		uint32 souls_saved;
+		uint16 day;
+		uint8 selected_player;
+		uint8 alive_players;
+		uint8 map_fog;
+		uint32 random_state; //so a loaded game continues as the saved one would have
+	};
+
+	static bool save(const World& world, const char* filename);
+	static bool load(World& world, const char* filename); //the world is not modified if the file is not valid
+
+	//byte run-length encoding: a control byte n < 128 is followed by n + 1 literal bytes, n >= 128 by one byte repeated n - 125 times
+	static void encodeRLE(const uint8* data, unsigned int size, std::vector<uint8>& out);
+	static bool decodeRLE(const uint8* data, unsigned int size, uint8* out, unsigned int out_size);
+};
+
+#endif
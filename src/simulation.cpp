@@ -0,0 +1,211 @@
+#include "simulation.h"
+
+#include <algorithm>
+#include "includes.h"
+#include "pathfinding.h"
+
+void ScriptedPolicy::add(int day, int player, int action, int param)
+{
+	sAction a = { (uint16)day, (uint8)player, (uint8)action, (uint8)param };
+	actions.push_back(a);
+}
+
+void ScriptedPolicy::playTurn(World& world, int player)
+{
+	for (int i = 0; i < actions.size(); ++i)
+	{
+		const sAction& a = actions[i];
+		if (a.day > world.day)
+			break;
+		if (a.day == world.day && a.player == player)
+			world.applyAction(player, a.action, a.param);
+	}
+}
+
+GreedyPolicy::GreedyPolicy(int radius, PathFinder* pathfinder)
+{
+	this->radius = radius;
+	this->pathfinder = pathfinder;
+	memset(upgrades, 0, sizeof(upgrades));
+}
+
+bool GreedyPolicy::canAfford(const sCharacter& player, const sUpgrade& upgrade, int extra_movements)
+{
+	return player.movements >= upgrade.movements + extra_movements && player.wood + upgrade.wood >= 0 &&
+		player.stone + upgrade.stone >= 0 && player.goods + upgrade.goods >= 0;
+}
+
+void GreedyPolicy::playTurn(World& world, int player_index)
+{
+	//every step costs a movement, the limit only protects from getting stuck
+	sCharacter& player = world.players[player_index];
+	for (int steps = 0; steps < 64 && player.alive && player.movements > 0; ++steps)
+		if (!step(world, player_index))
+			break;
+}
+
+bool GreedyPolicy::step(World& world, int player_index, int* action, int* param)
+{
+	sCharacter& player = world.players[player_index];
+	Matrix<sCell>& gamemap = world.gamemap;
+	int px = player.pos.x / 16;
+	int py = player.pos.y / 16;
+
+	//upgrade here if possible
+	int row = World::findUpgrade(gamemap.get(px, py).item);
+	if (row && canAfford(player, upgrade_table[row]) && world.applyAction(player_index, INTERACT))
+	{
+		upgrades[row]++;
+		if (action)
+			*action = INTERACT;
+		return true;
+	}
+
+	//closest cell worth walking to: water when thirsty, the family when it needs love, otherwise something to upgrade
+	bool thirsty = player.water < 40;
+	bool lonely = player.love < 40 && !thirsty;
+	if (pathfinder && (thirsty || lonely))
+	{
+		int field = thirsty ? PathFinder::FIELD_WATER : pathfinder->getClosestPlayer(player_index);
+		int direction = field == -1 ? 0 : pathfinder->getDirection(field, px, py);
+		if (!direction || !world.applyAction(player_index, WALK, direction))
+			return false;
+		if (action)
+			*action = WALK;
+		if (param)
+			*param = direction;
+		return true;
+	}
+	int best_x = -1, best_y = -1, best_dist = radius * 2 + 1;
+	if (lonely)
+	{
+		for (int i = 0; i < 3; ++i)
+		{
+			const sCharacter& other = world.players[i];
+			int dist = abs(other.pos.x / 16 - px) + abs(other.pos.y / 16 - py);
+			if (i == player_index || !other.alive || dist == 0 || (best_x != -1 && dist >= best_dist))
+				continue;
+			best_x = other.pos.x / 16;
+			best_y = other.pos.y / 16;
+			best_dist = dist;
+		}
+	}
+	else
+	{
+		for (int y = max(0, py - radius); y <= min((int)gamemap.height - 1, py + radius); ++y)
+			for (int x = max(0, px - radius); x <= min((int)gamemap.width - 1, px + radius); ++x)
+			{
+				int dist = abs(x - px) + abs(y - py);
+				if (dist == 0 || dist >= best_dist)
+					continue;
+				const sCell& cell = gamemap.get(x, y);
+				if (thirsty)
+				{
+					if (cell.item != ITEM_FOUNTAIN && cell.item != ITEM_WELL)
+						continue;
+				}
+				else
+				{
+					int target_row = World::findUpgrade(cell.item);
+					if (!target_row || !canAfford(player, upgrade_table[target_row], dist))
+						continue;
+				}
+				best_x = x;
+				best_y = y;
+				best_dist = dist;
+			}
+	}
+	if (best_x == -1)
+		return false;
+
+	//one step, along the longest axis first and the other one if it is blocked
+	int dx = best_x - px;
+	int dy = best_y - py;
+	int first = dx > 0 ? EAST : WEST;
+	int second = dy > 0 ? SOUTH : NORTH;
+	if (abs(dx) < abs(dy))
+		std::swap(first, second);
+	int direction = 0;
+	if (world.applyAction(player_index, WALK, first))
+		direction = first;
+	else if ((abs(dx) < abs(dy) ? dx : dy) && world.applyAction(player_index, WALK, second))
+		direction = second;
+	if (!direction)
+		return false;
+	if (action)
+		*action = WALK;
+	if (param)
+		*param = direction;
+	return true;
+}
+
+std::vector<SimulationRunner::sResult> SimulationRunner::run(int num_worlds, int days, uint32 first_seed, ThreadPool* pool)
+{
+	std::vector<sResult> results(num_worlds);
+	pool->parallelFor(num_worlds, [&](int i) {
+		//everything the world uses is its own, so worlds do not need to be synchronized
+		World world(first_seed + i);
+		PathFinder pathfinder(&world);
+		GreedyPolicy policy(10, &pathfinder);
+		sResult& result = results[i];
+		result.seed = first_seed + i;
+		result.days = world.simulate(days, &policy);
+		result.souls_saved = world.souls_saved;
+		result.alive_players = world.alive_players;
+		memcpy(result.upgrades, policy.upgrades, sizeof(result.upgrades));
+	});
+	return results;
+}
+
+void SimulationRunner::benchmark(int num_worlds, int days, uint32 first_seed)
+{
+	std::cout << "Simulation benchmark, " << num_worlds << " worlds of " << days << " days" << std::endl;
+
+	//one world, without players and with the greedy policy
+	{
+		World world(first_seed);
+		Uint64 start = SDL_GetPerformanceCounter();
+		int played = world.simulate(days);
+		double seconds = (SDL_GetPerformanceCounter() - start) / (double)SDL_GetPerformanceFrequency();
+		std::cout << " * 1 world, no actions: " << played << " turns, " << played / seconds << " turns/s" << std::endl;
+
+		World world2(first_seed);
+		PathFinder pathfinder(&world2);
+		GreedyPolicy policy(10, &pathfinder);
+		start = SDL_GetPerformanceCounter();
+		played = world2.simulate(days, &policy);
+		seconds = (SDL_GetPerformanceCounter() - start) / (double)SDL_GetPerformanceFrequency();
+		std::cout << " * 1 world, greedy policy: " << played << " turns, " << played / seconds << " turns/s" << std::endl;
+	}
+
+	//many worlds in all the cores (map generation included)
+	ThreadPool* pool = ThreadPool::Get();
+	Uint64 start = SDL_GetPerformanceCounter();
+	std::vector<sResult> results = run(num_worlds, days, first_seed, pool);
+	double seconds = (SDL_GetPerformanceCounter() - start) / (double)SDL_GetPerformanceFrequency();
+
+	long total_days = 0;
+	double souls = 0;
+	int survived = 0;
+	double upgrades[32] = { 0 };
+	for (int i = 0; i < results.size(); ++i)
+	{
+		const sResult& result = results[i];
+		total_days += result.days;
+		souls += result.souls_saved;
+		if (result.alive_players)
+			survived++;
+		for (int j = 0; j < upgrade_table_size; ++j)
+			upgrades[j] += result.upgrades[j];
+	}
+	std::cout << " * " << num_worlds << " worlds in " << pool->num_threads + 1 << " threads: " << total_days << " turns in " << seconds << " s, "
+		<< total_days / seconds << " turns/s" << std::endl;
+
+	//economy, averages per world
+	std::cout << std::endl << "Days played: " << total_days / (double)num_worlds << ", souls saved: " << souls / num_worlds
+		<< ", worlds with players alive: " << survived * 100.0 / num_worlds << "%" << std::endl;
+	std::cout << "Upgrades per world:" << std::endl;
+	for (int j = 1; j < upgrade_table_size; ++j)
+		if (upgrade_table[j].item != 255)
+			std::cout << "   " << upgrade_table[j].str << " (" << upgrade_table[j].item << "): " << upgrades[j] / num_worlds << std::endl;
+}
@@ -0,0 +1,72 @@
+/*	Simulation: plays worlds without rendering, for testing and for balancing the economy (upgrade_table).
+	A policy decides the actions of the players every turn (see World::simulate), and SimulationRunner plays
+	many independent worlds, each one with its own seed, in all the cores.
+*/
+
+#ifndef SIMULATION_H
+#define SIMULATION_H
+
+#include <vector>
+#include "mygame.h"
+#include "threadpool.h"
+
+class PathFinder;
+
+class WorldPolicy
+{
+public:
+	virtual ~WorldPolicy() {}
+	virtual void playTurn(World& world, int player) = 0; //called once per day for every player alive
+};
+
+//actions given in advance, p.e. to reproduce a bug
+class ScriptedPolicy : public WorldPolicy
+{
+public:
+	struct sAction {
+		uint16 day;
+		uint8 player;
+		uint8 action; //WALK or INTERACT
+		uint8 param; //direction of WALK
+	};
+	std::vector<sAction> actions; //sorted by day
+
+	void add(int day, int player, int action, int param = 0);
+	virtual void playTurn(World& world, int player);
+};
+
+//goes to the closest thing it can upgrade and upgrades it, or to water when it is thirsty, or to the family when it needs love
+class GreedyPolicy : public WorldPolicy
+{
+public:
+	int radius; //cells around the player where it looks for something to do
+	uint32 upgrades[32]; //upgrades done, by row of the upgrade_table
+	PathFinder* pathfinder; //if any, water and the family are reached by the shortest way instead of straight lines
+
+	GreedyPolicy(int radius = 10, PathFinder* pathfinder = NULL);
+	virtual void playTurn(World& world, int player);
+	//does one action, false if there is nothing to do (action and param get what it did)
+	bool step(World& world, int player, int* action = NULL, int* param = NULL);
+
+	static bool canAfford(const sCharacter& player, const sUpgrade& upgrade, int extra_movements = 0);
+};
+
+class SimulationRunner
+{
+public:
+	struct sResult {
+		uint32 seed;
+		int days; //days played
+		int souls_saved;
+		int alive_players;
+		uint32 upgrades[32]; //by row of the upgrade_table
+	};
+
+	//plays num_worlds worlds (seeds first_seed, first_seed + 1...) with a GreedyPolicy in parallel
+	static std::vector<sResult> run(int num_worlds, int days, uint32 first_seed, ThreadPool* pool = ThreadPool::Get());
+
+	//turns per second of one world and of many in parallel, and the averages of the economy
+	static void benchmark(int num_worlds, int days, uint32 first_seed = 1);
+};
+
+#endif
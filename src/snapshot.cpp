@@ -0,0 +1,175 @@
+#include "snapshot.h"
+
+int WorldSnapshot::getNumChunks(int width, int height, int* chunks_width)
+{
+	int w = (width + SNAPSHOT_CHUNK_SIZE - 1) / SNAPSHOT_CHUNK_SIZE;
+	int h = (height + SNAPSHOT_CHUNK_SIZE - 1) / SNAPSHOT_CHUNK_SIZE;
+	if (chunks_width)
+		*chunks_width = w;
+	return w * h;
+}
+
+void WorldSnapshot::readChunk(const Matrix<sCell>& gamemap, int index, sChunk& chunk)
+{
+	int chunks_width = (gamemap.width + SNAPSHOT_CHUNK_SIZE - 1) / SNAPSHOT_CHUNK_SIZE;
+	int x = (index % chunks_width) * SNAPSHOT_CHUNK_SIZE;
+	int y = (index / chunks_width) * SNAPSHOT_CHUNK_SIZE;
+	int w = min(SNAPSHOT_CHUNK_SIZE, (int)gamemap.width - x);
+	int h = min(SNAPSHOT_CHUNK_SIZE, (int)gamemap.height - y);
+	for (int i = 0; i < h; ++i)
+		memcpy(chunk.cells + i * SNAPSHOT_CHUNK_SIZE, gamemap.data + (y + i) * gamemap.width + x, w * sizeof(sCell));
+}
+
+void WorldSnapshot::writeChunk(Matrix<sCell>& gamemap, int index, const sChunk& chunk)
+{
+	int chunks_width = (gamemap.width + SNAPSHOT_CHUNK_SIZE - 1) / SNAPSHOT_CHUNK_SIZE;
+	int x = (index % chunks_width) * SNAPSHOT_CHUNK_SIZE;
+	int y = (index / chunks_width) * SNAPSHOT_CHUNK_SIZE;
+	int w = min(SNAPSHOT_CHUNK_SIZE, (int)gamemap.width - x);
+	int h = min(SNAPSHOT_CHUNK_SIZE, (int)gamemap.height - y);
+	for (int i = 0; i < h; ++i)
+		memcpy(gamemap.data + (y + i) * gamemap.width + x, chunk.cells + i * SNAPSHOT_CHUNK_SIZE, w * sizeof(sCell));
+}
+
+//the small part of the world, copied always
+static void copyState(const World& world, WorldSnapshot& snapshot)
+{
+	memcpy(snapshot.players, world.players, sizeof(world.players));
+	snapshot.day = world.day;
+	snapshot.selected_player = world.selected_player;
+	snapshot.alive_players = world.alive_players;
+	snapshot.souls_saved = world.souls_saved;
+	snapshot.map_fog = world.map_fog;
+	snapshot.unlimited_movements = world.unlimited_movements;
+	snapshot.random_state = world.random_state;
+	snapshot.coverage = world.coverage;
+}
+
+static void copyState(const WorldSnapshot& snapshot, World& world)
+{
+	memcpy(world.players, snapshot.players, sizeof(world.players));
+	world.day = snapshot.day;
+	world.selected_player = snapshot.selected_player;
+	world.alive_players = snapshot.alive_players;
+	world.souls_saved = snapshot.souls_saved;
+	world.map_fog = snapshot.map_fog;
+	world.unlimited_movements = snapshot.unlimited_movements;
+	world.random_state = snapshot.random_state;
+	world.coverage = snapshot.coverage;
+}
+
+void WorldSnapshot::apply(World& world) const
+{
+	world.gamemap.resize(width, height);
+	for (int i = 0; i < chunks.size(); ++i)
+		writeChunk(world.gamemap, i, *chunks[i]);
+	copyState(*this, world);
+	world.notifyMapReset();
+}
+
+WorldHistory::WorldHistory(World* world)
+{
+	this->world = world;
+	restoring = false;
+	onMapReset();
+	world->addListener(this);
+}
+
+WorldHistory::~WorldHistory()
+{
+	world->removeListener(this);
+}
+
+WorldSnapshot WorldHistory::take()
+{
+	Matrix<sCell>& gamemap = world->gamemap;
+	WorldSnapshot snapshot;
+	snapshot.width = gamemap.width;
+	snapshot.height = gamemap.height;
+	int num_chunks = WorldSnapshot::getNumChunks(gamemap.width, gamemap.height, &snapshot.chunks_width);
+	if (synced.size() != num_chunks)
+		onMapReset();
+
+	//the clean chunks are shared with the previous snapshots
+	for (int i = 0; i < num_chunks; ++i)
+	{
+		if (!dirty[i])
+			continue;
+		std::shared_ptr<WorldSnapshot::sChunk> chunk = std::make_shared<WorldSnapshot::sChunk>();
+		WorldSnapshot::readChunk(gamemap, i, *chunk);
+		synced[i] = chunk;
+		dirty[i] = false;
+	}
+	snapshot.chunks = synced;
+	copyState(*world, snapshot);
+	return snapshot;
+}
+
+void WorldHistory::restore(const WorldSnapshot& snapshot)
+{
+	Matrix<sCell>& gamemap = world->gamemap;
+	restoring = true;
+	copyState(snapshot, *world);
+
+	if (gamemap.width != snapshot.width || gamemap.height != snapshot.height)
+	{
+		snapshot.apply(*world);
+		synced = snapshot.chunks;
+		dirty.assign(synced.size(), false);
+		restoring = false;
+		return;
+	}
+
+	//only the chunks modified since they were synced or that are not the same as in the snapshot
+	int min_x = snapshot.chunks_width, min_y = snapshot.chunks.size(), max_x = -1, max_y = -1;
+	for (int i = 0; i < snapshot.chunks.size(); ++i)
+	{
+		if (!dirty[i] && synced[i] == snapshot.chunks[i])
+			continue;
+		WorldSnapshot::writeChunk(gamemap, i, *snapshot.chunks[i]);
+		synced[i] = snapshot.chunks[i];
+		dirty[i] = false;
+		int x = i % snapshot.chunks_width;
+		int y = i / snapshot.chunks_width;
+		min_x = min(min_x, x);
+		min_y = min(min_y, y);
+		max_x = max(max_x, x);
+		max_y = max(max_y, y);
+	}
+	if (max_x >= 0)
+		world->notifyCellsChanged(min_x * SNAPSHOT_CHUNK_SIZE, min_y * SNAPSHOT_CHUNK_SIZE, (max_x - min_x + 1) * SNAPSHOT_CHUNK_SIZE, (max_y - min_y + 1) * SNAPSHOT_CHUNK_SIZE);
+	restoring = false;
+}
+
+bool WorldHistory::undo()
+{
+	if (undo_stack.empty())
+		return false;
+	restore(undo_stack.back());
+	undo_stack.pop_back();
+	return true;
+}
+
+void WorldHistory::onCellsChanged(int x, int y, int w, int h)
+{
+	if (restoring)
+		return;
+	int chunks_width = 0;
+	if (synced.size() != WorldSnapshot::getNumChunks(world->gamemap.width, world->gamemap.height, &chunks_width))
+	{
+		onMapReset();
+		return;
+	}
+	for (int cy = y / SNAPSHOT_CHUNK_SIZE; cy <= (y + h - 1) / SNAPSHOT_CHUNK_SIZE; ++cy)
+		for (int cx = x / SNAPSHOT_CHUNK_SIZE; cx <= (x + w - 1) / SNAPSHOT_CHUNK_SIZE; ++cx)
+			dirty[cy * chunks_width + cx] = true;
+}
+
+void WorldHistory::onMapReset()
+{
+	if (restoring)
+		return;
+	int num_chunks = WorldSnapshot::getNumChunks(world->gamemap.width, world->gamemap.height);
+	synced.assign(num_chunks, WorldSnapshot::ChunkRef());
+	dirty.assign(num_chunks, true);
+}
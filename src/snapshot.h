@@ -0,0 +1,73 @@
+/*	WorldSnapshot: the whole state of a World, with the map split in chunks of 16x16 cells.
+	Chunks are shared (copy-on-write) between snapshots, so taking one only copies the chunks that
+	changed since the previous one, and keeping many costs memory only for what changed.
+	WorldHistory listens to the map to know which chunks are dirty and keeps the undo stack.
+*/
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <vector>
+#include <memory>
+#include "mygame.h"
+
+#define SNAPSHOT_CHUNK_SIZE 16
+
+class WorldSnapshot
+{
+public:
+	struct sChunk {
+		sCell cells[SNAPSHOT_CHUNK_SIZE * SNAPSHOT_CHUNK_SIZE]; //rows of SNAPSHOT_CHUNK_SIZE, chunks in the border are not full
+	};
+	typedef std::shared_ptr<const sChunk> ChunkRef;
+
+	sCharacter players[3];
+	uint16 day;
+	uint8 selected_player;
+	uint8 alive_players;
+	int souls_saved;
+	bool map_fog;
+	bool unlimited_movements;
+	uint32 random_state; //so the same actions after restoring give the same results
+	ChurchCoverage coverage; //only the churches, the fields are rebuilt when needed
+
+	int width; //of the map, in cells
+	int height;
+	int chunks_width;
+	std::vector<ChunkRef> chunks;
+
+	WorldSnapshot() { width = height = chunks_width = 0; }
+
+	//copies everything to a world, used to fork a world that has no history
+	void apply(World& world) const;
+
+	static int getNumChunks(int width, int height, int* chunks_width = NULL);
+	static void readChunk(const Matrix<sCell>& gamemap, int index, sChunk& chunk);
+	static void writeChunk(Matrix<sCell>& gamemap, int index, const sChunk& chunk);
+};
+
+class WorldHistory : public MapListener
+{
+public:
+	World* world;
+	std::vector<WorldSnapshot::ChunkRef> synced; //chunks the map has, except the dirty ones
+	std::vector<bool> dirty; //chunks modified since they were synced
+	std::vector<WorldSnapshot> undo_stack;
+	bool restoring; //ignores the notifications of its own changes
+
+	WorldHistory(World* world);
+	~WorldHistory();
+
+	WorldSnapshot take(); //only copies the dirty chunks
+	void restore(const WorldSnapshot& snapshot); //only writes the chunks that are different
+
+	void push() { undo_stack.push_back(take()); }
+	void push(const WorldSnapshot& snapshot) { undo_stack.push_back(snapshot); } //taken before a change that did happen
+	bool undo(); //false if there is nothing to undo
+	void clear() { undo_stack.clear(); }
+
+	virtual void onCellsChanged(int x, int y, int w, int h);
+	virtual void onMapReset();
+};
+
+#endif
@@ -0,0 +1,361 @@
+#include "spritebatch.h"
+#include <algorithm>
+#include "includes.h"
+
+SpriteBatch::SpriteBatch()
+{
+	viewport_width = viewport_height = 0;
+	sorted = true;
+	memset(&stats, 0, sizeof(stats));
+}
+
+void SpriteBatch::begin(int viewport_width, int viewport_height)
+{
+	this->viewport_width = viewport_width;
+	this->viewport_height = viewport_height;
+	commands.clear();
+	atlases.clear();
+	sorted = true;
+	memset(&stats, 0, sizeof(stats));
+}
+
+SpriteBatch::sCommand* SpriteBatch::addCommand(const void* atlas, int atlas_width, int atlas_height, int x, int y, const Area& rect, int layer, uint32 flags)
+{
+	stats.submitted++;
+
+	//same clamping as Image::drawImage
+	int sx = clamp((int)rect.x, 0, atlas_width);
+	int sy = clamp((int)rect.y, 0, atlas_height);
+	int w = clamp((int)rect.w, 0, atlas_width - sx);
+	int h = clamp((int)rect.h, 0, atlas_height - sy);
+
+	int clip_x0 = max(x, 0);
+	int clip_y0 = max(y, 0);
+	int clip_x1 = min(x + w, viewport_width);
+	int clip_y1 = min(y + h, viewport_height);
+	if (clip_x0 >= clip_x1 || clip_y0 >= clip_y1)
+	{
+		stats.culled++;
+		return NULL;
+	}
+
+	//atlases are numbered by order of appearance so the sort does not depend on pointers
+	unsigned int atlas_index = 0;
+	while (atlas_index < atlases.size() && atlases[atlas_index] != atlas)
+		atlas_index++;
+	if (atlas_index == atlases.size())
+		atlases.push_back(atlas);
+
+	sCommand command;
+	command.image = NULL;
+	command.indexed = NULL;
+	command.palette = NULL;
+	command.x = x;
+	command.y = y;
+	command.sx = sx;
+	command.sy = sy;
+	command.w = w;
+	command.h = h;
+	command.clip_x0 = clip_x0;
+	command.clip_y0 = clip_y0;
+	command.clip_x1 = clip_x1;
+	command.clip_y1 = clip_y1;
+	command.layer = layer;
+	command.flags = flags;
+	command.key = ((uint32)(layer + 0x8000) & 0xFFFF) << 16 | (atlas_index & 0xFFFF);
+	if (!commands.empty() && command.key < commands.back().key)
+		sorted = false;
+	commands.push_back(command);
+	return &commands.back();
+}
+
+void SpriteBatch::draw(const Image& img, int x, int y, const Area& rect, int layer, uint32 flags)
+{
+	sCommand* command = addCommand(&img, img.width, img.height, x, y, rect, layer, flags);
+	if (command)
+		command->image = &img;
+}
+
+void SpriteBatch::draw(const IndexedImage& img, int x, int y, const Area& rect, int layer, uint32 flags, const Color* palette)
+{
+	sCommand* command = addCommand(&img, img.width, img.height, x, y, rect, layer, flags);
+	if (!command)
+		return;
+	command->indexed = &img;
+	command->palette = palette ? palette : img.palette;
+}
+
+void SpriteBatch::sort()
+{
+	if (sorted)
+		return;
+	//sorting small (key, index) pairs is cheaper than moving the commands around, the index keeps it stable
+	sort_keys.resize(commands.size());
+	for (unsigned int i = 0; i < commands.size(); ++i)
+		sort_keys[i] = (uint64)commands[i].key << 32 | i;
+	std::sort(sort_keys.begin(), sort_keys.end());
+	sorted_commands.resize(commands.size());
+	for (unsigned int i = 0; i < commands.size(); ++i)
+		sorted_commands[i] = commands[(uint32)sort_keys[i]];
+	commands.swap(sorted_commands);
+	sorted = true;
+}
+
+void SpriteBatch::updateStats()
+{
+	stats.drawn = commands.size();
+	stats.atlas_changes = 0;
+	stats.pixels = 0;
+	const void* atlas = NULL;
+	for (unsigned int i = 0; i < commands.size(); ++i)
+	{
+		const sCommand& command = commands[i];
+		const void* command_atlas = command.image ? (const void*)command.image : (const void*)command.indexed;
+		if (command_atlas != atlas)
+		{
+			stats.atlas_changes++;
+			atlas = command_atlas;
+		}
+		stats.pixels += (command.clip_x1 - command.clip_x0) * (command.clip_y1 - command.clip_y0);
+	}
+}
+
+void SpriteBatch::execute(Image& target)
+{
+	if ((int)target.width < viewport_width || (int)target.height < viewport_height)
+	{
+		std::cerr << "SpriteBatch: target smaller than the viewport" << std::endl;
+		return;
+	}
+
+	sort();
+	updateStats();
+	for (unsigned int i = 0; i < commands.size(); ++i)
+		executeCommand(target, commands[i], 0, viewport_height);
+}
+
+void SpriteBatch::execute(Image& target, ThreadPool* pool, int num_bins)
+{
+	if (!pool)
+		return execute(target);
+	if (num_bins <= 0)
+		num_bins = pool->num_threads + 1; //the calling thread works too
+	num_bins = min(num_bins, viewport_height);
+	if (num_bins <= 1)
+		return execute(target);
+	if ((int)target.width < viewport_width || (int)target.height < viewport_height)
+	{
+		std::cerr << "SpriteBatch: target smaller than the viewport" << std::endl;
+		return;
+	}
+
+	sort();
+	updateStats();
+
+	//every command goes to the bins its rows touch, keeping the order so the result is the same as drawing them serially
+	int bin_height = (viewport_height + num_bins - 1) / num_bins;
+	if ((int)bins.size() < num_bins)
+		bins.resize(num_bins);
+	for (int i = 0; i < num_bins; ++i)
+		bins[i].clear();
+	for (unsigned int i = 0; i < commands.size(); ++i)
+	{
+		const sCommand& command = commands[i];
+		int last = (command.clip_y1 - 1) / bin_height;
+		for (int bin = command.clip_y0 / bin_height; bin <= last; ++bin)
+			bins[bin].push_back(i);
+	}
+
+	pool->parallelFor(num_bins, [&](int bin) {
+		int min_y = bin * bin_height;
+		int max_y = min(min_y + bin_height, viewport_height);
+		const std::vector<unsigned int>& bin_commands = bins[bin];
+		for (unsigned int i = 0; i < bin_commands.size(); ++i)
+			executeCommand(target, commands[bin_commands[i]], min_y, max_y);
+	});
+}
+
+void SpriteBatch::executeCommand(Image& target, const sCommand& command, int min_y, int max_y)
+{
+	//already clipped, every row is a straight run of pixels (backwards when flipped)
+	bool flip_x = (command.flags & FLIP_X) != 0;
+	bool flip_y = (command.flags & FLIP_Y) != 0;
+	int step = flip_x ? -1 : 1;
+	int col = flip_x ? command.sx + command.w - 1 - (command.clip_x0 - command.x) : command.sx + (command.clip_x0 - command.x);
+	int length = command.clip_x1 - command.clip_x0;
+
+	int end_y = min(command.clip_y1, max_y);
+	for (int j = max(command.clip_y0, min_y); j < end_y; ++j)
+	{
+		int row = flip_y ? command.sy + command.h - 1 - (j - command.y) : command.sy + (j - command.y);
+		Color* dst = target.pixels + j * target.width + command.clip_x0;
+		if (command.image)
+		{
+			const Color* src = command.image->pixels + row * command.image->width + col;
+			for (int i = 0; i < length; ++i, src += step, ++dst)
+			{
+				if (src->a == 255)
+					*dst = *src;
+				else if (src->a)
+					*dst = blendColors(*src, *dst);
+			}
+		}
+		else
+		{
+			const uint8* src = command.indexed->indices + row * command.indexed->width + col;
+			const Color* palette = command.palette;
+			for (int i = 0; i < length; ++i, src += step, ++dst)
+			{
+				if (*src == IndexedImage::TRANSPARENT_INDEX)
+					continue;
+				const Color& c = palette[*src];
+				if (c.a == 255)
+					*dst = c;
+				else if (c.a)
+					*dst = blendColors(c, *dst);
+			}
+		}
+	}
+}
+
+//a 256x256 atlas of 16x16 tiles with transparent holes, used by the benchmarks
+static void makeBenchmarkAtlas(Image& atlas)
+{
+	atlas = Image(256, 256);
+	for (unsigned int y = 0; y < atlas.height; ++y)
+		for (unsigned int x = 0; x < atlas.width; ++x)
+		{
+			unsigned int tile = (x / 16) + (y / 16) * 16;
+			Color c(((tile * 37) & 0xF) << 4, ((tile * 91) & 0xF) << 4, ((tile * 53) & 0x7) << 5);
+			if ((x * 7 + y * 3) % 5 == 0)
+				c.a = 0;
+			atlas.setPixel(x, y, c);
+		}
+}
+
+void SpriteBatch::benchmark(int num_sprites)
+{
+	//the atlas and its indexed version
+	Image atlas;
+	makeBenchmarkAtlas(atlas);
+	IndexedImage atlas8;
+	bool has_indexed = atlas8.fromImage(atlas);
+
+	//tiles scattered over a 128x128 viewport, some of them partially or totally outside, in random layers
+	struct sSprite { int x, y, layer; Area rect; };
+	std::vector<sSprite> sprites(num_sprites);
+	srand(1234);
+	for (int i = 0; i < num_sprites; ++i)
+	{
+		sSprite& sprite = sprites[i];
+		sprite.x = rand() % 192 - 32;
+		sprite.y = rand() % 192 - 32;
+		sprite.layer = rand() % 4;
+		sprite.rect = Area((rand() % 16) * 16, (rand() % 16) * 16, 16, 16);
+	}
+
+	//reference: immediate drawing in the order the batch will use
+	std::vector<int> order(num_sprites);
+	for (int i = 0; i < num_sprites; ++i)
+		order[i] = i;
+	std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return sprites[a].layer < sprites[b].layer; });
+
+	const int iterations = 200;
+	Image reference(128, 128);
+	Image target(128, 128);
+	SpriteBatch batch;
+
+	std::cout << "SpriteBatch benchmark, " << num_sprites << " sprites" << std::endl;
+	for (int indexed = 0; indexed < (has_indexed ? 2 : 1); ++indexed)
+	{
+		Uint64 start = SDL_GetPerformanceCounter();
+		for (int it = 0; it < iterations; ++it)
+		{
+			reference.fill(Color::BLACK);
+			for (int i = 0; i < num_sprites; ++i)
+			{
+				sSprite& sprite = sprites[order[i]];
+				if (indexed)
+					reference.drawImage(atlas8, sprite.x, sprite.y, sprite.rect);
+				else
+					reference.drawImage(atlas, sprite.x, sprite.y, sprite.rect);
+			}
+		}
+		double immediate = (SDL_GetPerformanceCounter() - start) / (double)SDL_GetPerformanceFrequency() / iterations;
+
+		start = SDL_GetPerformanceCounter();
+		for (int it = 0; it < iterations; ++it)
+		{
+			target.fill(Color::BLACK);
+			batch.begin(target.width, target.height);
+			for (int i = 0; i < num_sprites; ++i)
+			{
+				sSprite& sprite = sprites[i];
+				if (indexed)
+					batch.draw(atlas8, sprite.x, sprite.y, sprite.rect, sprite.layer);
+				else
+					batch.draw(atlas, sprite.x, sprite.y, sprite.rect, sprite.layer);
+			}
+			batch.execute(target);
+		}
+		double batched = (SDL_GetPerformanceCounter() - start) / (double)SDL_GetPerformanceFrequency() / iterations;
+		bool same = memcmp(reference.pixels, target.pixels, target.width * target.height * sizeof(Color)) == 0;
+
+		//replay the recorded commands without submitting them again
+		start = SDL_GetPerformanceCounter();
+		for (int it = 0; it < iterations; ++it)
+		{
+			target.fill(Color::BLACK);
+			batch.execute(target);
+		}
+		double replay = (SDL_GetPerformanceCounter() - start) / (double)SDL_GetPerformanceFrequency() / iterations;
+
+		std::cout << (indexed ? " indexed: " : " rgba: ") << "immediate " << immediate * 1000.0 << " ms, batched " << batched * 1000.0
+			<< " ms, replay " << replay * 1000.0 << " ms " << (same ? "" : "(MISMATCH)") << std::endl;
+		std::cout << "   submitted " << batch.stats.submitted << ", culled " << batch.stats.culled << ", drawn " << batch.stats.drawn
+			<< ", atlas changes " << batch.stats.atlas_changes << ", pixels " << batch.stats.pixels << std::endl;
+	}
+}
+
+void SpriteBatch::benchmarkBinned(int size, int num_sprites)
+{
+	Image atlas;
+	makeBenchmarkAtlas(atlas);
+
+	SpriteBatch batch;
+	batch.begin(size, size);
+	srand(1234);
+	for (int i = 0; i < num_sprites; ++i)
+		batch.draw(atlas, rand() % (size + 32) - 16, rand() % (size + 32) - 16, Area((rand() % 16) * 16, (rand() % 16) * 16, 16, 16), rand() % 4);
+
+	const int iterations = 50;
+	Image reference(size, size);
+	Image target(size, size);
+	reference.fill(Color::BLACK);
+	batch.execute(reference);
+
+	Uint64 start = SDL_GetPerformanceCounter();
+	for (int it = 0; it < iterations; ++it)
+	{
+		target.fill(Color::BLACK);
+		batch.execute(target);
+	}
+	double serial = (SDL_GetPerformanceCounter() - start) / (double)SDL_GetPerformanceFrequency() / iterations;
+	std::cout << "Binned rasterizer benchmark " << size << "x" << size << ", " << num_sprites << " sprites, "
+		<< batch.stats.drawn << " drawn" << std::endl;
+	std::cout << " serial: " << serial * 1000.0 << " ms" << std::endl;
+
+	for (int threads = 2; threads <= 8; threads *= 2)
+	{
+		ThreadPool pool(threads - 1); //plus the calling thread
+		start = SDL_GetPerformanceCounter();
+		for (int it = 0; it < iterations; ++it)
+		{
+			target.fill(Color::BLACK);
+			batch.execute(target, &pool, threads);
+		}
+		double binned = (SDL_GetPerformanceCounter() - start) / (double)SDL_GetPerformanceFrequency() / iterations;
+		bool same = memcmp(reference.pixels, target.pixels, size * size * sizeof(Color)) == 0;
+		std::cout << " " << threads << " threads: " << binned * 1000.0 << " ms, x" << serial / binned << " " << (same ? "" : "(MISMATCH)") << std::endl;
+	}
+}
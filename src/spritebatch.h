@@ -0,0 +1,72 @@
+/*	SpriteBatch: stages submit their sprites here instead of drawing them immediately.
+	Every sprite is clipped against the viewport once when it is submitted, then the batch is sorted
+	by layer and atlas and executed with a blitter that has no bounds checks.
+	Commands are kept after executing so they can be inspected (stats) or replayed.
+*/
+
+#ifndef SPRITEBATCH_H
+#define SPRITEBATCH_H
+
+#include <vector>
+#include "image.h"
+#include "threadpool.h"
+
+class SpriteBatch
+{
+public:
+	enum {
+		FLIP_X = 1,
+		FLIP_Y = 2
+	};
+
+	struct sCommand {
+		const Image* image; //one of image or indexed is set
+		const IndexedImage* indexed;
+		const Color* palette; //indexed only, NULL to use its own palette
+		int x, y; //destination of the whole sprite
+		int sx, sy, w, h; //source rect, already clamped to the atlas
+		int clip_x0, clip_y0, clip_x1, clip_y1; //visible part in the viewport
+		int layer;
+		uint32 flags;
+		uint32 key; //layer and atlas, used to sort
+	};
+
+	struct sStats {
+		unsigned int submitted;
+		unsigned int culled; //completely outside the viewport
+		unsigned int drawn;
+		unsigned int atlas_changes; //times the source atlas changed while executing
+		unsigned int pixels; //visible pixels of the drawn sprites
+	};
+
+	std::vector<sCommand> commands;
+	std::vector<const void*> atlases; //atlases used in this batch, in order of appearance
+	int viewport_width;
+	int viewport_height;
+	bool sorted;
+	sStats stats;
+
+	SpriteBatch();
+
+	void begin(int viewport_width, int viewport_height); //clears the previous commands
+	void draw(const Image& img, int x, int y, const Area& rect, int layer = 0, uint32 flags = 0);
+	void draw(const IndexedImage& img, int x, int y, const Area& rect, int layer = 0, uint32 flags = 0, const Color* palette = NULL);
+	void sort(); //by layer and atlas, sprites with the same key keep the order in which they were submitted
+	void execute(Image& target); //sorts if needed and draws all the commands, it can be called again to replay them
+	//same result but the target is split in horizontal bins that are drawn in parallel, one per worker by default
+	void execute(Image& target, ThreadPool* pool, int num_bins = 0);
+
+	static void benchmark(int num_sprites = 2000);
+	static void benchmarkBinned(int size = 512, int num_sprites = 20000); //serial against binned with several threads
+
+private:
+	sCommand* addCommand(const void* atlas, int atlas_width, int atlas_height, int x, int y, const Area& rect, int layer, uint32 flags);
+	void updateStats();
+	void executeCommand(Image& target, const sCommand& command, int min_y, int max_y); //only the rows in [min_y, max_y)
+
+	std::vector<uint64> sort_keys;
+	std::vector<sCommand> sorted_commands;
+	std::vector< std::vector<unsigned int> > bins; //commands touching every bin, in drawing order
+};
+
+#endif
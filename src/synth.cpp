@@ -1,22 +1,31 @@
 #include "synth.h"
 #include "framework.h"
+#include "utils.h"
 #include <math.h>
+#include <algorithm>
 
 Synth::Sample::~Sample()
 {
-	SDL_free(buffer);
+	if (!external)
+		SDL_free(buffer);
 }
 
 Synth::Synth()
 {
 	volume = 0.2;
 	noise_volume = 0;
+	time = 0;
+	noise_seed = 1;
+	next_event = 0;
 
 	memset(&samples_playback, 0, sizeof(SamplePlayback)*MAX_PLAYBACK_SAMPLES);
 }
 
 Synth::~Synth()
 {
+	for (int i = 0; i < MAX_PLAYBACK_STREAMS; ++i)
+		streams[i].close();
+
 	//iterate samples
 	for (auto it = samples.begin(); it != samples.end(); it++)
 	{
@@ -49,11 +58,17 @@ void Synth::generateAudio( float* buffer, int len, SDL_AudioSpec& spec )
 		s = osc1.buffer[i];
 		s += osc2.buffer[i];
 		s += osc3.buffer[i];
-		s += noise_volume * ((rand() % 255) / 255.0);
-		
+		if (noise_volume)
+		{
+			noise_seed = noise_seed * 1103515245 + 12345;
+			s += noise_volume * (((noise_seed >> 16) % 255) / 255.0);
+		}
+
 		s += samples_buffer[i];
 		buffer[i] = volume * s;
 	}
+
+	time += AUDIO_BUFFER_LENGTH / (float)spec.freq;
 }
 
 void Synth::generateOscillator(Oscillator& osc, SDL_AudioSpec& spec)
@@ -209,43 +224,501 @@ Synth::SamplePlayback* Synth::playSample( std::string filename, float volume, bo
 }
 
 
+//adds src to dst scaled by volume, clamping like SDL_MixAudio does
+inline void mixBuffer(float* dst, const float* src, unsigned int size, float volume)
+{
+	for (unsigned int i = 0; i < size; ++i)
+		dst[i] = clamp(dst[i] + src[i] * volume, -1.0, 1.0);
+}
+
 bool Synth::updateSamplesBuffer(SDL_AudioSpec& spec)
 {
 	bool playing = false;
+	for (int j = 0; j < MAX_PLAYBACK_SAMPLES && !playing; ++j)
+		playing = samples_playback[j].in_use != 0;
+	for (int j = 0; j < MAX_PLAYBACK_STREAMS && !playing; ++j)
+		playing = streams[j].in_use != 0;
+
+	memset( samples_buffer, 0, sizeof(float) * AUDIO_BUFFER_LENGTH );
+
+	if (!playing)
+		return false;
+
 	for (int j = 0; j < MAX_PLAYBACK_SAMPLES; ++j)
 	{
 		SamplePlayback& sp = samples_playback[j];
-		if (!sp.in_use)
+		if (sp.in_use)
+			mixSamplePlayback(sp);
+	}
+
+	for (int j = 0; j < MAX_PLAYBACK_STREAMS; ++j)
+	{
+		Stream& stream = streams[j];
+		if (stream.in_use)
+			mixStream(stream);
+	}
+	return true;
+}
+
+//mixes one block of the sample, when it reaches the loop end it wraps around inside the same block so there are no gaps
+void Synth::mixSamplePlayback(SamplePlayback& sp)
+{
+	Sample* sample = sp.sample;
+	unsigned int loop_start = sample->loop_start;
+	unsigned int loop_end = sample->loop_end ? min(sample->loop_end, sample->length) : sample->length;
+	if (sp.loop && loop_start >= loop_end) //invalid loop, play it once
+		sp.loop = 0;
+
+	unsigned int pos = 0;
+	while (pos < AUDIO_BUFFER_LENGTH)
+	{
+		unsigned int end = sp.loop ? loop_end : sample->length;
+		if (sp.offset >= end)
+		{
+			if (!sp.loop)
+			{
+				sp.in_use = false;
+				break;
+			}
+			sp.offset = loop_start;
 			continue;
-		playing = true;
-		break;
+		}
+		unsigned int size = min(AUDIO_BUFFER_LENGTH - pos, end - sp.offset);
+		mixBuffer(samples_buffer + pos, sample->buffer + sp.offset, size, sp.volume);
+		pos += size;
+		sp.offset += size;
 	}
+}
 
-	memset( samples_buffer, 0, sizeof(float) * AUDIO_BUFFER_LENGTH );
+//consumes from the ring buffer of the stream, if the decoder is late the rest of the block stays silent
+void Synth::mixStream(Stream& stream)
+{
+	unsigned int size = min((unsigned int)AUDIO_BUFFER_LENGTH, stream.available());
+	unsigned int read_pos = stream.read_pos;
+	unsigned int start = read_pos & (STREAM_RING_LENGTH - 1);
+	unsigned int first = min(size, STREAM_RING_LENGTH - start);
+	mixBuffer(samples_buffer, stream.ring + start, first, stream.volume);
+	mixBuffer(samples_buffer + first, stream.ring, size - first, stream.volume);
+	stream.read_pos = read_pos + size;
+
+	if (size == 0 && stream.finished)
+		stream.in_use = false;
+}
 
-	if (!playing)
+Synth::Stream* Synth::playStream(std::string filename, float volume, bool loop)
+{
+	//find free stream
+	int i = 0;
+	for (; i < MAX_PLAYBACK_STREAMS; ++i)
+		if (!streams[i].in_use)
+			break;
+	if (i == MAX_PLAYBACK_STREAMS)
+		return NULL;
+
+	Stream& stream = streams[i];
+	stream.close(); //in case it finished but the decoder is still alive
+	if (!stream.open(filename.c_str(), loop))
+		return NULL;
+	stream.volume = volume;
+	stream.in_use = true;
+	return &stream;
+}
+
+void Synth::stopStream(Stream* stream)
+{
+	//the audio callback could be reading the ring
+	SDL_LockAudio();
+	stream->in_use = false;
+	SDL_UnlockAudio();
+	stream->close();
+}
+
+Synth::Stream::Stream() : read_pos(0), write_pos(0), finished(false), must_stop(false)
+{
+	volume = 0.2;
+	in_use = false;
+	loop = false;
+	ring = new float[STREAM_RING_LENGTH];
+}
+
+Synth::Stream::~Stream()
+{
+	close();
+	delete[] ring;
+}
+
+bool Synth::Stream::open(const char* filename, bool loop)
+{
+	FILE* f = fopen(filename, "rb");
+	if (!f)
+	{
+		std::cerr << "Could not open stream: " << filename << std::endl;
 		return false;
+	}
+	fclose(f);
+
+	this->filename = filename;
+	this->loop = loop ? 1 : 0;
+	read_pos = 0;
+	write_pos = 0;
+	finished = false;
+	must_stop = false;
+	decoder = std::thread(&Stream::decode, this);
+	return true;
+}
 
-	for (int j = 0; j < MAX_PLAYBACK_SAMPLES; ++j)
+void Synth::Stream::close()
+{
+	must_stop = true;
+	if (decoder.joinable())
+		decoder.join();
+	in_use = false;
+}
+
+//reads the WAV header looking for the fmt and data chunks, returns the offset to the data
+static bool readWAVHeader(FILE* f, SDL_AudioFormat& format, int& channels, int& freq, unsigned int& data_start, unsigned int& data_length)
+{
+	unsigned char riff[12];
+	if (fread(riff, 1, 12, f) != 12 || memcmp(riff, "RIFF", 4) != 0 || memcmp(riff + 8, "WAVE", 4) != 0)
+		return false;
+
+	bool has_format = false;
+	unsigned char chunk[8];
+	while (fread(chunk, 1, 8, f) == 8)
 	{
-		SamplePlayback& sp = samples_playback[j];
-		if (!sp.in_use)
+		unsigned int size = chunk[4] | (chunk[5] << 8) | (chunk[6] << 16) | (chunk[7] << 24);
+		if (memcmp(chunk, "fmt ", 4) == 0)
+		{
+			unsigned char fmt[16];
+			if (size < 16 || fread(fmt, 1, 16, f) != 16)
+				return false;
+			int type = fmt[0] | (fmt[1] << 8);
+			channels = fmt[2] | (fmt[3] << 8);
+			freq = fmt[4] | (fmt[5] << 8) | (fmt[6] << 16) | (fmt[7] << 24);
+			int bits = fmt[14] | (fmt[15] << 8);
+			if (type == 3 && bits == 32)
+				format = AUDIO_F32;
+			else if (type == 1 && bits == 8)
+				format = AUDIO_U8;
+			else if (type == 1 && bits == 16)
+				format = AUDIO_S16;
+			else if (type == 1 && bits == 32)
+				format = AUDIO_S32;
+			else
+				return false;
+			has_format = true;
+			fseek(f, size - 16 + (size & 1), SEEK_CUR);
+		}
+		else if (memcmp(chunk, "data", 4) == 0)
+		{
+			data_start = ftell(f);
+			data_length = size;
+			return has_format;
+		}
+		else
+			fseek(f, size + (size & 1), SEEK_CUR); //chunks are word aligned
+	}
+	return false;
+}
+
+//decoder thread: reads the file in small blocks, converts them to F32 mono 48KHz and fills the ring buffer
+void Synth::Stream::decode()
+{
+	FILE* f = fopen(filename.c_str(), "rb");
+	SDL_AudioFormat format;
+	int channels, freq;
+	unsigned int data_start, data_length;
+	if (!f || !readWAVHeader(f, format, channels, freq, data_start, data_length))
+	{
+		std::cerr << "Stream format not supported: " << filename << std::endl;
+		if (f)
+			fclose(f);
+		finished = true;
+		return;
+	}
+
+	SDL_AudioStream* converter = SDL_NewAudioStream(format, channels, freq, AUDIO_F32, 1, 48000);
+	if (!converter)
+	{
+		std::cerr << "Stream can not be converted: " << filename << " (" << SDL_GetError() << ")" << std::endl;
+		fclose(f);
+		finished = true;
+		return;
+	}
+	unsigned char block[4096];
+	float converted[1024];
+	unsigned int remaining = data_length;
+	unsigned int read_in_pass = 0; //a loop over a file with no data would never wait
+
+	while (!must_stop)
+	{
+		//wait till there is enough space in the ring
+		if (STREAM_RING_LENGTH - available() < 1024)
+		{
+			SDL_Delay(5);
+			continue;
+		}
+
+		int got = SDL_AudioStreamGet(converter, converted, sizeof(converted));
+		if (got > 0)
+		{
+			unsigned int num = got / sizeof(float);
+			unsigned int pos = write_pos;
+			for (unsigned int i = 0; i < num; ++i)
+				ring[(pos + i) & (STREAM_RING_LENGTH - 1)] = converted[i];
+			write_pos = pos + num; //publish after the data is written
 			continue;
+		}
 
-		unsigned int size = AUDIO_BUFFER_LENGTH;
-		unsigned int offset = sp.offset;
-		if (sp.offset + size > sp.sample->length)
+		//converter is empty, feed it
+		if (remaining == 0)
+		{
+			if (!loop || !read_in_pass)
+			{
+				SDL_AudioStreamFlush(converter);
+				if (SDL_AudioStreamAvailable(converter))
+					continue;
+				finished = true;
+				break;
+			}
+			fseek(f, data_start, SEEK_SET);
+			remaining = data_length;
+			read_in_pass = 0;
+		}
+		size_t size = fread(block, 1, min((unsigned int)sizeof(block), remaining), f);
+		if (size == 0) //truncated file
 		{
-			size = sp.sample->length - sp.offset;
-			if (sp.loop)
-				sp.offset = 0;
+			remaining = 0;
+			continue;
+		}
+		remaining -= size;
+		read_in_pass += size;
+		SDL_AudioStreamPut(converter, block, size);
+	}
+
+	SDL_FreeAudioStream(converter);
+	fclose(f);
+}
+
+
+/* Script format, one event per line, lines starting with # are ignored:
+	<time> osc1|osc2|osc3 wave SIN|SAW|TRI|SQR
+	<time> osc1|osc2|osc3 note|freq|amp|pw|lpf <value>
+	<time> noise|volume <value>
+	<time> sample <filename> <volume> [loop]
+	<time> stop
+*/
+bool Synth::loadScript(const char* filename)
+{
+	std::string content;
+	if (!readFile(filename, content))
+		return false;
+
+	events.clear();
+	next_event = 0;
+	std::vector<std::string> lines = split(content, '\n');
+	for (int i = 0; i < lines.size(); ++i)
+	{
+		std::vector<std::string> tokens = tokenize(lines[i], " \t\r");
+		if (tokens.size() < 2 || tokens[0][0] == '#')
+			continue;
+
+		Event e;
+		e.time = atof(tokens[0].c_str());
+		e.osc = 0;
+		e.loop = 0;
+		e.value = 0;
+		const std::string& cmd = tokens[1];
+		if (cmd.size() == 4 && cmd.compare(0, 3, "osc") == 0 && tokens.size() >= 4)
+		{
+			e.osc = clamp(cmd[3] - '1', 0, 2);
+			const std::string& param = tokens[2];
+			const std::string& value = tokens[3];
+			e.value = atof(value.c_str());
+			if (param == "wave")
+			{
+				e.type = EVENT_WAVE;
+				e.value = value == "SAW" ? SAW : (value == "TRI" ? TRI : (value == "SQR" ? SQR : SIN));
+			}
+			else if (param == "note") e.type = EVENT_NOTE;
+			else if (param == "freq") e.type = EVENT_FREQ;
+			else if (param == "amp") e.type = EVENT_AMPLITUDE;
+			else if (param == "pw") e.type = EVENT_PW;
+			else if (param == "lpf") e.type = EVENT_LPF;
 			else
-				sp.in_use = false;
+			{
+				std::cerr << "Unknown synth param in script: " << param << std::endl;
+				continue;
+			}
+		}
+		else if (cmd == "noise" && tokens.size() >= 3) { e.type = EVENT_NOISE; e.value = atof(tokens[2].c_str()); }
+		else if (cmd == "volume" && tokens.size() >= 3) { e.type = EVENT_VOLUME; e.value = atof(tokens[2].c_str()); }
+		else if (cmd == "sample" && tokens.size() >= 4)
+		{
+			e.type = EVENT_SAMPLE;
+			e.filename = tokens[2];
+			e.value = atof(tokens[3].c_str());
+			e.loop = tokens.size() >= 5 && tokens[4] == "loop";
 		}
+		else if (cmd == "stop") e.type = EVENT_STOP;
 		else
-			sp.offset += size;
+		{
+			std::cerr << "Unknown command in synth script: " << cmd << std::endl;
+			continue;
+		}
+		events.push_back(e);
+	}
+
+	std::stable_sort(events.begin(), events.end(), [](const Event& a, const Event& b) { return a.time < b.time; });
+	return true;
+}
+
+void Synth::applyEvents(float time)
+{
+	Oscillator* oscs[3] = { &osc1, &osc2, &osc3 };
+	while (next_event < events.size() && events[next_event].time <= time)
+	{
+		const Event& e = events[next_event++];
+		Oscillator& osc = *oscs[(int)e.osc];
+		switch (e.type)
+		{
+			case EVENT_WAVE: osc.wave = (char)e.value; break;
+			case EVENT_NOTE: osc.setNote((int)e.value); break;
+			case EVENT_FREQ: osc.freq = e.value; break;
+			case EVENT_AMPLITUDE: osc.amplitude = e.value; break;
+			case EVENT_PW: osc.pw = e.value; break;
+			case EVENT_LPF: osc.LPF = e.value; break;
+			case EVENT_NOISE: noise_volume = e.value; break;
+			case EVENT_VOLUME: volume = e.value; break;
+			case EVENT_SAMPLE: playSample(e.filename, e.value, e.loop != 0); break;
+			case EVENT_STOP:
+				for (int i = 0; i < MAX_PLAYBACK_SAMPLES; ++i)
+					samples_playback[i].stop();
+				osc1.amplitude = osc2.amplitude = osc3.amplitude = noise_volume = 0;
+				break;
+		}
+	}
+}
 
-		SDL_MixAudio((Uint8*)samples_buffer, (Uint8*)(sp.sample->buffer + offset), size * sizeof(float), sp.volume * 128 );
+//events are applied at the start of every block, like the game does when it changes the synth between callbacks
+void Synth::render(float* output, unsigned int num_samples, SDL_AudioSpec& spec)
+{
+	float block[AUDIO_BUFFER_LENGTH];
+	for (unsigned int pos = 0; pos < num_samples; pos += AUDIO_BUFFER_LENGTH)
+	{
+		applyEvents(time);
+		generateAudio(block, AUDIO_BUFFER_LENGTH, spec);
+		unsigned int size = min((unsigned int)AUDIO_BUFFER_LENGTH, num_samples - pos);
+		memcpy(output + pos, block, size * sizeof(float));
 	}
+}
+
+//saves as 32 bits float mono WAV
+bool Synth::saveWAV(const char* filename, const float* data, unsigned int num_samples, int freq)
+{
+	FILE* f = fopen(filename, "wb");
+	if (!f)
+		return false;
+
+	unsigned int data_size = num_samples * sizeof(float);
+	unsigned int header[11];
+	memcpy(&header[0], "RIFF", 4);
+	header[1] = 36 + data_size;
+	memcpy(&header[2], "WAVE", 4);
+	memcpy(&header[3], "fmt ", 4);
+	header[4] = 16;
+	header[5] = 3 | (1 << 16); //float format, 1 channel
+	header[6] = freq;
+	header[7] = freq * sizeof(float); //bytes per second
+	header[8] = sizeof(float) | (32 << 16); //block align, bits per sample
+	memcpy(&header[9], "data", 4);
+	header[10] = data_size;
+
+	fwrite(header, sizeof(header), 1, f);
+	fwrite(data, sizeof(float), num_samples, f);
+	fclose(f);
 	return true;
 }
+
+//only the files saveWAV writes (float, mono), to compare renders against golden files
+bool Synth::loadWAV(const char* filename, std::vector<float>& data, int* freq)
+{
+	FILE* f = fopen(filename, "rb");
+	if (!f)
+		return false;
+	unsigned int header[11];
+	bool ok = fread(header, sizeof(header), 1, f) == 1 && memcmp(&header[0], "RIFF", 4) == 0 && memcmp(&header[2], "WAVE", 4) == 0 &&
+		header[5] == (3 | (1 << 16)) && memcmp(&header[9], "data", 4) == 0 && header[10] % sizeof(float) == 0;
+	if (ok)
+	{
+		data.resize(header[10] / sizeof(float));
+		ok = data.empty() || fread(&data[0], sizeof(float), data.size(), f) == data.size();
+		if (freq)
+			*freq = header[6];
+	}
+	fclose(f);
+	if (!ok)
+		std::cerr << "Not a float mono WAV: " << filename << std::endl;
+	return ok;
+}
+
+//helper to measure a stage of the synth, returns nanoseconds per sample
+template<typename F> double measureSynth(F func, int blocks = 2000)
+{
+	Uint64 start = SDL_GetPerformanceCounter();
+	for (int i = 0; i < blocks; ++i)
+		func();
+	Uint64 end = SDL_GetPerformanceCounter();
+	double seconds = (end - start) / (double)SDL_GetPerformanceFrequency();
+	return seconds * 1e9 / (blocks * (double)AUDIO_BUFFER_LENGTH);
+}
+
+void Synth::benchmark()
+{
+	SDL_AudioSpec spec;
+	memset(&spec, 0, sizeof(spec));
+	spec.freq = 48000;
+	spec.format = AUDIO_F32;
+	spec.channels = 1;
+
+	Synth synth;
+	const char* wave_names[] = { "", "SIN", "SAW", "TRI", "SQR" };
+	std::cout << "Synth benchmark (ns/sample)" << std::endl;
+
+	//oscillators
+	for (int wave = SIN; wave <= SQR; ++wave)
+	{
+		synth.osc1.wave = wave;
+		synth.osc1.amplitude = 0.5;
+		std::cout << " oscillator " << wave_names[wave] << ": " << measureSynth([&]() { synth.generateOscillator(synth.osc1, spec); }) << std::endl;
+	}
+
+	//filter
+	synth.osc1.LPF = 0.3;
+	std::cout << " low-pass filter: " << measureSynth([&]() { synth.applyFilter(synth.osc1, spec); }) << std::endl;
+
+	//sample mixing with a generated one second sample
+	Sample* sample = new Sample(); //value initialized, every field zero
+	sample->length = 48000;
+	sample->buffer = (float*)SDL_malloc(sample->length * sizeof(float));
+	sample->spec = spec;
+	for (unsigned int i = 0; i < sample->length; ++i)
+		sample->buffer[i] = sin(i * 0.05) * 0.5;
+	synth.samples["benchmark"] = sample;
+
+	const int voices[] = { 1, 4, 16, MAX_PLAYBACK_SAMPLES };
+	for (int i = 0; i < 4; ++i)
+	{
+		for (int j = 0; j < MAX_PLAYBACK_SAMPLES; ++j)
+			synth.samples_playback[j].stop();
+		for (int j = 0; j < voices[i]; ++j)
+			synth.playSample(sample, 0.1, true);
+		std::cout << " sample mixing " << voices[i] << " voices: " << measureSynth([&]() { synth.updateSamplesBuffer(spec); }) << std::endl;
+	}
+
+	//everything together
+	synth.osc2.amplitude = synth.osc3.amplitude = 0.2;
+	synth.noise_volume = 0.1;
+	float output[AUDIO_BUFFER_LENGTH];
+	std::cout << " full mix " << MAX_PLAYBACK_SAMPLES << " voices: " << measureSynth([&]() { synth.generateAudio(output, AUDIO_BUFFER_LENGTH, spec); }) << std::endl;
+}
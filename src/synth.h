@@ -5,9 +5,13 @@
 #include <string>
 #include <map>
 #include <vector>
+#include <thread>
+#include <atomic>
 
 #define AUDIO_BUFFER_LENGTH 1024
 #define MAX_PLAYBACK_SAMPLES 32
+#define MAX_PLAYBACK_STREAMS 4
+#define STREAM_RING_LENGTH (1 << 16) //in samples (must be power of two), a bit more than one second at 48KHz
 
 class Synth {
 
@@ -56,7 +60,8 @@ class Synth {
 		float noise_volume;
 
 		float buffer[AUDIO_BUFFER_LENGTH];
-		float time;
+		float time; //seconds of audio generated
+		unsigned int noise_seed; //noise uses its own generator so offline renders are deterministic
 
 		Synth();
 		~Synth();
@@ -71,7 +76,11 @@ class Synth {
 			Uint32 length;
 			float* buffer;
 			SDL_AudioSpec spec;
+			Uint32 loop_start; //first sample of the loop when playing in loop mode
+			Uint32 loop_end; //last sample (not included) of the loop, 0 means the end of the sample
+			bool external; //buffer is not owned by the sample (p.e. it points inside a mapped asset pack)
 			~Sample();
+			void setLoopPoints(Uint32 start, Uint32 end) { loop_start = start; loop_end = end; }
 		};
 
 		//object with info about a sample being played
@@ -86,16 +95,78 @@ class Synth {
 			void resume() { in_use = true; }
 		};
 
+		//streams: long audio files (music) decoded by a worker thread into a ring buffer, never fully in memory
+		struct Stream {
+			std::string filename;
+			float volume;
+			char in_use;
+			char loop;
+			float* ring; //STREAM_RING_LENGTH samples in F32, mono, 48KHz
+			std::atomic<unsigned int> read_pos; //only written by the audio thread
+			std::atomic<unsigned int> write_pos; //only written by the decoder thread
+			std::atomic<bool> finished; //decoder reached the end of the file (and not looping)
+			std::atomic<bool> must_stop;
+			std::thread decoder;
+
+			Stream();
+			~Stream();
+			bool open(const char* filename, bool loop);
+			void close();
+			unsigned int available() const { return write_pos - read_pos; }
+			void decode(); //decoder thread main loop
+			void stop() { in_use = false; }
+		};
+
 		float samples_buffer[AUDIO_BUFFER_LENGTH];
 		SamplePlayback samples_playback[MAX_PLAYBACK_SAMPLES];
+		Stream streams[MAX_PLAYBACK_STREAMS];
 		std::map<std::string, Sample*> samples;
 
 		Sample* loadSample(std::string filename);
 		SamplePlayback* playSample( Sample* sample, float volume = 0.2, bool loop = false);
 		SamplePlayback* playSample( std::string filename, float volume = 0.2, bool loop = false);
+		Stream* playStream( std::string filename, float volume = 0.2, bool loop = false);
+		void stopStream( Stream* stream );
 		bool updateSamplesBuffer(SDL_AudioSpec& spec );
+		void mixSamplePlayback( SamplePlayback& sp );
+		void mixStream( Stream& stream );
 
 		static float getNoteFreq(int note) { return 440 * pow(2.0, (note - 69) / 12.0); }
+
+		//offline rendering (no audio device needed)
+
+		enum {
+			EVENT_WAVE = 1,
+			EVENT_NOTE,
+			EVENT_FREQ,
+			EVENT_AMPLITUDE,
+			EVENT_PW,
+			EVENT_LPF,
+			EVENT_NOISE,
+			EVENT_VOLUME,
+			EVENT_SAMPLE,
+			EVENT_STOP
+		};
+
+		//something that happens at a given time while rendering
+		struct Event {
+			float time; //in seconds
+			char type;
+			char osc; //0,1,2 for osc1,osc2,osc3
+			char loop; //only for samples
+			float value;
+			std::string filename; //only for samples
+		};
+
+		std::vector<Event> events; //sorted by time
+		unsigned int next_event;
+
+		bool loadScript(const char* filename); //see synth.cpp for the format
+		void applyEvents(float time);
+		void render(float* output, unsigned int num_samples, SDL_AudioSpec& spec); //renders using the events script
+		static bool saveWAV(const char* filename, const float* data, unsigned int num_samples, int freq);
+		static bool loadWAV(const char* filename, std::vector<float>& data, int* freq = NULL); //float mono, as saveWAV writes them
+		static void benchmark(); //prints the cost per sample of every stage of the synth
 };
 
 #endif
\ No newline at end of file
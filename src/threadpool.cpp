@@ -0,0 +1,149 @@
+#include "threadpool.h"
+#include <memory>
+
+//index of the worker running in this thread, to push the jobs it adds to its own queue
+static thread_local const ThreadPool* t_pool = NULL;
+static thread_local int t_worker = -1;
+
+ThreadPool::ThreadPool(int num_threads) : next_queue(0), queued(0)
+{
+	if (num_threads <= 0)
+		num_threads = std::thread::hardware_concurrency();
+	if (num_threads <= 0)
+		num_threads = 1;
+	this->num_threads = num_threads;
+	pending = 0;
+	must_exit = false;
+	for (int i = 0; i < num_threads; ++i)
+		queues.push_back(new sQueue());
+	for (int i = 0; i < num_threads; ++i)
+		threads.push_back(std::thread(&ThreadPool::workerLoop, this, i));
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		must_exit = true;
+	}
+	job_available.notify_all();
+	for (int i = 0; i < threads.size(); ++i)
+		threads[i].join();
+	for (int i = 0; i < queues.size(); ++i)
+		delete queues[i];
+}
+
+void ThreadPool::add(Job job)
+{
+	int index = (t_pool == this) ? t_worker : (next_queue++ % num_threads);
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		pending++;
+	}
+	{
+		std::unique_lock<std::mutex> lock(queues[index]->mutex);
+		queues[index]->jobs.push_back(job);
+	}
+	{
+		//under the lock so a worker about to sleep can not miss it
+		std::unique_lock<std::mutex> lock(mutex);
+		queued++;
+	}
+	job_available.notify_one();
+}
+
+void ThreadPool::wait()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	all_done.wait(lock, [this]() { return pending == 0; });
+}
+
+bool ThreadPool::popJob(int worker, Job& job)
+{
+	//own jobs first (oldest first), then steal the newest from the other queues
+	for (int i = 0; i < num_threads; ++i)
+	{
+		sQueue* queue = queues[(worker + i) % num_threads];
+		std::unique_lock<std::mutex> lock(queue->mutex);
+		if (queue->jobs.empty())
+			continue;
+		if (i == 0)
+		{
+			job = std::move(queue->jobs.front());
+			queue->jobs.pop_front();
+		}
+		else
+		{
+			job = std::move(queue->jobs.back());
+			queue->jobs.pop_back();
+		}
+		queued--;
+		return true;
+	}
+	return false;
+}
+
+void ThreadPool::workerLoop(int worker)
+{
+	t_pool = this;
+	t_worker = worker;
+	while (true)
+	{
+		Job job;
+		if (!popJob(worker, job))
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			job_available.wait(lock, [this]() { return must_exit || queued > 0; });
+			if (must_exit && queued == 0)
+				return;
+			continue;
+		}
+
+		job();
+
+		std::unique_lock<std::mutex> lock(mutex);
+		if (--pending == 0)
+			all_done.notify_all();
+	}
+}
+
+void ThreadPool::parallelFor(int count, const std::function<void(int)>& func)
+{
+	if (count <= 0)
+		return;
+
+	//shared with the helper jobs, they may start after this call has returned so they must not touch the stack
+	struct sState {
+		std::atomic<int> next;
+		std::atomic<int> done;
+		std::function<void(int)> func;
+	};
+	std::shared_ptr<sState> state = std::make_shared<sState>();
+	state->next = 0;
+	state->done = 0;
+	state->func = func;
+
+	auto run = [](sState* state, int count) {
+		int index;
+		while ((index = state->next++) < count)
+		{
+			state->func(index);
+			state->done++;
+		}
+	};
+
+	int helpers = num_threads < count - 1 ? num_threads : count - 1;
+	for (int i = 0; i < helpers; ++i)
+		add([state, run, count]() { run(state.get(), count); });
+
+	//the calling thread works too, so it finishes even if all the workers are busy
+	run(state.get(), count);
+	while (state->done < count)
+		std::this_thread::yield();
+}
+
+ThreadPool* ThreadPool::Get()
+{
+	static ThreadPool pool;
+	return &pool;
+}
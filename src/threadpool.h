@@ -0,0 +1,57 @@
+/*	ThreadPool: a group of worker threads that execute jobs (functions) in the background.
+	Used to load assets while the game runs and for other tasks that can be split across cores.
+	Every worker has its own queue and steals from the others when it runs out of jobs,
+	so a worker busy with a long job (p.e. loading an image) does not hold back the rest.
+*/
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+
+class ThreadPool
+{
+public:
+	typedef std::function<void()> Job;
+
+	int num_threads;
+
+	ThreadPool(int num_threads = 0); //0 means one per core
+	~ThreadPool();
+
+	void add(Job job); //the job will be executed in any of the threads
+	void wait(); //blocks till all the jobs added are finished
+
+	//calls func(0) ... func(count - 1) in the workers and in the calling thread, returns when all of them are done.
+	//It only waits for its own calls, not for other jobs in the pool
+	void parallelFor(int count, const std::function<void(int)>& func);
+
+	static ThreadPool* Get(); //global pool shared by the engine
+
+private:
+	struct sQueue {
+		std::deque<Job> jobs;
+		std::mutex mutex;
+	};
+
+	std::vector<std::thread> threads;
+	std::vector<sQueue*> queues; //one per worker
+	std::atomic<unsigned int> next_queue; //round robin for jobs added from outside the pool
+	std::atomic<int> queued; //jobs waiting in any queue
+	std::mutex mutex; //only to sleep and to wait
+	std::condition_variable job_available;
+	std::condition_variable all_done;
+	int pending; //jobs queued or running
+	bool must_exit;
+
+	bool popJob(int worker, Job& job); //from its own queue or stolen from the others
+	void workerLoop(int worker);
+};
+
+#endif
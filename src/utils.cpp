@@ -8,6 +8,7 @@
 
 #include "includes.h"
 #include "game.h"
+#include <algorithm>
 
 //returns time in milliseconds
 long getTime()
@@ -105,6 +106,38 @@ bool readFile(const std::string& filename, std::string& content)
 	return true;
 }
 
+#ifndef WIN32
+	#include <dirent.h>
+#endif
+
+std::vector<std::string> listFiles(const std::string& folder)
+{
+	std::vector<std::string> files;
+#ifdef WIN32
+	WIN32_FIND_DATAA data;
+	HANDLE handle = FindFirstFileA((folder + "/*").c_str(), &data);
+	if (handle == INVALID_HANDLE_VALUE)
+		return files;
+	do {
+		if (!(data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+			files.push_back(folder + "/" + data.cFileName);
+	} while (FindNextFileA(handle, &data));
+	FindClose(handle);
+#else
+	DIR* dir = opendir(folder.c_str());
+	if (!dir)
+		return files;
+	while (dirent* entry = readdir(dir))
+	{
+		if (entry->d_name[0] == '.')
+			continue;
+		files.push_back(folder + "/" + entry->d_name);
+	}
+	closedir(dir);
+#endif
+	std::sort(files.begin(), files.end());
+	return files;
+}
 
 bool checkGLErrors()
 {
@@ -35,6 +35,7 @@ bool checkGLErrors();
 //files
 std::string getPath();
 bool readFile(const std::string& filename, std::string& content);
+std::vector<std::string> listFiles(const std::string& folder); //files inside a folder (not recursive), with the folder in the path
 
 //returns the size of the dekstop (not the window, the full desktop)
 Vector2 getDesktopSize( int display_index = 0 );